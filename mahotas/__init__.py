@@ -14,9 +14,10 @@ try:
     from .edge import sobel
     from .euler import euler
     from .histogram import fullhistogram
+    from .integral import integral
     from .labeled import border, borders, bwperim, label, labeled_sum
     from .features.moments import moments
-    from .morph import cerode, close, close_holes, get_structuring_elem, dilate, hitmiss, erode, cwatershed, majority_filter, open, regmin, regmax
+    from .morph import cerode, close, close_holes, get_structuring_elem, dilate, hitmiss, erode, cwatershed, majority_filter, open, regmin, regmax, tophat_open, tophat_close
     from .resize import imresize
     from .stretch import stretch, as_rgb
     from .thin import thin
@@ -71,6 +72,7 @@ __all__ = [
     'ihaar',
     'hitmiss',
     'imresize',
+    'integral',
     'label',
     'labeled_sum',
     'majority_filter',
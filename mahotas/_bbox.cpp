@@ -102,8 +102,60 @@ PyObject* py_bbox(PyObject* self, PyObject* args) {
 }
 
 
+// Bounding boxes of all labels at once. bboxes is a C-contiguous
+// (nr_labels x 2*ndims) array in the same format as the output of bbox.
+void labeled_bbox(numpy::aligned_array<int> labeled, numpy::aligned_array<npy_intp> bboxes) {
+    gil_release nogil;
+    const int nd = labeled.ndims();
+    const npy_intp nr_labels = bboxes.dim(0);
+    for (npy_intp i = 0; i != nr_labels; ++i) {
+        npy_intp* extrema = bboxes.data(i);
+        for (int j = 0; j != nd; ++j) {
+            extrema[2*j] = labeled.dim(j);
+            extrema[2*j+1] = 0;
+        }
+    }
+    const int N = labeled.size();
+    numpy::aligned_array<int>::iterator pos = labeled.begin();
+    for (int i = 0; i != N; ++i, ++pos) {
+        const int label = *pos;
+        if (label < 0 || label >= nr_labels) {
+            throw PythonException(PyExc_ValueError, "mahotas.labeled_bbox: label is out of range");
+        }
+        npy_intp* extrema = bboxes.data(label);
+        numpy::position where = pos.position();
+        for (int j = 0; j != nd; ++j) {
+            extrema[2*j] = std::min<npy_intp>(extrema[2*j], where[j]);
+            extrema[2*j+1] = std::max<npy_intp>(extrema[2*j+1], where[j]+1);
+        }
+    }
+    for (npy_intp i = 0; i != nr_labels; ++i) {
+        npy_intp* extrema = bboxes.data(i);
+        if (extrema[1] == 0) std::fill(extrema, extrema + 2*nd, 0);
+    }
+}
+
+PyObject* py_labeled_bbox(PyObject* self, PyObject* args) {
+    PyArrayObject* labeled;
+    PyArrayObject* bboxes;
+    if (!PyArg_ParseTuple(args,"OO", &labeled, &bboxes) ||
+        !numpy::are_arrays(labeled, bboxes) ||
+        PyArray_TYPE(labeled) != NPY_INT ||
+        PyArray_TYPE(bboxes) != numpy::index_type_number || !PyArray_ISCARRAY(bboxes) ||
+        PyArray_NDIM(bboxes) != 2 || PyArray_DIM(bboxes, 1) != 2*PyArray_NDIM(labeled)) {
+        PyErr_SetString(PyExc_RuntimeError, TypeErrorMsg);
+        return NULL;
+    }
+    try {
+        labeled_bbox(numpy::aligned_array<int>(labeled), numpy::aligned_array<npy_intp>(bboxes));
+    }
+    CATCH_PYTHON_EXCEPTIONS(true)
+    Py_RETURN_NONE;
+}
+
 PyMethodDef methods[] = {
   {"bbox",(PyCFunction)py_bbox, METH_VARARGS, NULL},
+  {"labeled_bbox",(PyCFunction)py_labeled_bbox, METH_VARARGS, NULL},
   {NULL, NULL,0,NULL},
 };
 
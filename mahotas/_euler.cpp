@@ -0,0 +1,183 @@
+// Copyright (C) 2012, Luis Pedro Coelho <luis@luispedro.org>
+// vim: set ts=4 sts=4 sw=4 expandtab smartindent:
+//
+// License: MIT
+
+#include <algorithm>
+#include <vector>
+
+#include "numpypp/array.hpp"
+#include "numpypp/dispatch.hpp"
+#include "utils.hpp"
+
+extern "C" {
+    #include <Python.h>
+    #include <numpy/ndarrayobject.h>
+}
+
+namespace{
+
+const char TypeErrorMsg[] =
+    "Type not understood. "
+    "This is caused by either a direct call to _euler (which is dangerous: types are not checked!) or a bug in mahotas.\n";
+
+// std::vector<bool> cannot be used as a plain buffer
+template <typename T>
+struct buffer_type { typedef T type; };
+template <>
+struct buffer_type<bool> { typedef unsigned char type; };
+
+// Copies a row of f into buffer, leaving a zero at each end of buffer.
+template <typename T, typename B>
+void load_row(const numpy::aligned_array<T>& f, const T* row, B* buffer) {
+    const npy_intp step = f.stride(f.ndims() - 1);
+    const npy_intp N = f.dim(f.ndims() - 1);
+    for (npy_intp x = 0; x != N; ++x, row += step) buffer[x+1] = *row;
+}
+
+template <typename T>
+void check_label(const T v, const npy_intp nlabels) {
+    if (v < 0 || npy_intp(v) >= nlabels) {
+        throw PythonException(PyExc_ValueError, "mahotas.euler: label is out of range");
+    }
+}
+
+// Counts the patterns in the window values[0..Nw) for each (nonzero) label in it.
+// The pattern of label v is the integer whose bit i is set if values[i] == v
+template <typename T, int Nw>
+void count_patterns(const T* values, numpy::aligned_array<npy_intp>& counts) {
+    for (int i = 0; i != Nw; ++i) {
+        const T v = values[i];
+        if (!v) continue;
+        bool seen = false;
+        for (int j = 0; j != i; ++j) {
+            if (values[j] == v) {
+                seen = true;
+                break;
+            }
+        }
+        if (seen) continue;
+        check_label(v, counts.dim(0));
+        int code = 0;
+        for (int j = i; j != Nw; ++j) {
+            if (values[j] == v) code |= (1 << j);
+        }
+        ++counts.data(npy_intp(v))[code];
+    }
+}
+
+// The image is taken to be surrounded by zeros. Therefore, there are
+// (N0 + 1) x (N1 + 1) quads, the first and last rows & columns of which
+// include border pixels.
+//
+// Bit order (matching mahotas.euler):
+//      1 2
+//      4 8
+template <typename T>
+void quad_counts2(numpy::aligned_array<T> f, numpy::aligned_array<npy_intp> counts) {
+    gil_release nogil;
+    const npy_intp N0 = f.dim(0);
+    const npy_intp N1 = f.dim(1);
+    typedef typename buffer_type<T>::type B;
+    std::vector<B> top(N1 + 2, B(0));
+    std::vector<B> bottom(N1 + 2, B(0));
+    B values[4];
+    for (npy_intp y = 0; y <= N0; ++y) {
+        std::swap(top, bottom);
+        if (y < N0) load_row(f, f.data(y), &bottom[0]);
+        else std::fill(bottom.begin(), bottom.end(), B(0));
+        for (npy_intp x = 0; x <= N1; ++x) {
+            values[0] = top[x];
+            values[1] = top[x+1];
+            values[2] = bottom[x];
+            values[3] = bottom[x+1];
+            // The most common case: nothing to do
+            if (!values[0] && !values[1] && !values[2] && !values[3]) continue;
+            count_patterns<B,4>(values, counts);
+        }
+    }
+}
+
+// 3-D version of the above: 2x2x2 cubes (256 patterns). Bit (4*dz + 2*dy + dx)
+// corresponds to voxel (z + dz - 1, y + dy - 1, x + dx - 1).
+template <typename T>
+void quad_counts3(numpy::aligned_array<T> f, numpy::aligned_array<npy_intp> counts) {
+    gil_release nogil;
+    const npy_intp N0 = f.dim(0);
+    const npy_intp N1 = f.dim(1);
+    const npy_intp N2 = f.dim(2);
+    const npy_intp rowsize = N2 + 2;
+    const npy_intp planesize = (N1 + 2) * rowsize;
+    typedef typename buffer_type<T>::type B;
+    std::vector<B> top(planesize, B(0));
+    std::vector<B> bottom(planesize, B(0));
+    B values[8];
+    for (npy_intp z = 0; z <= N0; ++z) {
+        std::swap(top, bottom);
+        if (z < N0) {
+            for (npy_intp y = 0; y != N1; ++y) {
+                load_row(f, f.data(z, y), &bottom[(y + 1)*rowsize]);
+            }
+        } else {
+            std::fill(bottom.begin(), bottom.end(), B(0));
+        }
+        for (npy_intp y = 0; y <= N1; ++y) {
+            const B* t0 = &top[y*rowsize];
+            const B* t1 = t0 + rowsize;
+            const B* b0 = &bottom[y*rowsize];
+            const B* b1 = b0 + rowsize;
+            for (npy_intp x = 0; x <= N2; ++x) {
+                values[0] = t0[x];
+                values[1] = t0[x+1];
+                values[2] = t1[x];
+                values[3] = t1[x+1];
+                values[4] = b0[x];
+                values[5] = b0[x+1];
+                values[6] = b1[x];
+                values[7] = b1[x+1];
+                bool any = false;
+                for (int i = 0; i != 8; ++i) any |= bool(values[i]);
+                if (!any) continue;
+                count_patterns<B,8>(values, counts);
+            }
+        }
+    }
+}
+
+PyObject* py_quad_counts(PyObject* self, PyObject* args) {
+    PyArrayObject* array;
+    PyArrayObject* counts;
+    if (!PyArg_ParseTuple(args, "OO", &array, &counts) ||
+        !numpy::are_arrays(array, counts) ||
+        PyArray_TYPE(counts) != numpy::index_type_number ||
+        !PyArray_ISCARRAY(counts) ||
+        PyArray_NDIM(counts) != 2) {
+        PyErr_SetString(PyExc_RuntimeError, TypeErrorMsg);
+        return NULL;
+    }
+    const int nd = PyArray_NDIM(array);
+    if ((nd != 2 && nd != 3) || PyArray_DIM(counts, 1) != (nd == 2 ? 16 : 256)) {
+        PyErr_SetString(PyExc_RuntimeError, TypeErrorMsg);
+        return NULL;
+    }
+    holdref r(counts);
+    PyArray_FILLWBYTE(counts, 0);
+
+#define HANDLE(type) \
+    if (nd == 2) quad_counts2<type>(numpy::aligned_array<type>(array), numpy::aligned_array<npy_intp>(counts)); \
+    else quad_counts3<type>(numpy::aligned_array<type>(array), numpy::aligned_array<npy_intp>(counts));
+    SAFE_SWITCH_ON_INTEGER_TYPES_OF(array, true);
+#undef HANDLE
+
+    Py_INCREF(counts);
+    return PyArray_Return(counts);
+}
+
+PyMethodDef methods[] = {
+  {"quad_counts",(PyCFunction)py_quad_counts, METH_VARARGS, NULL},
+  {NULL, NULL,0,NULL},
+};
+
+} // namespace
+
+DECLARE_MODULE(_euler)
@@ -0,0 +1,178 @@
+// Copyright (C) 2012, Luis Pedro Coelho <luis@luispedro.org>
+// vim: set ts=4 sts=4 sw=4 expandtab smartindent:
+//
+// License: MIT
+
+#include "numpypp/array.hpp"
+#include "numpypp/dispatch.hpp"
+#include "utils.hpp"
+
+extern "C" {
+    #include <Python.h>
+    #include <numpy/ndarrayobject.h>
+}
+
+namespace{
+
+const char TypeErrorMsg[] =
+    "Type not understood. "
+    "This is caused by either a direct call to _integral (which is dangerous: types are not checked!) or a bug in mahotas.\n";
+
+// A 2-D or 3-D array seen as 3-D (2-D arrays have a first dimension of 1).
+// Strides are in elements.
+template <typename T>
+struct volume {
+    volume(numpy::aligned_array<T>& array)
+        :data(array.data())
+        {
+            const int nd = array.ndims();
+            for (int d = 0; d != 3; ++d) {
+                const int ad = d - (3 - nd);
+                dims[d] = (ad >= 0 ? array.dim(ad) : 1);
+                strides[d] = (ad >= 0 ? npy_intp(array.stride(ad)) : 0);
+            }
+        }
+    T* data;
+    npy_intp dims[3];
+    npy_intp strides[3];
+};
+
+// [begin, end) is the part-th of nr_parts blocks in which [0, n) is split
+void block(const npy_intp n, const int part, const int nr_parts, npy_intp& begin, npy_intp& end) {
+    begin = (n * part) / nr_parts;
+    end = (n * (part + 1)) / nr_parts;
+}
+
+// Cumulative sum along the last axis (each line is serial, so the lines are
+// split between the parts). If squared is given, it is first set to the
+// square of the values and then also summed.
+template <typename T>
+void prefix_rows(volume<T> f, volume<T>* squared, const int part, const int nr_parts) {
+    npy_intp r0, r1;
+    block(f.dims[0] * f.dims[1], part, nr_parts, r0, r1);
+    const npy_intp N = f.dims[2];
+    const npy_intp step = f.strides[2];
+    for (npy_intp r = r0; r < r1; ++r) {
+        const npy_intp z = r / f.dims[1];
+        const npy_intp y = r % f.dims[1];
+        T* p = f.data + z*f.strides[0] + y*f.strides[1];
+        if (squared) {
+            T* q = squared->data + z*squared->strides[0] + y*squared->strides[1];
+            const npy_intp qstep = squared->strides[2];
+            T acc = T();
+            T acc2 = T();
+            for (npy_intp x = 0; x != N; ++x, p += step, q += qstep) {
+                const T v = *p;
+                acc += v;
+                acc2 += v*v;
+                *p = acc;
+                *q = acc2;
+            }
+        } else {
+            T acc = T();
+            for (npy_intp x = 0; x != N; ++x, p += step) {
+                acc += *p;
+                *p = acc;
+            }
+        }
+    }
+}
+
+// Cumulative sum along axis (0 or 1), which is done by adding each line to
+// the next one. The lines are split between the parts. Along a contiguous
+// line, the inner loop is trivially vectorizable.
+template <typename T>
+void prefix_axis(volume<T> f, const int axis, const int part, const int nr_parts) {
+    // a: the axis being summed, b & c: the other two (c is always the last one)
+    const int a = axis;
+    const int b = (axis == 0 ? 1 : 0);
+    npy_intp c0, c1;
+    block(f.dims[2], part, nr_parts, c0, c1);
+    const npy_intp sa = f.strides[a];
+    const npy_intp sb = f.strides[b];
+    const npy_intp sc = f.strides[2];
+    for (npy_intp j = 0; j != f.dims[b]; ++j) {
+        for (npy_intp i = 1; i < f.dims[a]; ++i) {
+            T* cur = f.data + i*sa + j*sb;
+            const T* prev = cur - sa;
+            if (sc == 1) {
+                for (npy_intp k = c0; k < c1; ++k) cur[k] += prev[k];
+            } else {
+                for (npy_intp k = c0; k < c1; ++k) cur[k*sc] += prev[k*sc];
+            }
+        }
+    }
+}
+
+template <typename T>
+void integral_pass(numpy::aligned_array<T> array, numpy::aligned_array<T>* squared, const int axis, const int part, const int nr_parts) {
+    gil_release nogil;
+    volume<T> f(array);
+    // axis is the axis of the original array
+    const int vaxis = axis + (3 - array.ndims());
+    if (vaxis == 2) {
+        if (squared) {
+            volume<T> sq(*squared);
+            prefix_rows(f, &sq, part, nr_parts);
+        } else {
+            prefix_rows<T>(f, 0, part, nr_parts);
+        }
+    } else {
+        prefix_axis(f, vaxis, part, nr_parts);
+        if (squared) prefix_axis(volume<T>(*squared), vaxis, part, nr_parts);
+    }
+}
+
+// Performs one pass of the integral image computation (in place) along axis.
+// The last axis must be processed first (as it also computes the squares).
+// Each pass is split into nr_parts, of which this call does part, so that
+// different parts can run in parallel (but all parts of a pass must finish
+// before the next pass starts).
+PyObject* py_integral(PyObject* self, PyObject* args) {
+    PyArrayObject* array;
+    PyObject* squared_obj;
+    int axis;
+    int part;
+    int nr_parts;
+    if (!PyArg_ParseTuple(args, "OOiii", &array, &squared_obj, &axis, &part, &nr_parts) ||
+        !PyArray_Check(array) ||
+        (PyArray_NDIM(array) != 2 && PyArray_NDIM(array) != 3) ||
+        axis < 0 || axis >= PyArray_NDIM(array) ||
+        part < 0 || nr_parts <= part) {
+        PyErr_SetString(PyExc_RuntimeError, TypeErrorMsg);
+        return NULL;
+    }
+    PyArrayObject* squared = 0;
+    if (squared_obj != Py_None) {
+        if (!PyArray_Check(squared_obj)) {
+            PyErr_SetString(PyExc_RuntimeError, TypeErrorMsg);
+            return NULL;
+        }
+        squared = reinterpret_cast<PyArrayObject*>(squared_obj);
+        if (!numpy::arrays_of_same_shape_type(array, squared)) {
+            PyErr_SetString(PyExc_RuntimeError, TypeErrorMsg);
+            return NULL;
+        }
+    }
+
+#define HANDLE(type) \
+    if (squared) { \
+        numpy::aligned_array<type> sq(squared); \
+        integral_pass<type>(numpy::aligned_array<type>(array), &sq, axis, part, nr_parts); \
+    } else { \
+        integral_pass<type>(numpy::aligned_array<type>(array), 0, axis, part, nr_parts); \
+    }
+    SAFE_SWITCH_ON_TYPES_OF(array, true);
+#undef HANDLE
+
+    Py_RETURN_NONE;
+}
+
+PyMethodDef methods[] = {
+  {"integral",(PyCFunction)py_integral, METH_VARARGS, NULL},
+  {NULL, NULL,0,NULL},
+};
+
+} // namespace
+
+DECLARE_MODULE(_integral)
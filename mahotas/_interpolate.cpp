@@ -30,6 +30,7 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <algorithm>
 #include <cstdlib>
 #include <cmath>
 #include <vector>
@@ -143,7 +144,7 @@ void spline_filter1d(numpy::aligned_array<FT> array, const int order, const int
 template <typename FT>
 void spline_coefficients(FT x, const int order, std::vector<FT>& result)
 {
-    const FT start = floor(x + 0.5*(order & 1)) - order / 2;
+    const FT start = floor(x + ((order & 1) ? 0. : 0.5)) - order / 2;
 
     for(int hh = 0; hh <= order; hh++)  {
         FT y = fabs(start - x + hh);
@@ -205,160 +206,379 @@ void spline_coefficients(FT x, const int order, std::vector<FT>& result)
     }
 }
 
+/* Maps a (real valued) coordinate into [0, len - 1] according to the
+ * boundary mode. Returns -1 for points outside in constant mode.
+ */
+double map_coordinate(double in, const npy_intp len, const int mode) {
+    // Zoom coordinates which should land exactly on the last element may
+    // overshoot it by a rounding error:
+    if (in > len - 1 && in < len - 1 + 1e-9) in = len - 1;
+    if (in < 0) {
+        switch (mode) {
+        case EXTEND_MIRROR:
+            if (len <= 1) {
+                in = 0;
+            } else {
+                const npy_intp sz2 = 2 * len - 2;
+                in = sz2 * npy_intp(-in / sz2) + in;
+                in = in <= 1 - len ? in + sz2 : -in;
+            }
+            break;
+        case EXTEND_REFLECT:
+            if (len <= 1) {
+                in = 0;
+            } else {
+                const npy_intp sz2 = 2 * len;
+                if (in < -sz2) in = sz2 * npy_intp(-in / sz2) + in;
+                in = in < -len ? in + sz2 : -in - 1;
+            }
+            break;
+        case EXTEND_WRAP:
+            if (len <= 1) {
+                in = 0;
+            } else {
+                const npy_intp sz = len - 1;
+                in += sz * (npy_intp(-in / sz) + 1);
+            }
+            break;
+        case EXTEND_NEAREST:
+            in = 0;
+            break;
+        case EXTEND_CONSTANT:
+            in = -1;
+            break;
+        }
+    } else if (in > len - 1) {
+        switch (mode) {
+        case EXTEND_MIRROR:
+            if (len <= 1) {
+                in = 0;
+            } else {
+                const npy_intp sz2 = 2 * len - 2;
+                in -= sz2 * npy_intp(in / sz2);
+                if (in >= len) in = sz2 - in;
+            }
+            break;
+        case EXTEND_REFLECT:
+            if (len <= 1) {
+                in = 0;
+            } else {
+                const npy_intp sz2 = 2 * len;
+                in -= sz2 * npy_intp(in / sz2);
+                if (in >= len) in = sz2 - in - 1;
+            }
+            break;
+        case EXTEND_WRAP:
+            if (len <= 1) {
+                in = 0;
+            } else {
+                const npy_intp sz = len - 1;
+                in -= sz * npy_intp(in / sz);
+            }
+            break;
+        case EXTEND_NEAREST:
+            in = len - 1;
+            break;
+        case EXTEND_CONSTANT:
+            in = -1;
+            break;
+        }
+    }
+    return in;
+}
+
+/* Folds a sample index (which may fall up to order/2 + 1 positions outside
+ * the input) back into [0, len) by mirroring.
+ */
 inline
-int int_pow(const int x, const int p) {
-    int r = 1;
-    for (int i = 0; i != p; ++i) r *= x;
-    return r;
+npy_intp mirror_index(npy_intp idx, const npy_intp len) {
+    if (len <= 1) return 0;
+    const npy_intp s2 = 2 * len - 2;
+    if (idx < 0) {
+        idx = s2 * (-idx / s2) + idx;
+        idx = idx <= 1 - len ? idx + s2 : -idx;
+    } else if (idx >= len) {
+        idx -= s2 * (idx / s2);
+        if (idx >= len) idx = s2 - idx;
+    }
+    return idx;
 }
 
+/* The samples used to interpolate at each output position along one axis:
+ * output position k is the sum of weights[k*(order+1) + h] times the input at
+ * position indices[k*(order+1) + h] (for h in [0, order]).
+ *
+ * outside[k] is true if the output position is outside the input (in constant
+ * mode).
+ */
+template <typename FT>
+struct axis_table {
+    std::vector<npy_intp> indices;
+    std::vector<FT> weights;
+    std::vector<bool> outside;
+};
+
+template <typename FT>
+void build_axis_table(axis_table<FT>& table, const npy_intp out_len, const npy_intp in_len,
+                        const double* zoom, const double* shift, const int order, const int mode) {
+    const int nsamples = order + 1;
+    table.indices.resize(out_len * nsamples);
+    table.weights.resize(out_len * nsamples);
+    table.outside.assign(out_len, false);
+    std::vector<FT> coefficients(nsamples);
+    for (npy_intp k = 0; k != out_len; ++k) {
+        double cc = k;
+        if (shift) cc += *shift;
+        if (zoom) cc *= *zoom;
+        cc = map_coordinate(cc, in_len, mode);
+        if (cc == -1) {
+            table.outside[k] = true;
+            continue;
+        }
+        const npy_intp start = npy_intp(std::floor(cc + ((order & 1) ? 0. : 0.5)) - order / 2);
+        if (order > 0) {
+            spline_coefficients(FT(cc), order, coefficients);
+        } else {
+            coefficients[0] = 1.;
+        }
+        for (int hh = 0; hh <= order; ++hh) {
+            table.indices[k*nsamples + hh] = mirror_index(start + hh, in_len);
+            table.weights[k*nsamples + hh] = coefficients[hh];
+        }
+    }
+}
+
+/* Zooming & shifting are separable, so they are performed one axis at a time
+ * (each output value along an axis is a combination of order + 1 values,
+ * instead of (order + 1)^rank values for all axes at once).
+ *
+ * Pass r interpolates along axis r, from an array whose first r dimensions
+ * are those of the output (and the rest those of the input) into one where the
+ * first r + 1 are. The intermediate arrays are contiguous, and the inner loop
+ * (over the axes after r) adds whole contiguous lines.
+ */
 template <typename FT>
 void zoom_shift(numpy::aligned_array<FT> array, PyArrayObject* zoom_ar,
                                  PyArrayObject* shift_ar, numpy::aligned_array<FT> output,
                                  int order, int mode, FT cval) {
     gil_release nogil;
-    typename numpy::aligned_array<FT>::iterator io = output.begin();
-    FT *zooms = zoom_ar ? (FT*)PyArray_DATA(zoom_ar) : NULL;
-    FT *shifts = shift_ar ? (FT*)PyArray_DATA(shift_ar) : NULL;
+    const double* zooms = zoom_ar ? (const double*)PyArray_DATA(zoom_ar) : NULL;
+    const double* shifts = shift_ar ? (const double*)PyArray_DATA(shift_ar) : NULL;
     const int rank = array.ndims();
+    const int nsamples = order + 1;
+    if (output.size() == 0) return;
 
-    std::vector< std::vector<bool> > zeros;
-    /* if the mode is 'constant' we need some temps later: */
-    if (mode == EXTEND_CONSTANT) {
-        for(int r = 0; r < rank; r++) {
-            zeros.push_back( std::vector<bool>(output.dim(r)) );
-        }
-    }
-
-    /* store offsets, along each axis: */
-    std::vector< std::vector<npy_intp> > offsets;
-    /* store spline coefficients, along each axis: */
-    std::vector< std::vector< std::vector<FT> > > splvals;
-    /* store offsets at all edges: */
-    std::vector< std::vector< std::vector<npy_intp> > > edge_offsets;
-    for(int r = 0; r < rank; ++r) {
-        offsets.push_back( std::vector<npy_intp>(output.dim(r)) );
-        splvals.push_back( std::vector< std::vector<FT> >(output.dim(r)) );
-        edge_offsets.push_back( std::vector< std::vector<npy_intp> >(output.dim(r)) );
+    std::vector< axis_table<FT> > tables(rank);
+    for (int r = 0; r != rank; ++r) {
+        build_axis_table(tables[r], output.dim(r), array.dim(r),
+                    zooms ? zooms + r : 0, shifts ? shifts + r : 0, order, mode);
     }
 
-    /* precalculate offsets, and offsets at the edge: */
-    for(int r = 0; r < rank; r++) {
-        double shift = 0.0, zoom = 0.0;
-        if (shifts) shift = shifts[r];
-        if (zooms) zoom = zooms[r];
-        for(int kk = 0; kk < output.dim(r); ++kk) {
-            FT cc = kk;
-            if (shifts) cc += shift;
-            if (zooms) cc *= zoom;
-            cc = fix_offset(ExtendMode(mode), cc, array.dim(r));
-            if (cc != -1) {
-                const int start = int(floor(cc + 0.5*(order & 1)) - order / 2);
-                offsets[r][kk] = array.stride(r) * start;
-                if (start < 0 || start + order >= array.dim(r)) {
-                    edge_offsets[r][kk].resize(order + 1);
-                    for(int hh = 0; hh <= order; hh++) {
-                        int idx = start + hh;
-                         int len = array.dim(r);
-                        if (len <= 1) {
-                            idx = 0;
-                        } else {
-                            int s2 = 2 * len - 2;
-                            if (idx < 0) {
-                                idx = s2 * (int)(-idx / s2) + idx;
-                                idx = idx <= 1 - len ? idx + s2 : -idx;
-                            } else if (idx >= len) {
-                                idx -= s2 * (int)(idx / s2);
-                                if (idx >= len)
-                                    idx = s2 - idx;
-                            }
-                        }
-                        edge_offsets[r][kk][hh] = array.stride(r) * (idx - start);
-                    }
+    std::vector<npy_intp> shape(rank);
+    for (int r = 0; r != rank; ++r) shape[r] = array.dim(r);
+
+    // outer_outside[o] is true if any of the (output) coordinates in the
+    // first r dimensions of outer index o is outside (in constant mode)
+    std::vector<bool> outer_outside(1, false);
+
+    std::vector<FT> buffer;
+    std::vector<FT> next;
+    const FT* src = array.data();
+    for (int r = 0; r != rank; ++r) {
+        npy_intp outer = 1;
+        for (int j = 0; j != r; ++j) outer *= shape[j];
+        npy_intp inner = 1;
+        for (int j = r + 1; j != rank; ++j) inner *= shape[j];
+        const npy_intp in_len = shape[r];
+        const npy_intp out_len = output.dim(r);
+
+        FT* dst;
+        if (r == rank - 1) {
+            dst = output.data();
+        } else {
+            next.resize(outer * out_len * inner);
+            dst = &next[0];
+        }
+        const axis_table<FT>& table = tables[r];
+        for (npy_intp o = 0; o != outer; ++o) {
+            const FT* src_block = src + o * in_len * inner;
+            FT* dst_block = dst + o * out_len * inner;
+            for (npy_intp k = 0; k != out_len; ++k) {
+                FT* dline = dst_block + k * inner;
+                if (outer_outside[o] || table.outside[k]) {
+                    std::fill(dline, dline + inner, cval);
+                    continue;
                 }
-                if (order > 0) {
-
-                    splvals[r][kk].resize(order + 1);
-                    spline_coefficients(cc, order, splvals[r][kk]);
+                const npy_intp* indices = &table.indices[k * nsamples];
+                const FT* weights = &table.weights[k * nsamples];
+                if (inner == 1) {
+                    FT t = 0.;
+                    for (int hh = 0; hh != nsamples; ++hh) t += weights[hh] * src_block[indices[hh]];
+                    *dline = t;
+                } else {
+                    const FT* sline = src_block + indices[0] * inner;
+                    const FT w0 = weights[0];
+                    for (npy_intp i = 0; i != inner; ++i) dline[i] = w0 * sline[i];
+                    for (int hh = 1; hh != nsamples; ++hh) {
+                        const FT w = weights[hh];
+                        sline = src_block + indices[hh] * inner;
+                        for (npy_intp i = 0; i != inner; ++i) dline[i] += w * sline[i];
+                    }
                 }
-            } else {
-                zeros[r][kk] = true;
             }
         }
-    }
 
-    const int filter_size = int_pow(order + 1, rank);
-    std::vector<npy_intp> idxs(filter_size);
-    std::vector<npy_intp> fcoordinates(rank * filter_size);
-    std::vector<npy_intp> foffsets(filter_size);
-
-    std::vector<npy_intp> ftmp(rank);
-    int off = 0;
-    for(int hh = 0; hh < filter_size; hh++) {
-        for(int r = 0; r < rank; r++)
-            fcoordinates[r + hh * rank] = ftmp[r];
-        foffsets[hh] = off;
-        for(int r = rank - 1; r >= 0; r--) {
-            if (ftmp[r] < order) {
-                ftmp[r]++;
-                off += array.stride(r);
-                break;
-            } else {
-                ftmp[r] = 0;
-                off -= array.stride(r) * order;
+        std::vector<bool> next_outside(outer * out_len);
+        for (npy_intp o = 0; o != outer; ++o) {
+            for (npy_intp k = 0; k != out_len; ++k) {
+                next_outside[o * out_len + k] = outer_outside[o] || table.outside[k];
             }
         }
+        outer_outside.swap(next_outside);
+        shape[r] = out_len;
+        buffer.swap(next);
+        src = (buffer.empty() ? 0 : &buffer[0]);
     }
-    const npy_intp size = output.size();
-    for(int i = 0; i < size; ++i, ++io) {
-        int oo = 0;
-        bool on_edge = false;
-        bool zero = false;
-        for(int r = 0; r < rank; r++) {
-            if (zeros.size() && zeros[r][io.index(r)]) {
-                /* we use constant border condition */
-                *io = cval;
-                zero = true;
-                break;
+}
+
+
+// [begin, end) is the part-th of nr_parts blocks in which [0, n) is split
+void block(const npy_intp n, const int part, const int nr_parts, npy_intp& begin, npy_intp& end) {
+    begin = (n * part) / nr_parts;
+    end = (n * (part + 1)) / nr_parts;
+}
+
+/* Interpolates the (prefiltered) input at arbitrary coordinates.
+ *
+ * For each point, the order + 1 sample offsets & weights along each axis are
+ * computed (as in build_axis_table) and the (order + 1)^rank products are
+ * summed one axis at a time.
+ */
+template <typename FT>
+struct spline_sampler {
+    spline_sampler(numpy::aligned_array<FT>& array, const int order, const int mode, const FT cval)
+        :data_(array.data())
+        ,rank_(array.ndims())
+        ,order_(order)
+        ,mode_(mode)
+        ,cval_(cval)
+        ,dims_(rank_)
+        ,strides_(rank_)
+        ,offsets_(rank_ * (order + 1))
+        ,weights_(rank_ * (order + 1))
+        ,coefficients_(order + 1)
+        {
+            for (int d = 0; d != rank_; ++d) {
+                dims_[d] = array.dim(d);
+                strides_[d] = array.stride(d);
             }
-            oo += offsets[r][io.index(r)];
-            if (edge_offsets[r][io.index(r)].size()) on_edge = true;
         }
-        if (zero) continue;
-        std::vector<npy_intp>::const_iterator ff = fcoordinates.begin();
-        for(int fi = 0; fi < filter_size; fi++) {
-            int idx = 0;
-            if (on_edge) {
-                    /* use precalculated edge offsets: */
-                for(int r = 0; r < rank; r++) {
-                    if (edge_offsets[r][io.index(r)].size())
-                        idx += edge_offsets[r][io.index(r)][ff[r]];
-                    else
-                        idx += ff[r] * array.stride(r);
-                }
-                idx += oo;
+
+    FT sample(const double* coordinates) {
+        const int nsamples = order_ + 1;
+        for (int d = 0; d != rank_; ++d) {
+            const double cc = map_coordinate(coordinates[d], dims_[d], mode_);
+            if (cc == -1) return cval_;
+            const npy_intp start = npy_intp(std::floor(cc + ((order_ & 1) ? 0. : 0.5)) - order_ / 2);
+            if (order_ > 0) {
+                spline_coefficients(FT(cc), order_, coefficients_);
             } else {
-                /* use normal offsets: */
-                idx += oo + foffsets[fi];
+                coefficients_[0] = 1.;
             }
-            idxs[fi] = idx;
-            ff += rank;
+            for (int hh = 0; hh != nsamples; ++hh) {
+                offsets_[d*nsamples + hh] = mirror_index(start + hh, dims_[d]) * strides_[d];
+                weights_[d*nsamples + hh] = coefficients_[hh];
+            }
+        }
+        return accumulate(0, 0);
+    }
+
+    private:
+    FT accumulate(const int d, const npy_intp base) const {
+        const int nsamples = order_ + 1;
+        const npy_intp* offsets = &offsets_[d * nsamples];
+        const FT* weights = &weights_[d * nsamples];
+        FT t = 0.;
+        if (d == rank_ - 1) {
+            for (int hh = 0; hh != nsamples; ++hh) t += weights[hh] * data_[base + offsets[hh]];
+        } else {
+            for (int hh = 0; hh != nsamples; ++hh) t += weights[hh] * accumulate(d + 1, base + offsets[hh]);
+        }
+        return t;
+    }
+
+    const FT* data_;
+    const int rank_;
+    const int order_;
+    const int mode_;
+    const FT cval_;
+    std::vector<npy_intp> dims_;
+    std::vector<npy_intp> strides_;
+    std::vector<npy_intp> offsets_;
+    std::vector<FT> weights_;
+    std::vector<FT> coefficients_;
+};
+
+/* output[o] = array[matrix * o + offset]
+ *
+ * The output lines along the last axis are split into nr_parts blocks, of
+ * which this call computes part. Along each line, the input coordinates
+ * advance by the last column of the matrix.
+ */
+template <typename FT>
+void affine_transform(numpy::aligned_array<FT> array, const double* matrix, const double* offset,
+                        numpy::aligned_array<FT> output, int order, int mode, FT cval,
+                        const int part, const int nr_parts) {
+    gil_release nogil;
+    if (output.size() == 0) return;
+    const int irank = array.ndims();
+    const int orank = output.ndims();
+    spline_sampler<FT> sampler(array, order, mode, cval);
+
+    const npy_intp line_len = output.dim(orank - 1);
+    npy_intp r0, r1;
+    block(output.size() / line_len, part, nr_parts, r0, r1);
+
+    std::vector<double> base(irank);
+    std::vector<double> coordinates(irank);
+    for (npy_intp r = r0; r < r1; ++r) {
+        for (int i = 0; i != irank; ++i) base[i] = offset[i];
+        npy_intp rest = r;
+        for (int j = orank - 2; j >= 0; --j) {
+            const npy_intp idx = rest % output.dim(j);
+            rest /= output.dim(j);
+            for (int i = 0; i != irank; ++i) base[i] += matrix[i*orank + j] * idx;
         }
-        ff = fcoordinates.begin();
-        FT t = 0.0;
-        for(int fi = 0; fi < filter_size; fi++) {
-            double coeff = array.data()[idxs[fi]];
-            /* calculate interpolated value: */
-            for(int r = 0; r < rank; r++)
-                if (order > 0)
-                    coeff *= splvals[r][io.index(r)][ff[r]];
-            t += coeff;
-            ff += rank;
+        FT* out = output.data() + r * line_len;
+        for (npy_intp k = 0; k != line_len; ++k) {
+            for (int i = 0; i != irank; ++i) coordinates[i] = base[i] + matrix[i*orank + orank - 1] * k;
+            out[k] = sampler.sample(&coordinates[0]);
         }
-        *io = t;
     }
 }
 
+/* output[o] = array[coordinates[:, o]]
+ *
+ * The output is split into nr_parts blocks, of which this call computes part.
+ */
+template <typename FT>
+void map_coordinates(numpy::aligned_array<FT> array, const double* coordinates,
+                        numpy::aligned_array<FT> output, int order, int mode, FT cval,
+                        const int part, const int nr_parts) {
+    gil_release nogil;
+    const int rank = array.ndims();
+    const npy_intp N = output.size();
+    spline_sampler<FT> sampler(array, order, mode, cval);
+    npy_intp i0, i1;
+    block(N, part, nr_parts, i0, i1);
+
+    std::vector<double> point(rank);
+    FT* out = output.data();
+    for (npy_intp i = i0; i < i1; ++i) {
+        for (int d = 0; d != rank; ++d) point[d] = coordinates[d*N + i];
+        out[i] = sampler.sample(&point[0]);
+    }
+}
 
 
 PyObject* py_spline_filter1d(PyObject* self, PyObject* args) {
@@ -390,22 +610,27 @@ PyObject* py_zoom_shift(PyObject* self, PyObject* args) {
     int order;
     int mode;
     double cval;
-    if (!PyArg_ParseTuple(args,"OOOOiif", &array, &zooms, &shifts, &output, &order, &mode, &cval)) return NULL;
+    if (!PyArg_ParseTuple(args,"OOOOiid", &array, &zooms, &shifts, &output, &order, &mode, &cval)) return NULL;
     if (!PyArray_Check(array) || !PyArray_ISCARRAY(array) ||
-        !PyArray_Check(output) || !PyArray_ISCARRAY(output)) {
+        !PyArray_Check(output) || !PyArray_ISCARRAY(output) ||
+        !PyArray_EquivTypenums(PyArray_TYPE(array), PyArray_TYPE(output)) ||
+        PyArray_NDIM(array) != PyArray_NDIM(output) ||
+        order < 0 || order > 5) {
         PyErr_SetString(PyExc_RuntimeError, TypeErrorMsg);
         return NULL;
     }
     if (!PyArray_Check(zooms)) {
         zooms = 0;
-    } else if (!PyArray_ISCARRAY(zooms)) {
+    } else if (!PyArray_ISCARRAY(zooms) || PyArray_TYPE(zooms) != NPY_DOUBLE ||
+                PyArray_NDIM(zooms) != 1 || PyArray_DIM(zooms, 0) != PyArray_NDIM(array)) {
         PyErr_SetString(PyExc_RuntimeError, TypeErrorMsg);
         return NULL;
     }
 
     if (!PyArray_Check(shifts)) {
         shifts = 0;
-    } else if (!PyArray_ISCARRAY(shifts)) {
+    } else if (!PyArray_ISCARRAY(shifts) || PyArray_TYPE(shifts) != NPY_DOUBLE ||
+                PyArray_NDIM(shifts) != 1 || PyArray_DIM(shifts, 0) != PyArray_NDIM(array)) {
         PyErr_SetString(PyExc_RuntimeError, TypeErrorMsg);
         return NULL;
     }
@@ -421,7 +646,79 @@ PyObject* py_zoom_shift(PyObject* self, PyObject* args) {
     Py_RETURN_NONE;
 }
 
+PyObject* py_affine_transform(PyObject* self, PyObject* args) {
+    PyArrayObject* array;
+    PyArrayObject* matrix;
+    PyArrayObject* offset;
+    PyArrayObject* output;
+    int order;
+    int mode;
+    double cval;
+    int part;
+    int nr_parts;
+    if (!PyArg_ParseTuple(args,"OOOOiidii", &array, &matrix, &offset, &output, &order, &mode, &cval, &part, &nr_parts)) return NULL;
+    if (!PyArray_Check(array) || !PyArray_ISCARRAY(array) ||
+        !PyArray_Check(output) || !PyArray_ISCARRAY(output) ||
+        !PyArray_EquivTypenums(PyArray_TYPE(array), PyArray_TYPE(output)) ||
+        PyArray_NDIM(array) < 1 || PyArray_NDIM(output) < 1 ||
+        !PyArray_Check(matrix) || !PyArray_ISCARRAY(matrix) || PyArray_TYPE(matrix) != NPY_DOUBLE ||
+        PyArray_NDIM(matrix) != 2 ||
+        PyArray_DIM(matrix, 0) != PyArray_NDIM(array) || PyArray_DIM(matrix, 1) != PyArray_NDIM(output) ||
+        !PyArray_Check(offset) || !PyArray_ISCARRAY(offset) || PyArray_TYPE(offset) != NPY_DOUBLE ||
+        PyArray_NDIM(offset) != 1 || PyArray_DIM(offset, 0) != PyArray_NDIM(array) ||
+        order < 0 || order > 5 ||
+        part < 0 || nr_parts <= part) {
+        PyErr_SetString(PyExc_RuntimeError, TypeErrorMsg);
+        return NULL;
+    }
+    holdref array_hr(array);
+    holdref output_hr(output);
+    const double* matrix_data = static_cast<const double*>(PyArray_DATA(matrix));
+    const double* offset_data = static_cast<const double*>(PyArray_DATA(offset));
+#define HANDLE(type) \
+    affine_transform<type>(numpy::aligned_array<type>(array), matrix_data, offset_data, numpy::aligned_array<type>(output), order, mode, type(cval), part, nr_parts);
+    SAFE_SWITCH_ON_FLOAT_TYPES_OF(array, true);
+#undef HANDLE
+
+    Py_RETURN_NONE;
+}
+
+PyObject* py_map_coordinates(PyObject* self, PyObject* args) {
+    PyArrayObject* array;
+    PyArrayObject* coordinates;
+    PyArrayObject* output;
+    int order;
+    int mode;
+    double cval;
+    int part;
+    int nr_parts;
+    if (!PyArg_ParseTuple(args,"OOOiidii", &array, &coordinates, &output, &order, &mode, &cval, &part, &nr_parts)) return NULL;
+    if (!PyArray_Check(array) || !PyArray_ISCARRAY(array) ||
+        !PyArray_Check(output) || !PyArray_ISCARRAY(output) ||
+        !PyArray_EquivTypenums(PyArray_TYPE(array), PyArray_TYPE(output)) ||
+        PyArray_NDIM(array) < 1 ||
+        !PyArray_Check(coordinates) || !PyArray_ISCARRAY(coordinates) || PyArray_TYPE(coordinates) != NPY_DOUBLE ||
+        PyArray_NDIM(coordinates) < 1 || PyArray_DIM(coordinates, 0) != PyArray_NDIM(array) ||
+        PyArray_SIZE(coordinates) != PyArray_NDIM(array) * PyArray_SIZE(output) ||
+        order < 0 || order > 5 ||
+        part < 0 || nr_parts <= part) {
+        PyErr_SetString(PyExc_RuntimeError, TypeErrorMsg);
+        return NULL;
+    }
+    holdref array_hr(array);
+    holdref output_hr(output);
+    const double* coordinates_data = static_cast<const double*>(PyArray_DATA(coordinates));
+#define HANDLE(type) \
+    map_coordinates<type>(numpy::aligned_array<type>(array), coordinates_data, numpy::aligned_array<type>(output), order, mode, type(cval), part, nr_parts);
+    SAFE_SWITCH_ON_FLOAT_TYPES_OF(array, true);
+#undef HANDLE
+
+    Py_RETURN_NONE;
+}
+
 PyMethodDef methods[] = {
+  {"affine_transform",(PyCFunction)py_affine_transform, METH_VARARGS, NULL},
+  {"map_coordinates",(PyCFunction)py_map_coordinates, METH_VARARGS, NULL},
   {"spline_filter1d",(PyCFunction)py_spline_filter1d, METH_VARARGS, NULL},
   {"zoom_shift",(PyCFunction)py_zoom_shift, METH_VARARGS, NULL},
   {NULL, NULL,0,NULL},
@@ -4,6 +4,7 @@
 // License: MIT
 
 #include <algorithm>
+#include <cmath>
 #include <queue>
 #include <vector>
 #include <cstdio>
@@ -309,6 +310,493 @@ PyObject* py_dilate(PyObject* self, PyObject* args) {
     return PyArray_Return(output);
 }
 
+// Fused morphological operators
+//
+// These compute open/close (and the derived top-hats & gradient) in a single
+// sweep over the first axis of a 3-D array (lower dimensional arrays are
+// passed in with extra axes of size 1 after the first one, so that a slab of
+// a 2-D image is one of its rows), keeping only a few slabs (planes
+// orthogonal to the first axis) of the intermediate result.
+//
+// The results are exactly the same as composing erode() & dilate() above:
+// erosion is a gather and dilation a scatter, both with per-axis clamping of
+// the coordinates (EXTEND_NEAREST).
+
+enum fused_operation {
+    fused_open = 0,
+    fused_close = 1,
+    fused_tophat_open = 2,
+    fused_tophat_close = 3,
+    fused_gradient = 4
+};
+
+template <typename T>
+struct se_entry {
+    npy_intp dz, dy, dx;
+    T b;
+};
+
+// Elements equal to the minimum of T have no effect on either erode_sub or
+// dilate_add (for bool, these are the elements not in the structuring element)
+template <typename T>
+std::vector<se_entry<T> > se_entries(const numpy::aligned_array<T>& Bc) {
+    std::vector<se_entry<T> > res;
+    for (npy_intp z = 0; z != Bc.dim(0); ++z) {
+        for (npy_intp y = 0; y != Bc.dim(1); ++y) {
+            for (npy_intp x = 0; x != Bc.dim(2); ++x) {
+                const T b = Bc.at(z, y, x);
+                if (b == std::numeric_limits<T>::min()) continue;
+                se_entry<T> e;
+                e.dz = z - Bc.dim(0)/2;
+                e.dy = y - Bc.dim(1)/2;
+                e.dx = x - Bc.dim(2)/2;
+                e.b = b;
+                res.push_back(e);
+            }
+        }
+    }
+    return res;
+}
+
+inline
+npy_intp clamp_index(const npy_intp i, const npy_intp N) {
+    if (i < 0) return 0;
+    if (i >= N) return N - 1;
+    return i;
+}
+
+// Rows of a 3-D array (or, if period is non-zero, of a ring buffer of
+// `period` slabs)
+template <typename T>
+struct slab_rows {
+    slab_rows(T* base, npy_intp s0, npy_intp s1, npy_intp s2, npy_intp period = 0)
+        :base_(base)
+        ,s0_(s0)
+        ,s1_(s1)
+        ,s2_(s2)
+        ,period_(period)
+        { }
+
+    T* row(npy_intp z, const npy_intp y) const {
+        if (period_) z %= period_;
+        return base_ + z*s0_ + y*s1_;
+    }
+    npy_intp step(npy_intp = 0) const { return s2_; }
+
+    T* base_;
+    npy_intp s0_, s1_, s2_;
+    npy_intp period_;
+};
+
+// Splits [0, N) into the values of x for which x + dx is below the range,
+// inside it, and above it.
+inline
+void clamp_split(const npy_intp dx, const npy_intp N, npy_intp& lo, npy_intp& hi) {
+    lo = std::min<npy_intp>(std::max<npy_intp>(-dx, 0), N);
+    hi = std::max<npy_intp>(std::min<npy_intp>(N - dx, N), lo);
+}
+
+// Erosion of row (z,y), written to `out`
+template <typename T, typename Source>
+void erode_row(const Source& src, const npy_intp z, const npy_intp y, const npy_intp* dims, const std::vector<se_entry<T> >& entries, T* out, const npy_intp out_step) {
+    const npy_intp N2 = dims[2];
+    for (npy_intp x = 0; x != N2; ++x) out[x*out_step] = std::numeric_limits<T>::max();
+    for (typename std::vector<se_entry<T> >::const_iterator e = entries.begin(); e != entries.end(); ++e) {
+        const npy_intp sz = clamp_index(z + e->dz, dims[0]);
+        const T* row = src.row(sz, clamp_index(y + e->dy, dims[1]));
+        const npy_intp step = src.step(sz);
+        npy_intp lo, hi;
+        clamp_split(e->dx, N2, lo, hi);
+        npy_intp x = 0;
+        for ( ; x != lo; ++x) out[x*out_step] = std::min<T>(out[x*out_step], erode_sub(row[0], e->b));
+        for ( ; x != hi; ++x) out[x*out_step] = std::min<T>(out[x*out_step], erode_sub(row[(x + e->dx)*step], e->b));
+        for ( ; x != N2; ++x) out[x*out_step] = std::min<T>(out[x*out_step], erode_sub(row[(N2 - 1)*step], e->b));
+    }
+}
+
+// Dilation (scatter) of row (z,y) of src into dst
+template <typename T, typename Source>
+void dilate_row(const Source& src, const npy_intp z, const npy_intp y, const npy_intp* dims, const std::vector<se_entry<T> >& entries, const slab_rows<T>& dst) {
+    const npy_intp N2 = dims[2];
+    const T* row = src.row(z, y);
+    const npy_intp step = src.step();
+    const npy_intp dstep = dst.step();
+    for (typename std::vector<se_entry<T> >::const_iterator e = entries.begin(); e != entries.end(); ++e) {
+        T* drow = dst.row(clamp_index(z + e->dz, dims[0]), clamp_index(y + e->dy, dims[1]));
+        npy_intp lo, hi;
+        clamp_split(e->dx, N2, lo, hi);
+        npy_intp x = 0;
+        for ( ; x != lo; ++x) drow[0] = std::max<T>(drow[0], dilate_add(row[x*step], e->b));
+        for ( ; x != hi; ++x) {
+            T& t = drow[(x + e->dx)*dstep];
+            t = std::max<T>(t, dilate_add(row[x*step], e->b));
+        }
+        for ( ; x != N2; ++x) drow[(N2 - 1)*dstep] = std::max<T>(drow[(N2 - 1)*dstep], dilate_add(row[x*step], e->b));
+    }
+}
+
+template <typename T>
+T fused_subtract(const T a, const T b) { return a - b; }
+
+template <>
+bool fused_subtract<bool>(const bool a, const bool b) { return a && !b; }
+
+// Rows of the dilated image while closing in place: slabs up to `current`
+// have been saved to the ring buffer (as they are being overwritten), later
+// ones are still in the output.
+template <typename T>
+struct close_source {
+    close_source(const slab_rows<T>& saved, const slab_rows<T>& res, const npy_intp current)
+        :saved_(saved)
+        ,res_(res)
+        ,current_(current)
+        { }
+    const T* row(const npy_intp z, const npy_intp y) const {
+        return (z <= current_ ? saved_.row(z, y) : res_.row(z, y));
+    }
+    npy_intp step(const npy_intp z) const {
+        return (z <= current_ ? saved_.step() : res_.step());
+    }
+
+    const slab_rows<T>& saved_;
+    const slab_rows<T>& res_;
+    const npy_intp current_;
+};
+
+template <typename T>
+void fused_morph(numpy::aligned_array<T> res, numpy::aligned_array<T> f, numpy::aligned_array<T> Bc, const fused_operation op) {
+    gil_release nogil;
+    const npy_intp dims[3] = { f.dim(0), f.dim(1), f.dim(2) };
+    const npy_intp N0 = dims[0];
+    const npy_intp N1 = dims[1];
+    const npy_intp N2 = dims[2];
+    const npy_intp slab_size = N1*N2;
+    const std::vector<se_entry<T> > entries = se_entries(Bc);
+    npy_intp dzmin = 0;
+    npy_intp dzmax = 0;
+    for (typename std::vector<se_entry<T> >::const_iterator e = entries.begin(); e != entries.end(); ++e) {
+        dzmin = std::min(dzmin, e->dz);
+        dzmax = std::max(dzmax, e->dz);
+    }
+
+    const slab_rows<T> input(f.data(), f.stride(0), f.stride(1), f.stride(2));
+    const slab_rows<T> output(res.data(), res.stride(0), res.stride(1), res.stride(2));
+    for (npy_intp z = 0; z != N0; ++z) {
+        for (npy_intp y = 0; y != N1; ++y) {
+            T* row = output.row(z, y);
+            for (npy_intp x = 0; x != N2; ++x) row[x*output.step()] = std::numeric_limits<T>::min();
+        }
+    }
+
+    // The scatter of slab z (the dilation) only writes to slabs from
+    // (z + dzmin) to (z + dzmax) (clamped), so that, after it, all slabs
+    // below (z + dzmin) are final (except for the last slab, which may
+    // receive values until the end).
+    //
+    // For open & gradient, the erosion is a gather from the input. For close,
+    // it is a gather from the dilated slabs, which needs (dzmax - dzmin) slabs
+    // of lookahead and (-dzmin) slabs of the dilated image which have already
+    // been overwritten (these are saved in a ring buffer).
+    const bool dilate_first = (op == fused_close || op == fused_tophat_close);
+    const npy_intp lag = (dilate_first ? dzmax - dzmin : -dzmin);
+    const npy_intp nr_buffer_slabs = (dilate_first ? (1 - dzmin) : 1);
+    T* buffer = new T[nr_buffer_slabs * slab_size];
+    const slab_rows<T> buffer_rows(buffer, slab_size, N2, 1, nr_buffer_slabs);
+    npy_intp next = 0;
+    for (npy_intp z = 0; z != N0 || next != N0; ) {
+        if (z != N0) {
+            if (op == fused_open || op == fused_tophat_open) {
+                for (npy_intp y = 0; y != N1; ++y) {
+                    erode_row(input, z, y, dims, entries, buffer_rows.row(z, y), 1);
+                }
+                for (npy_intp y = 0; y != N1; ++y) {
+                    dilate_row(buffer_rows, z, y, dims, entries, output);
+                }
+            } else {
+                for (npy_intp y = 0; y != N1; ++y) {
+                    dilate_row(input, z, y, dims, entries, output);
+                }
+            }
+            ++z;
+        }
+        // Finalize all slabs which can be finalized
+        const npy_intp limit = (z == N0 ? N0 : std::min(z - 1 - lag, N0 - 2));
+        for ( ; next <= limit && next != N0; ++next) {
+            if (dilate_first) {
+                for (npy_intp y = 0; y != N1; ++y) {
+                    const T* row = output.row(next, y);
+                    T* saved = buffer_rows.row(next, y);
+                    for (npy_intp x = 0; x != N2; ++x) saved[x] = row[x*output.step()];
+                }
+                const close_source<T> dilated(buffer_rows, output, next);
+                for (npy_intp y = 0; y != N1; ++y) {
+                    erode_row(dilated, next, y, dims, entries, output.row(next, y), output.step());
+                }
+            }
+            if (op == fused_open || op == fused_close) continue;
+            for (npy_intp y = 0; y != N1; ++y) {
+                T* row = output.row(next, y);
+                const T* frow = input.row(next, y);
+                const npy_intp step = output.step();
+                const npy_intp fstep = input.step();
+                if (op == fused_tophat_open) {
+                    for (npy_intp x = 0; x != N2; ++x) row[x*step] = fused_subtract(frow[x*fstep], row[x*step]);
+                } else if (op == fused_tophat_close) {
+                    for (npy_intp x = 0; x != N2; ++x) row[x*step] = fused_subtract(row[x*step], frow[x*fstep]);
+                } else {
+                    T* eroded = buffer_rows.row(next, y);
+                    erode_row(input, next, y, dims, entries, eroded, 1);
+                    for (npy_intp x = 0; x != N2; ++x) row[x*step] = fused_subtract(row[x*step], eroded[x]);
+                }
+            }
+        }
+    }
+    delete [] buffer;
+}
+
+PyObject* py_fused_morph(PyObject* self, PyObject* args) {
+    PyArrayObject* array;
+    PyArrayObject* Bc;
+    PyArrayObject* output;
+    int op;
+    if (!PyArg_ParseTuple(args,"OOOi", &array, &Bc, &output, &op)) return NULL;
+    if (!numpy::are_arrays(array, Bc, output) || !numpy::same_shape(array, output) ||
+        !numpy::equiv_typenums(array, Bc, output) ||
+        PyArray_NDIM(array) != 3 ||
+        PyArray_NDIM(Bc) != 3 ||
+        op < fused_open || op > fused_gradient
+    ) {
+        PyErr_SetString(PyExc_RuntimeError, TypeErrorMsg);
+        return NULL;
+    }
+    holdref r_o(output);
+#define HANDLE(type) \
+    fused_morph<type>(numpy::aligned_array<type>(output), numpy::aligned_array<type>(array), numpy::aligned_array<type>(Bc), fused_operation(op));
+    SAFE_SWITCH_ON_INTEGER_TYPES_OF(array, true);
+#undef HANDLE
+
+    Py_XINCREF(output);
+    return PyArray_Return(output);
+}
+
+// Decomposed erosion & dilation
+//
+// For flat structuring elements (all elements in the support have the same
+// value, c) which are symmetric along each axis and whose intersection with
+// any line parallel to an axis is an interval (e.g., disks, diamonds,
+// octagons), erosion is
+//
+//      min_{rows dy of Bc} min_{|dx| <= w(dy)} g(y + dy, x + dx)
+//
+// where g = erode_sub(f, c)
+// (with coordinates clamped to the image as in erode() above). The inner
+// minimum is a range query on a single row of f, which is answered in
+// constant time from a table of minima over power-of-2 windows, so that each
+// row of Bc costs a few operations per pixel, independently of its width.
+// Because Bc is symmetric, the (scatter) dilation above is equal to the
+// same computation with max & dilate_add.
+//
+// Boxes in other than 2 dimensions are decomposed into a sequence of one
+// dimensional filters along each axis.
+
+template <typename T, bool is_max>
+inline
+T extremum(const T a, const T b) {
+    return (is_max ? std::max<T>(a, b) : std::min<T>(a, b));
+}
+
+template <typename T, bool is_max>
+inline
+T apply_flat_value(const T v, const T c) {
+    return (is_max ? dilate_add(v, c) : erode_sub(v, c));
+}
+
+template <typename T, bool is_max>
+void chord_filter(numpy::aligned_array<T> res, numpy::aligned_array<T> f, const npy_intp* widths, const npy_intp nr_rows, const T c) {
+    gil_release nogil;
+    const npy_intp N0 = f.dim(0);
+    const npy_intp N1 = f.dim(1);
+    if (!N0 || !N1) return;
+    const npy_intp r = nr_rows/2;
+    npy_intp max_width = 0;
+    for (npy_intp i = 0; i != nr_rows; ++i) max_width = std::max(max_width, widths[i]);
+    const npy_intp max_length = std::min(2*max_width + 1, N1);
+
+    std::vector<int> log2(max_length + 1);
+    for (npy_intp n = 2; n <= max_length; ++n) log2[n] = log2[n/2] + 1;
+    const npy_intp nr_levels = log2[max_length] + 1;
+
+    // Tables for the rows currently in use. Slot (yy % nr_rows) holds row yy,
+    // level k of the table is a row where x holds the extremum of
+    // f[yy, x:x + 2**k]
+    const npy_intp table_size = nr_levels * N1;
+    T* tables = new T[nr_rows * table_size];
+    std::vector<npy_intp> table_row(nr_rows, -1);
+    T* acc = new T[N1];
+    const T identity = (is_max ? std::numeric_limits<T>::min() : std::numeric_limits<T>::max());
+
+    for (npy_intp y = 0; y != N0; ++y) {
+        std::fill(acc, acc + N1, identity);
+        for (npy_intp dy = -r; dy <= r; ++dy) {
+            const npy_intp w = widths[dy + r];
+            if (w < 0) continue;
+            const npy_intp yy = clamp_index(y + dy, N0);
+            T* table = tables + (yy % nr_rows) * table_size;
+            if (table_row[yy % nr_rows] != yy) {
+                const T* frow = f.data(yy);
+                const npy_intp step = f.stride(1);
+                for (npy_intp x = 0; x != N1; ++x) table[x] = apply_flat_value<T, is_max>(frow[x*step], c);
+                for (npy_intp k = 1; k != nr_levels; ++k) {
+                    const T* prev = table + (k - 1)*N1;
+                    T* cur = table + k*N1;
+                    const npy_intp half = npy_intp(1) << (k - 1);
+                    for (npy_intp x = 0; x + 2*half <= N1; ++x) {
+                        cur[x] = extremum<T, is_max>(prev[x], prev[x + half]);
+                    }
+                }
+                table_row[yy % nr_rows] = yy;
+            }
+
+            // Pixels whose window is inside the row
+            const npy_intp length = 2*w + 1;
+            if (length <= N1) {
+                const int k = log2[length];
+                const T* level = table + k*N1;
+                const npy_intp shift = length - (npy_intp(1) << k);
+                for (npy_intp x = w; x < N1 - w; ++x) {
+                    acc[x] = extremum<T, is_max>(acc[x], extremum<T, is_max>(level[x - w], level[x - w + shift]));
+                }
+            }
+            // Pixels whose window is clamped
+            for (npy_intp x = 0; x != N1; ++x) {
+                if (x == w && w < N1 - w) x = N1 - w;
+                if (x == N1) break;
+                const npy_intp lo = std::max<npy_intp>(x - w, 0);
+                const npy_intp hi = std::min<npy_intp>(x + w, N1 - 1);
+                const int k = log2[hi - lo + 1];
+                const T* level = table + k*N1;
+                acc[x] = extremum<T, is_max>(acc[x], extremum<T, is_max>(level[lo], level[hi + 1 - (npy_intp(1) << k)]));
+            }
+        }
+        T* rrow = res.data(y);
+        const npy_intp rstep = res.stride(1);
+        for (npy_intp x = 0; x != N1; ++x) rrow[x*rstep] = acc[x];
+    }
+    delete [] acc;
+    delete [] tables;
+}
+
+// Filters `lanes` adjacent lines (each of length N, with stride `step`) in
+// place by a window of half-size h, with nearest extension, using the van
+// Herk/Gil-Werman algorithm (3 operations per element). Filtering adjacent
+// lines together keeps memory access contiguous.
+//
+// buffer must have space for 3*(N + 2*h)*lanes elements
+template <typename T, bool is_max>
+void lines_filter(T* lines, const npy_intp N, const npy_intp step, const npy_intp lanes, const npy_intp h, T* buffer) {
+    const npy_intp size = 2*h + 1;
+    const npy_intp M = N + 2*h;
+    T* padded = buffer;
+    T* prefix = buffer + M*lanes;
+    T* suffix = buffer + 2*M*lanes;
+    for (npy_intp i = 0; i != M; ++i) {
+        const T* src = lines + clamp_index(i - h, N)*step;
+        std::copy(src, src + lanes, padded + i*lanes);
+    }
+    for (npy_intp start = 0; start < M; start += size) {
+        const npy_intp end = std::min(start + size, M);
+        std::copy(padded + start*lanes, padded + (start + 1)*lanes, prefix + start*lanes);
+        for (npy_intp i = start + 1; i != end; ++i) {
+            for (npy_intp j = 0; j != lanes; ++j) {
+                prefix[i*lanes + j] = extremum<T, is_max>(prefix[(i - 1)*lanes + j], padded[i*lanes + j]);
+            }
+        }
+        std::copy(padded + (end - 1)*lanes, padded + end*lanes, suffix + (end - 1)*lanes);
+        for (npy_intp i = end - 1; i != start; --i) {
+            for (npy_intp j = 0; j != lanes; ++j) {
+                suffix[(i - 1)*lanes + j] = extremum<T, is_max>(suffix[i*lanes + j], padded[(i - 1)*lanes + j]);
+            }
+        }
+    }
+    for (npy_intp i = 0; i != N; ++i) {
+        T* out = lines + i*step;
+        const T* s = suffix + i*lanes;
+        const T* p = prefix + (i + size - 1)*lanes;
+        for (npy_intp j = 0; j != lanes; ++j) out[j] = extremum<T, is_max>(s[j], p[j]);
+    }
+}
+
+// res must be C-contiguous (and may be the same array as f)
+template <typename T, bool is_max>
+void box_filter(numpy::aligned_array<T> res, numpy::aligned_array<T> f, const npy_intp* halfsizes, const T c) {
+    gil_release nogil;
+    const int nd = f.ndims();
+    const npy_intp N = f.size();
+    T* rdata = res.data();
+    typename numpy::aligned_array<T>::iterator iter = f.begin();
+    for (npy_intp i = 0; i != N; ++i, ++iter) rdata[i] = apply_flat_value<T, is_max>(*iter, c);
+    if (!N) return;
+
+    const npy_intp max_lanes = 64;
+    npy_intp inner = N;
+    for (int d = 0; d != nd; ++d) {
+        const npy_intp Nd = f.dim(d);
+        inner /= Nd;
+        const npy_intp h = halfsizes[d];
+        if (!h) continue;
+        const npy_intp outer = N / (Nd * inner);
+        const npy_intp lanes = std::min(inner, max_lanes);
+        T* buffer = new T[3*(Nd + 2*h)*lanes];
+        for (npy_intp o = 0; o != outer; ++o) {
+            for (npy_intp i = 0; i < inner; i += lanes) {
+                lines_filter<T, is_max>(rdata + o*Nd*inner + i, Nd, inner, std::min(lanes, inner - i), h, buffer);
+            }
+        }
+        delete [] buffer;
+    }
+}
+
+PyObject* py_decomposed_erode_dilate(PyObject* self, PyObject* args) {
+    PyArrayObject* array;
+    PyArrayObject* sizes;
+    PyArrayObject* c;
+    PyArrayObject* output;
+    int is_box;
+    int is_dilate;
+    if (!PyArg_ParseTuple(args,"OOOOii", &array, &sizes, &c, &output, &is_box, &is_dilate)) return NULL;
+    if (!numpy::are_arrays(array, sizes) || !numpy::are_arrays(c, output) ||
+        !numpy::same_shape(array, output) ||
+        !numpy::equiv_typenums(array, c, output) ||
+        PyArray_TYPE(sizes) != numpy::index_type_number ||
+        !PyArray_ISCARRAY(sizes) ||
+        !PyArray_ISCARRAY(output) ||
+        PyArray_SIZE(c) != 1 ||
+        (is_box && PyArray_SIZE(sizes) != PyArray_NDIM(array)) ||
+        (!is_box && PyArray_NDIM(array) != 2)
+    ) {
+        PyErr_SetString(PyExc_RuntimeError, TypeErrorMsg);
+        return NULL;
+    }
+    holdref r_o(output);
+    const npy_intp* sizes_data = static_cast<const npy_intp*>(PyArray_DATA(sizes));
+#define HANDLE(type) \
+    { \
+        const type cval = *static_cast<const type*>(PyArray_DATA(c)); \
+        if (is_box) { \
+            if (is_dilate) box_filter<type, true>(numpy::aligned_array<type>(output), numpy::aligned_array<type>(array), sizes_data, cval); \
+            else box_filter<type, false>(numpy::aligned_array<type>(output), numpy::aligned_array<type>(array), sizes_data, cval); \
+        } else { \
+            if (is_dilate) chord_filter<type, true>(numpy::aligned_array<type>(output), numpy::aligned_array<type>(array), sizes_data, PyArray_SIZE(sizes), cval); \
+            else chord_filter<type, false>(numpy::aligned_array<type>(output), numpy::aligned_array<type>(array), sizes_data, PyArray_SIZE(sizes), cval); \
+        } \
+    }
+    SAFE_SWITCH_ON_INTEGER_TYPES_OF(array, true);
+#undef HANDLE
+
+    Py_XINCREF(output);
+    return PyArray_Return(output);
+}
+
 void close_holes(numpy::aligned_array<bool> ref, numpy::aligned_array<bool> f, numpy::aligned_array<bool> Bc) {
     std::fill_n(f.data(),f. size(), false);
 
@@ -616,54 +1104,607 @@ PyObject* py_hitmiss(PyObject* self, PyObject* args) {
     return PyArray_Return(res_a);
 }
 
+// The 3x3 neighbourhood of a pixel is encoded as a 9-bit code, where bit
+// (3*c + r) is the value of the pixel at (y + r - 1, x + c - 1). Each column
+// of the neighbourhood thus occupies 3 consecutive bits and moving one pixel
+// to the right is just a shift by 3 and the insertion of a new column.
+// Pixels outside the image are taken to be zero.
+struct hitmiss_lut_rows {
+    hitmiss_lut_rows(const npy_intp ncols)
+        :prev_(ncols + 2, 0)
+        ,cur_(ncols + 2, 0)
+        ,next_(ncols + 2, 0)
+        { }
+
+    void load_next(const numpy::aligned_array<bool>& f, const npy_intp y) {
+        if (y >= f.dim(0)) {
+            std::fill(next_.begin(), next_.end(), 0);
+            return;
+        }
+        const bool* fp = f.data(y);
+        const npy_intp step = f.stride(1);
+        for (npy_intp x = 0; x != f.dim(1); ++x, fp += step) next_[x+1] = *fp;
+    }
+    void advance() {
+        std::swap(prev_, cur_);
+        std::swap(cur_, next_);
+    }
+    int column(const npy_intp x) const {
+        return prev_[x] | (cur_[x] << 1) | (next_[x] << 2);
+    }
+    bool centre(const npy_intp x) const { return cur_[x+1]; }
+
+    std::vector<unsigned char> prev_;
+    std::vector<unsigned char> cur_;
+    std::vector<unsigned char> next_;
+};
+
+// If remove is true, all pixels whose code is marked in lut are
+// simultaneously set to false in f (and res is ignored). Otherwise, the
+// result of the lookup is written to res.
+// Returns whether any pixel was set (or removed).
+bool hitmiss_lut_pass(numpy::aligned_array<bool> f, const bool* lut, numpy::aligned_array<bool> res, const bool remove) {
+    const npy_intp rows = f.dim(0);
+    const npy_intp cols = f.dim(1);
+    hitmiss_lut_rows buffer(cols);
+    bool any = false;
+    buffer.load_next(f, 0);
+    for (npy_intp y = 0; y != rows; ++y) {
+        buffer.advance();
+        buffer.load_next(f, y + 1);
+        bool* out = (remove ? f.data(y) : res.data(y));
+        const npy_intp step = (remove ? f.stride(1) : res.stride(1));
+        int code = (buffer.column(0) << 3) | (buffer.column(1) << 6);
+        for (npy_intp x = 0; x != cols; ++x, out += step) {
+            code = (code >> 3) | (buffer.column(x + 2) << 6);
+            const bool match = lut[code];
+            if (remove) {
+                if (match && buffer.centre(x)) {
+                    *out = false;
+                    any = true;
+                }
+            } else {
+                *out = match;
+                any |= match;
+            }
+        }
+    }
+    return any;
+}
+
+PyObject* py_hitmiss_lut(PyObject* self, PyObject* args) {
+    PyArrayObject* array;
+    PyArrayObject* lut;
+    PyArrayObject* res_a;
+    if (!PyArg_ParseTuple(args, "OOO", &array, &lut, &res_a) ||
+        !numpy::are_arrays(array, lut, res_a) ||
+        PyArray_TYPE(array) != NPY_BOOL || PyArray_TYPE(res_a) != NPY_BOOL ||
+        PyArray_NDIM(array) != 2 || !numpy::same_shape(array, res_a) ||
+        PyArray_TYPE(lut) != NPY_BOOL || !PyArray_ISCARRAY(lut) ||
+        PyArray_NDIM(lut) != 1 || PyArray_DIM(lut, 0) != 512) {
+        PyErr_SetString(PyExc_RuntimeError,TypeErrorMsg);
+        return NULL;
+    }
+    holdref r(res_a);
+    try {
+        gil_release nogil;
+        hitmiss_lut_pass(numpy::aligned_array<bool>(array),
+                        static_cast<const bool*>(PyArray_DATA(lut)),
+                        numpy::aligned_array<bool>(res_a),
+                        false);
+    }
+    CATCH_PYTHON_EXCEPTIONS(true)
+
+    Py_INCREF(res_a);
+    return PyArray_Return(res_a);
+}
+
+PyObject* py_hitmiss_lut_remove(PyObject* self, PyObject* args) {
+    PyArrayObject* array;
+    PyArrayObject* lut;
+    int max_iter;
+    if (!PyArg_ParseTuple(args, "OOi", &array, &lut, &max_iter) ||
+        !numpy::are_arrays(array, lut) ||
+        PyArray_TYPE(array) != NPY_BOOL || PyArray_NDIM(array) != 2 ||
+        PyArray_TYPE(lut) != NPY_BOOL || !PyArray_ISCARRAY(lut) ||
+        PyArray_NDIM(lut) != 1 || PyArray_DIM(lut, 0) != 512) {
+        PyErr_SetString(PyExc_RuntimeError,TypeErrorMsg);
+        return NULL;
+    }
+    int iters = 0;
+    try {
+        gil_release nogil;
+        numpy::aligned_array<bool> f(array);
+        // max_iter < 0 means iterate until there are no more changes
+        while (iters != max_iter) {
+            if (!hitmiss_lut_pass(f, static_cast<const bool*>(PyArray_DATA(lut)), f, true)) break;
+            ++iters;
+        }
+    }
+    CATCH_PYTHON_EXCEPTIONS(true)
+
+    return PyLong_FromLong(iters);
+}
+
+// Computes the part-th of nr_parts blocks of rows (along the first axis) of
+// the majority filter. Each block only needs the input rows within sizes[0]/2
+// of its own, so the blocks can be computed in parallel.
+void majority_filter(numpy::aligned_array<bool> res, numpy::aligned_array<bool> input, const npy_intp* sizes, const int part, const int nr_parts) {
+    gil_release nogil;
+    const int nd = input.ndims();
+    if (!input.size()) return;
+
+    const npy_intp n0 = input.dim(0);
+    const npy_intp y0 = (n0 * part) / nr_parts;
+    const npy_intp y1 = (n0 * (part + 1)) / nr_parts;
+    if (y0 == y1) return;
+    // The slab [h0, h1) includes the rows needed for the windows of [y0, y1)
+    const npy_intp h0 = std::max<npy_intp>(y0 - sizes[0]/2, 0);
+    const npy_intp h1 = std::min<npy_intp>(y1 + sizes[0]/2, n0);
+
+    npy_intp dims[NPY_MAXDIMS];
+    dims[0] = h1 - h0;
+    for (int d = 1; d != nd; ++d) dims[d] = input.dim(d);
+    npy_intp cstride[NPY_MAXDIMS];
+    cstride[nd - 1] = 1;
+    for (int d = nd - 1; d > 0; --d) cstride[d-1] = cstride[d] * dims[d];
+    const npy_intp N = dims[0] * cstride[0];
+
+    // counts holds, for every pixel of the slab, the number of positive pixels
+    // in its window. It is computed one axis at a time as a running (box) sum,
+    // so that the cost per pixel is O(nd) independently of the window size.
+    std::vector<int> counts(N);
+    {
+        npy_intp pos[NPY_MAXDIMS];
+        std::fill(pos, pos + nd, 0);
+        const bool* base = input.data() + h0 * input.stride(0);
+        for (npy_intp i = 0; i != N; ++i) {
+            npy_intp offset = 0;
+            for (int d = 0; d != nd; ++d) offset += pos[d] * input.stride(d);
+            counts[i] = base[offset];
+            for (int d = nd - 1; d >= 0; --d) {
+                if (++pos[d] != dims[d]) break;
+                pos[d] = 0;
+            }
+        }
+    }
+
+    std::vector<int> partial;
+    for (int d = 0; d != nd; ++d) {
+        const npy_intp len = dims[d];
+        const npy_intp step = cstride[d];
+        const npy_intp r = sizes[d]/2;
+        if (!r) continue;
+        partial.resize(len + 1);
+        // Lines along axis d start at (outer + inner):
+        for (npy_intp outer = 0; outer != N; outer += len*step) {
+            for (npy_intp inner = 0; inner != step; ++inner) {
+                int* line = &counts[outer + inner];
+                partial[0] = 0;
+                for (npy_intp j = 0; j != len; ++j) partial[j+1] = partial[j] + line[j*step];
+                for (npy_intp j = 0; j != len; ++j) {
+                    const npy_intp first = std::max<npy_intp>(j - r, 0);
+                    const npy_intp past = std::min<npy_intp>(j + r + 1, len);
+                    line[j*step] = partial[past] - partial[first];
+                }
+            }
+        }
+    }
+
+    // At the borders, the window is clipped to the image and the threshold is
+    // computed relative to the number of pixels actually inside it.
+    npy_intp pos[NPY_MAXDIMS];
+    std::fill(pos, pos + nd, 0);
+    pos[0] = y0;
+    bool* rpos = res.data() + y0 * cstride[0];
+    for (npy_intp i = (y0 - h0) * cstride[0]; i != (y1 - h0) * cstride[0]; ++i, ++rpos) {
+        npy_intp window = 1;
+        for (int d = 0; d != nd; ++d) {
+            const npy_intp r = sizes[d]/2;
+            const npy_intp first = std::max<npy_intp>(pos[d] - r, 0);
+            const npy_intp past = std::min<npy_intp>(pos[d] + r + 1, input.dim(d));
+            window *= (past - first);
+        }
+        *rpos = (counts[i] >= window/2);
+        for (int d = nd - 1; d >= 0; --d) {
+            if (++pos[d] != input.dim(d)) break;
+            pos[d] = 0;
+        }
+    }
+}
+
 PyObject* py_majority_filter(PyObject* self, PyObject* args) {
     PyArrayObject* array;
+    PyArrayObject* sizes;
     PyArrayObject* res_a;
-    int N;
-    if (!PyArg_ParseTuple(args, "OiO", &array, &N, &res_a) ||
-        !PyArray_Check(array) || !PyArray_Check(res_a) ||
+    int part;
+    int nr_parts;
+    if (!PyArg_ParseTuple(args, "OOOii", &array, &sizes, &res_a, &part, &nr_parts) ||
+        !numpy::are_arrays(array, sizes, res_a) ||
         PyArray_TYPE(array) != NPY_BOOL || PyArray_TYPE(res_a) != NPY_BOOL ||
-        !PyArray_ISCARRAY(res_a)) {
+        !numpy::same_shape(array, res_a) ||
+        !PyArray_ISCARRAY(res_a) ||
+        PyArray_TYPE(sizes) != numpy::index_type_number || !PyArray_ISCARRAY(sizes) ||
+        PyArray_NDIM(sizes) != 1 || PyArray_DIM(sizes, 0) != PyArray_NDIM(array) ||
+        PyArray_NDIM(array) < 1 ||
+        part < 0 || nr_parts <= part) {
         PyErr_SetString(PyExc_RuntimeError,TypeErrorMsg);
         return NULL;
     }
+    holdref r(res_a);
+    try {
+        majority_filter(numpy::aligned_array<bool>(res_a), numpy::aligned_array<bool>(array),
+                    static_cast<const npy_intp*>(PyArray_DATA(sizes)), part, nr_parts);
+    }
+    CATCH_PYTHON_EXCEPTIONS(true)
+
     Py_INCREF(res_a);
-    PyArray_FILLWBYTE(res_a, 0);
-    numpy::aligned_array<bool> input(array);
-    numpy::aligned_array<bool> output(res_a);
-    const int rows = input.dim(0);
-    const int cols = input.dim(1);
-    const int T = N*N/2;
-    if (rows < N || cols < N) {
-        return PyArray_Return(res_a);
-    }
-    for (int y = 0; y != rows-N; ++y) {
-        bool* output_iter = output.data() + (y+int(N/2)) * output.stride(0) + int(N/2);
-        for (int x = 0; x != cols-N; ++x) {
-            int count = 0;
-            for (int dy = 0; dy != N; ++dy) {
-                for (int dx = 0; dx != N; ++dx) {
-                    if (input.at(y+dy,x+dx)) ++count;
+    return PyArray_Return(res_a);
+}
+
+// Component tree (max-tree or min-tree) of an image.
+//
+// This is built with the union-find algorithm of Berger et al. (2007)
+// [as described by Najman & Couprie (2006) and Carlinet & Geraud (2014)]:
+//
+// Pixels are processed from the highest to the lowest (for a max-tree) and
+// each processed pixel becomes the parent of the roots of all the
+// neighbouring (and previously processed) components. Afterwards, the parent
+// links are canonicalized so that each pixel points to the canonical element
+// of its node (which points to the canonical element of the parent node).
+//
+// After construction, S_ holds the pixels in processing order, so that every
+// pixel comes before its parent (and the root is S_.back()).
+template <typename T>
+struct component_tree {
+    component_tree(const numpy::aligned_array<T>& f, const numpy::aligned_array<T>& Bc, const bool is_max)
+        :f_(f.data())
+        ,N_(f.size())
+        ,is_max_(is_max)
+        ,parent_(f.size())
+        ,S_(f.size())
+        {
+            if (!N_) return;
+            sort_pixels();
+            build(f, Bc);
+        }
+
+    // Whether a comes strictly before b in the processing order
+    bool before(const T a, const T b) const { return is_max_ ? (a > b) : (a < b); }
+    bool is_root(const npy_intp p) const { return parent_[p] == p; }
+    bool is_canonical(const npy_intp p) const { return is_root(p) || f_[parent_[p]] != f_[p]; }
+
+    const T* f_;
+    const npy_intp N_;
+    const bool is_max_;
+    std::vector<npy_intp> parent_;
+    std::vector<npy_intp> S_;
+
+    private:
+    struct compare_values {
+        compare_values(const component_tree<T>& tree)
+            :tree(tree)
+            { }
+        bool operator()(const npy_intp a, const npy_intp b) const {
+            return tree.before(tree.f_[a], tree.f_[b]);
+        }
+        const component_tree<T>& tree;
+    };
+
+    void sort_pixels() {
+        if (sizeof(T) <= 2) {
+            // Counting sort: this is the common case of 8 & 16 bit images
+            const npy_intp nbins = (npy_intp(1) << (8*(sizeof(T) <= 2 ? sizeof(T) : 2)));
+            const npy_intp minval = npy_intp(std::numeric_limits<T>::min());
+            std::vector<npy_intp> start(nbins + 1, 0);
+            for (npy_intp i = 0; i != N_; ++i) ++start[npy_intp(f_[i]) - minval + 1];
+            for (npy_intp b = 0; b != nbins; ++b) start[b + 1] += start[b];
+            for (npy_intp i = 0; i != N_; ++i) {
+                const npy_intp b = npy_intp(f_[i]) - minval;
+                const npy_intp idx = start[b]++;
+                S_[is_max_ ? (N_ - 1 - idx) : idx] = i;
+            }
+        } else {
+            for (npy_intp i = 0; i != N_; ++i) S_[i] = i;
+            std::stable_sort(S_.begin(), S_.end(), compare_values(*this));
+        }
+    }
+
+    static npy_intp find_root(std::vector<npy_intp>& zpar, npy_intp p) {
+        while (zpar[p] != p) {
+            zpar[p] = zpar[zpar[p]];
+            p = zpar[p];
+        }
+        return p;
+    }
+
+    void build(const numpy::aligned_array<T>& f, const numpy::aligned_array<T>& Bc) {
+        const int nd = f.ndims();
+        // The neighbourhood is made symmetric (otherwise, connectivity is not well defined)
+        std::vector<numpy::position> Bc_neighbours = neighbours(Bc);
+        const int N2 = Bc_neighbours.size();
+        for (int j = 0; j != N2; ++j) {
+            numpy::position opposite = Bc_neighbours[j];
+            for (int d = 0; d != nd; ++d) opposite.position_[d] = -opposite.position_[d];
+            if (std::find(Bc_neighbours.begin(), Bc_neighbours.end(), opposite) == Bc_neighbours.end()) {
+                Bc_neighbours.push_back(opposite);
+            }
+        }
+        npy_intp cstride[NPY_MAXDIMS];
+        cstride[nd - 1] = 1;
+        for (int d = nd - 1; d > 0; --d) cstride[d-1] = cstride[d] * f.dim(d);
+        std::vector<npy_intp> deltas;
+        for (std::vector<numpy::position>::const_iterator n = Bc_neighbours.begin(); n != Bc_neighbours.end(); ++n) {
+            npy_intp delta = 0;
+            for (int d = 0; d != nd; ++d) delta += (*n)[d] * cstride[d];
+            deltas.push_back(delta);
+        }
+        const int Nn = deltas.size();
+
+        std::vector<npy_intp> zpar(N_, -1);
+        npy_intp pos[NPY_MAXDIMS];
+        for (npy_intp i = 0; i != N_; ++i) {
+            const npy_intp p = S_[i];
+            parent_[p] = p;
+            zpar[p] = p;
+            npy_intp rest = p;
+            for (int d = 0; d != nd; ++d) {
+                pos[d] = rest / cstride[d];
+                rest %= cstride[d];
+            }
+            for (int j = 0; j != Nn; ++j) {
+                bool valid = true;
+                for (int d = 0; d != nd; ++d) {
+                    const npy_intp c = pos[d] + Bc_neighbours[j][d];
+                    if (c < 0 || c >= f.dim(d)) {
+                        valid = false;
+                        break;
+                    }
+                }
+                if (!valid) continue;
+                const npy_intp q = p + deltas[j];
+                if (zpar[q] == -1) continue;
+                const npy_intp r = find_root(zpar, q);
+                if (r != p) {
+                    parent_[r] = p;
+                    zpar[r] = p;
                 }
             }
-            if (count >= T) {
-                *output_iter = true;
+        }
+        for (npy_intp i = N_ - 1; i >= 0; --i) {
+            const npy_intp p = S_[i];
+            const npy_intp q = parent_[p];
+            if (f_[parent_[q]] == f_[q]) parent_[p] = parent_[q];
+        }
+    }
+};
+
+enum tree_attribute {
+    attribute_area = 0,
+    attribute_volume = 1,
+    attribute_height = 2,
+    attribute_extent = 3,
+};
+
+// Computes, for every node of the tree, the highest threshold t (the lowest,
+// for a min-tree) such that the component of the level set at t which
+// contains the node has an attribute of at least `threshold` (the values at
+// non-canonical pixels are meaningless). At level t, the attributes are:
+//
+//  area:       number of pixels
+//  volume:     sum of (|f(x) - t| + 1) over all pixels
+//  height:     |extremum - t| + 1
+//  extent:     largest side of the bounding box
+//
+// Area and extent do not depend on t within a node, so the result is
+// either +/-infinity.
+template <typename T>
+std::vector<double> admissible_levels(const component_tree<T>& tree, const numpy::aligned_array<T>& f, const tree_attribute attribute, const double threshold) {
+    const npy_intp N = tree.N_;
+    const T* fp = tree.f_;
+    const double inf = std::numeric_limits<double>::infinity();
+    const double sign = (tree.is_max_ ? +1. : -1.);
+    std::vector<double> levels(N);
+    if (attribute == attribute_area || attribute == attribute_volume) {
+        std::vector<npy_intp> area(N, 1);
+        std::vector<double> sum(N);
+        for (npy_intp p = 0; p != N; ++p) sum[p] = double(fp[p]);
+        for (npy_intp i = 0; i != N; ++i) {
+            const npy_intp p = tree.S_[i];
+            if (tree.is_root(p)) continue;
+            area[tree.parent_[p]] += area[p];
+            sum[tree.parent_[p]] += sum[p];
+        }
+        for (npy_intp p = 0; p != N; ++p) {
+            if (attribute == attribute_area) {
+                levels[p] = (area[p] >= threshold ? sign*inf : -sign*inf);
+            } else {
+                // sign*(sum - area*t) + area >= threshold
+                const double t = (sum[p] - sign*(threshold - area[p]))/area[p];
+                levels[p] = (tree.is_max_ ? std::floor(t) : std::ceil(t));
+            }
+        }
+    } else if (attribute == attribute_height) {
+        std::vector<T> extremum(fp, fp + N);
+        for (npy_intp i = 0; i != N; ++i) {
+            const npy_intp p = tree.S_[i];
+            if (tree.is_root(p)) continue;
+            const npy_intp q = tree.parent_[p];
+            if (tree.before(extremum[p], extremum[q])) extremum[q] = extremum[p];
+        }
+        for (npy_intp p = 0; p != N; ++p) {
+            // sign*(extremum - t) + 1 >= threshold
+            const double t = double(extremum[p]) - sign*(threshold - 1);
+            levels[p] = (tree.is_max_ ? std::floor(t) : std::ceil(t));
+        }
+    } else if (attribute == attribute_extent) {
+        const int nd = f.ndims();
+        std::vector<npy_intp> lower(N * nd);
+        std::vector<npy_intp> upper(N * nd);
+        for (npy_intp p = 0; p != N; ++p) {
+            npy_intp rest = p;
+            for (int d = nd - 1; d >= 0; --d) {
+                lower[p*nd + d] = upper[p*nd + d] = rest % f.dim(d);
+                rest /= f.dim(d);
             }
-            ++output_iter;
+        }
+        for (npy_intp i = 0; i != N; ++i) {
+            const npy_intp p = tree.S_[i];
+            if (tree.is_root(p)) continue;
+            const npy_intp q = tree.parent_[p];
+            for (int d = 0; d != nd; ++d) {
+                lower[q*nd + d] = std::min(lower[q*nd + d], lower[p*nd + d]);
+                upper[q*nd + d] = std::max(upper[q*nd + d], upper[p*nd + d]);
+            }
+        }
+        for (npy_intp p = 0; p != N; ++p) {
+            npy_intp extent = 0;
+            for (int d = 0; d != nd; ++d) {
+                extent = std::max(extent, upper[p*nd + d] - lower[p*nd + d] + 1);
+            }
+            levels[p] = (extent >= threshold ? sign*inf : -sign*inf);
         }
     }
-    return PyArray_Return(res_a);
+    return levels;
+}
+
+template <typename T>
+void attribute_filter(numpy::aligned_array<T> res, numpy::aligned_array<T> f, numpy::aligned_array<T> Bc, const tree_attribute attribute, const double threshold, const bool is_max) {
+    gil_release nogil;
+    const component_tree<T> tree(f, Bc, is_max);
+    const std::vector<double> levels = admissible_levels(tree, f, attribute, threshold);
+    T* rpos = res.data();
+    // Each node keeps the highest admissible level in the range between its
+    // parent's output and its own level. The root is always kept.
+    for (npy_intp i = tree.N_ - 1; i >= 0; --i) {
+        const npy_intp p = tree.S_[i];
+        const npy_intp q = tree.parent_[p];
+        if (tree.is_root(p)) {
+            rpos[p] = tree.f_[p];
+        } else if (!tree.is_canonical(p)) {
+            rpos[p] = rpos[q];
+        } else if (is_max) {
+            rpos[p] = T(std::max<double>(rpos[q], std::min<double>(tree.f_[p], levels[p])));
+        } else {
+            rpos[p] = T(std::min<double>(rpos[q], std::max<double>(tree.f_[p], levels[p])));
+        }
+    }
+}
+
+PyObject* py_attribute_filter(PyObject* self, PyObject* args) {
+    PyArrayObject* array;
+    PyArrayObject* Bc;
+    PyArrayObject* output;
+    int attribute;
+    double threshold;
+    int is_max;
+    if (!PyArg_ParseTuple(args, "OOOidi", &array, &Bc, &output, &attribute, &threshold, &is_max)) return NULL;
+    if (!numpy::are_arrays(array, Bc, output) || !numpy::same_shape(array, output) ||
+        !numpy::equiv_typenums(array, Bc, output) ||
+        PyArray_NDIM(array) != PyArray_NDIM(Bc) ||
+        !PyArray_ISCARRAY(array) || !PyArray_ISCARRAY(output) ||
+        attribute < attribute_area || attribute > attribute_extent
+    ) {
+        PyErr_SetString(PyExc_RuntimeError, TypeErrorMsg);
+        return NULL;
+    }
+    holdref r_o(output);
+
+#define HANDLE(type) \
+    attribute_filter<type>(numpy::aligned_array<type>(output), numpy::aligned_array<type>(array), numpy::aligned_array<type>(Bc), tree_attribute(attribute), threshold, bool(is_max));
+    SAFE_SWITCH_ON_INTEGER_TYPES_OF(array, true);
+#undef HANDLE
+
+    Py_XINCREF(output);
+    return PyArray_Return(output);
+}
+
+// h-maxima (or h-minima, if !is_max) transform: the reconstruction of f - h
+// under f (f + h over f), computed on the component tree.
+//
+// For a node A with level l and extremum M, the value min(l, M - h) is
+// reachable by the reconstruction. The result at a node is the best value
+// along the path to the root.
+template <typename T>
+void hextrema(numpy::aligned_array<T> res, numpy::aligned_array<T> f, numpy::aligned_array<T> Bc, const T h, const bool is_max) {
+    gil_release nogil;
+    const component_tree<T> tree(f, Bc, is_max);
+    const npy_intp N = tree.N_;
+    std::vector<T> extremum(tree.f_, tree.f_ + N);
+    for (npy_intp i = 0; i != N; ++i) {
+        const npy_intp p = tree.S_[i];
+        if (tree.is_root(p)) continue;
+        const npy_intp q = tree.parent_[p];
+        if (tree.before(extremum[p], extremum[q])) extremum[q] = extremum[p];
+    }
+    T* rpos = res.data();
+    for (npy_intp i = N - 1; i >= 0; --i) {
+        const npy_intp p = tree.S_[i];
+        const npy_intp q = tree.parent_[p];
+        if (!tree.is_canonical(p)) {
+            rpos[p] = rpos[q];
+            continue;
+        }
+        const T M = extremum[p];
+        T value;
+        if (is_max) {
+            // saturated M - h (the caller guarantees that h <= max(T))
+            value = (M < T(std::numeric_limits<T>::min() + h)) ? std::numeric_limits<T>::min() : T(M - h);
+            value = std::min(value, tree.f_[p]);
+            if (!tree.is_root(p)) value = std::max(value, rpos[q]);
+        } else {
+            value = (M > T(std::numeric_limits<T>::max() - h)) ? std::numeric_limits<T>::max() : T(M + h);
+            value = std::max(value, tree.f_[p]);
+            if (!tree.is_root(p)) value = std::min(value, rpos[q]);
+        }
+        rpos[p] = value;
+    }
+}
+
+PyObject* py_hextrema(PyObject* self, PyObject* args) {
+    PyArrayObject* array;
+    PyArrayObject* Bc;
+    PyArrayObject* output;
+    PyArrayObject* h;
+    int is_max;
+    if (!PyArg_ParseTuple(args, "OOOOi", &array, &Bc, &output, &h, &is_max)) return NULL;
+    if (!numpy::are_arrays(array, Bc, output) || !PyArray_Check(h) ||
+        !numpy::same_shape(array, output) ||
+        !numpy::equiv_typenums(array, Bc, output) ||
+        !numpy::equiv_typenums(array, h) ||
+        PyArray_SIZE(h) != 1 ||
+        PyArray_NDIM(array) != PyArray_NDIM(Bc) ||
+        !PyArray_ISCARRAY(array) || !PyArray_ISCARRAY(output)
+    ) {
+        PyErr_SetString(PyExc_RuntimeError, TypeErrorMsg);
+        return NULL;
+    }
+    holdref r_o(output);
+
+#define HANDLE(type) \
+    hextrema<type>(numpy::aligned_array<type>(output), numpy::aligned_array<type>(array), numpy::aligned_array<type>(Bc), *static_cast<const type*>(PyArray_DATA(h)), bool(is_max));
+    SAFE_SWITCH_ON_INTEGER_TYPES_OF(array, true);
+#undef HANDLE
+
+    Py_XINCREF(output);
+    return PyArray_Return(output);
 }
 
 PyMethodDef methods[] = {
   {"dilate",(PyCFunction)py_dilate, METH_VARARGS, NULL},
+  {"fused_morph",(PyCFunction)py_fused_morph, METH_VARARGS, NULL},
+  {"decomposed_erode_dilate",(PyCFunction)py_decomposed_erode_dilate, METH_VARARGS, NULL},
   {"erode",(PyCFunction)py_erode, METH_VARARGS, NULL},
   {"close_holes",(PyCFunction)py_close_holes, METH_VARARGS, NULL},
   {"cwatershed",(PyCFunction)py_cwatershed, METH_VARARGS, NULL},
   {"locmin_max",(PyCFunction)py_locminmax, METH_VARARGS, NULL},
   {"regmin_max",(PyCFunction)py_regminmax, METH_VARARGS, NULL},
   {"hitmiss",(PyCFunction)py_hitmiss, METH_VARARGS, NULL},
+  {"hitmiss_lut",(PyCFunction)py_hitmiss_lut, METH_VARARGS, NULL},
+  {"hitmiss_lut_remove",(PyCFunction)py_hitmiss_lut_remove, METH_VARARGS, NULL},
   {"majority_filter",(PyCFunction)py_majority_filter, METH_VARARGS, NULL},
+  {"attribute_filter",(PyCFunction)py_attribute_filter, METH_VARARGS, NULL},
+  {"hextrema",(PyCFunction)py_hextrema, METH_VARARGS, NULL},
   {NULL, NULL,0,NULL},
 };
 
@@ -63,3 +63,30 @@ def croptobbox(img, border=None):
         max2 += border
     return img[min1:max1,min2:max2]
 
+
+def labeled_bbox(labeled):
+    '''
+    bboxes = labeled_bbox(labeled)
+
+    Bounding boxes of all regions of a labeled image (in a single pass)
+
+    Parameters
+    ----------
+    labeled : ndarray of integers
+        Labeled image (labels must be non-negative)
+
+    Returns
+    -------
+    bboxes : ndarray
+        A ``(labeled.max() + 1) x (2 * labeled.ndim)`` array, where
+        ``bboxes[i]`` is equal to ``bbox(labeled == i)``
+    '''
+    labeled = np.asanyarray(labeled)
+    if labeled.dtype.kind not in 'biu':
+        raise TypeError('mahotas.labeled_bbox: labeled must be of an integer type')
+    if labeled.dtype != np.intc:
+        labeled = labeled.astype(np.intc)
+    nr_labels = (int(labeled.max()) + 1 if labeled.size else 1)
+    bboxes = np.empty((nr_labels, 2*labeled.ndim), np.intp)
+    _bbox.labeled_bbox(labeled, bboxes)
+    return bboxes
@@ -1,9 +1,11 @@
-# Copyright (C) 2008-2010, Luis Pedro Coelho <luis@luispedro.org>
+# Copyright (C) 2008-2012, Luis Pedro Coelho <luis@luispedro.org>
 # vim: set ts=4 sts=4 sw=4 expandtab smartindent:
 # License: MIT
 
+from __future__ import division
 import numpy as np
-from .convolve import convolve
+from . import _euler
+from .internal import _verify_is_integer_type
 
 _euler_lookup4 = np.array([
             0,  1,  1,  0,
@@ -22,23 +24,78 @@ _powers = np.array([
     [4, 8]
     ])
 
-__all__ = ['euler']
+def _compute_euler_lookup26():
+    '''
+    lookup26 = _compute_euler_lookup26()
 
-def euler(f, n=8):
+    Computes the contribution of each 2x2x2 pattern to the Euler number (with
+    26-connectivity), by taking each voxel to be a closed unit cube and
+    counting the vertices, edges, faces, and cubes around the centre of the
+    pattern (each of which is shared by 1, 2, 4, and 8 patterns respectively).
     '''
-    euler_nr = euler(f, n=8)
+    codes = np.arange(256)
+    cube = ((codes[:,np.newaxis] >> np.arange(8)) & 1).astype(np.bool_)
+    cube = cube.reshape((256,2,2,2))
+    V = cube.reshape((256,-1)).any(1)
+    E = 0
+    F = 0
+    for axis in (1,2,3):
+        for side in (0,1):
+            E = E + cube.take(side, axis=axis).reshape((256,-1)).any(1)
+        others = cube.swapaxes(axis, 3)
+        F = F + others.any(3).reshape((256,-1)).sum(1)
+    C = cube.reshape((256,-1)).sum(1)
+    return V - E/2. + F/4. - C/8.
+
+_euler_lookup26 = _compute_euler_lookup26()
+# By duality, the 6-connected Euler number of an object is the 26-connected
+# Euler number of its complement
+_euler_lookup6 = _euler_lookup26[255 - np.arange(256)]
+
+__all__ = [
+    'bitquad_measures',
+    'euler',
+    'labeled_euler',
+    ]
+
+def _lookup(f, n, fname):
+    if f.ndim == 2:
+        lookups = { 4 : _euler_lookup4, 8 : _euler_lookup8 }
+        if n is None:
+            n = 8
+    elif f.ndim == 3:
+        lookups = { 6 : _euler_lookup6, 26 : _euler_lookup26 }
+        if n is None:
+            n = 26
+    else:
+        raise ValueError('mahotas.%s: Only 2-D and 3-D images are supported' % fname)
+    if n not in lookups:
+        raise ValueError('mahotas.%s: Connectivity must be one of %s (for %s-D images)' % (fname, sorted(lookups.keys()), f.ndim))
+    return lookups[n]
+
+def _quad_counts(f, nlabels):
+    counts = np.empty((nlabels, 2**(2**f.ndim)), np.intp)
+    return _euler.quad_counts(f, counts)
+
+def euler(f, n=None):
+    '''
+    euler_nr = euler(f, n={8 for 2-D, 26 for 3-D})
 
     Compute the Euler number of image f
 
     The Euler number is also known as the Euler characteristic given that many
     other mathematical objects are also known as Euler numbers.
 
+    The image is considered to be surrounded by zeros, so that objects touching
+    the border are handled correctly.
+
     Parameters
     ----------
     f : ndarray
-        A 2-D binary image
+        A 2-D or 3-D binary image
     n : int, optional
-        Connectivity, one of (4,8). default: 8
+        Connectivity, one of (4,8) for 2-D images and one of (6,26) for 3-D
+        images. default: 8 (2-D) or 26 (3-D)
 
     Returns
     -------
@@ -54,16 +111,111 @@ def euler(f, n=8):
 
     *A Fast Algorithm for Computing the Euler Number of an Image and its VLSI
     Implementation*, doi: 10.1109/ICVD.2000.812628
+
+    See Also
+    --------
+    labeled_euler : function
+        Euler number of each region in a labeled image
     '''
-    if n == 8:
-        lookup = _euler_lookup8
-    elif n == 4:
-        lookup = _euler_lookup4
-    else:
-        raise ValueError('mahotas.euler: Connectivity must be 4 or 8')
-    if f.dtype is not np.bool:
+    f = np.asanyarray(f)
+    lookup = _lookup(f, n, 'euler')
+    if f.dtype != np.bool_:
         assert np.all( (f == 0) | (f == 1)), 'mahotas.euler: Non-binary image'
         f = (f != 0)
-    value = convolve(f.astype(_powers.dtype), _powers, mode='constant')
-    return lookup[value].sum()
+    counts = _quad_counts(f, 2)
+    return np.dot(counts[1], lookup)
+
+def labeled_euler(labeled, n=None):
+    '''
+    euler_nrs = labeled_euler(labeled, n={8 for 2-D, 26 for 3-D})
+
+    Compute the Euler number of each region in a labeled image
+
+    This is computed in a single pass over the image (i.e., it is much faster
+    than calling ``euler`` on each region).
+
+    Parameters
+    ----------
+    labeled : ndarray of integers
+        A 2-D or 3-D labeled image (labels should be non-negative)
+    n : int, optional
+        Connectivity (see ``euler``)
+
+    Returns
+    -------
+    euler_nrs : ndarray
+        ``euler_nrs[i]`` is the Euler number of region ``i`` (``euler_nrs[0]``
+        is always zero).
+
+    See Also
+    --------
+    euler : function
+    '''
+    labeled = np.asanyarray(labeled)
+    _verify_is_integer_type(labeled, 'labeled_euler')
+    lookup = _lookup(labeled, n, 'labeled_euler')
+    nlabels = (labeled.max() + 1 if labeled.size else 1)
+    counts = _quad_counts(labeled, nlabels)
+    return np.dot(counts, lookup)
+
+def bitquad_measures(f, n=8, method='gray', labeled=False):
+    '''
+    euler_nr, area, perimeter = bitquad_measures(f, n=8, method='gray', labeled=False)
+
+    Compute the Euler number, area, and perimeter using bit quads
 
+    All three measures are computed from a single count of the 2x2 patterns
+    ("bit quads") in the image.
+
+    Parameters
+    ----------
+    f : ndarray
+        A 2-D binary image (or labeled image if ``labeled``)
+    n : int, optional
+        Connectivity for the Euler number, one of (4, 8). default: 8
+    method : str, optional
+        One of:
+
+        'gray'
+            Gray's formulas (area is the same as the number of pixels)
+        'duda'
+            Duda's formulas (which take into account that the boundary of the
+            object is not a staircase)
+    labeled : bool, optional
+        If true, ``f`` is a labeled image and the return values are arrays
+        with one entry per label (default: False)
+
+    Returns
+    -------
+    euler_nr : float or ndarray
+    area : float or ndarray
+    perimeter : float or ndarray
+
+    Reference
+    ---------
+    Pratt, W.K. *Digital Image Processing*, section on shape analysis.
+    '''
+    f = np.asanyarray(f)
+    if f.ndim != 2:
+        raise ValueError('mahotas.bitquad_measures: Only 2-D images are supported')
+    lookup = _lookup(f, n, 'bitquad_measures')
+    if labeled:
+        _verify_is_integer_type(f, 'bitquad_measures')
+        counts = _quad_counts(f, (f.max() + 1 if f.size else 1))
+    else:
+        counts = _quad_counts((f != 0), 2)[1]
+    nbits = np.array([bin(i).count('1') for i in range(16)])
+    Q1 = counts[...,nbits == 1].sum(-1)
+    Q2 = counts[...,(nbits == 2) & (np.arange(16) != 6) & (np.arange(16) != 9)].sum(-1)
+    Q3 = counts[...,nbits == 3].sum(-1)
+    Q4 = counts[...,15]
+    QD = counts[...,6] + counts[...,9]
+    if method == 'gray':
+        area = (Q1 + 2*Q2 + 3*Q3 + 4*Q4 + 2*QD)/4.
+        perimeter = Q1 + Q2 + Q3 + 2.*QD
+    elif method == 'duda':
+        area = Q1/4. + Q2/2. + 7.*Q3/8. + Q4 + 3.*QD/4.
+        perimeter = Q2 + (Q1 + Q3 + 2.*QD)/np.sqrt(2.)
+    else:
+        raise ValueError("mahotas.bitquad_measures: method must be one of 'gray' or 'duda'")
+    return np.dot(counts, lookup), area, perimeter
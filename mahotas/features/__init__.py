@@ -1,11 +1,17 @@
-from .texture import haralick
+from .texture import haralick, haralick_map
 from .tas import tas, pftas
-from .zernike import zernike, zernike_moments
-from .lbp import lbp
+from .zernike import zernike, zernike_moments, ZernikeBasis
+from .lbp import lbp, lbp_transform, labeled_lbp
+from .labeled import labeled_features
 
 __all__ = [
+    'ZernikeBasis',
     'haralick',
+    'haralick_map',
+    'labeled_features',
+    'labeled_lbp',
     'lbp',
+    'lbp_transform',
     'pftas',
     'tas',
     'zernike',
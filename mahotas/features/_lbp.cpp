@@ -1,5 +1,11 @@
 // Part of mahotas. See LICENSE file for License
 // Copyright 2008-2012 Luis Pedro Coelho <luis@luispedro.org>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "../numpypp/array.hpp"
+#include "../numpypp/dispatch.hpp"
 #include "../utils.hpp"
 
 extern "C" {
@@ -46,9 +52,216 @@ PyObject* py_map(PyObject* self, PyObject* args) {
     return PyArray_Return(array);
 }
 
+// A sample point is interpolated (bi- or trilinearly) from up to 2^nd pixels.
+// All images are handled as 3-D (2-D images have a first dimension of size 1).
+struct corner {
+    npy_intp delta[3];
+    npy_intp offset;
+    double weight;
+};
+
+struct sample_point {
+    std::vector<corner> corners;
+};
+
+// Precomputes the pixels & weights needed for each sample point (given as
+// floating point offsets from the centre pixel)
+void build_samples(const numpy::aligned_array<double>& offsets, const int nd, const npy_intp strides[3], std::vector<sample_point>& samples, npy_intp lower[3], npy_intp upper[3]) {
+    const int nr_points = offsets.dim(0);
+    samples.resize(nr_points);
+    for (int d = 0; d != 3; ++d) lower[d] = upper[d] = 0;
+    for (int p = 0; p != nr_points; ++p) {
+        const double* off = offsets.data(p);
+        npy_intp base[3] = { 0, 0, 0 };
+        double frac[3] = { 0., 0., 0. };
+        for (int d = 0; d != nd; ++d) {
+            const double fl = std::floor(off[d]);
+            base[3 - nd + d] = npy_intp(fl);
+            frac[3 - nd + d] = off[d] - fl;
+        }
+        for (int c = 0; c != 8; ++c) {
+            corner cur;
+            cur.weight = 1.;
+            cur.offset = 0;
+            for (int d = 0; d != 3; ++d) {
+                const int up = (c >> d) & 1;
+                cur.delta[d] = base[d] + up;
+                cur.weight *= (up ? frac[d] : 1. - frac[d]);
+                cur.offset += cur.delta[d] * strides[d];
+            }
+            if (cur.weight == 0.) continue;
+            samples[p].corners.push_back(cur);
+            for (int d = 0; d != 3; ++d) {
+                lower[d] = std::min(lower[d], cur.delta[d]);
+                upper[d] = std::max(upper[d], cur.delta[d]);
+            }
+        }
+    }
+}
+
+// Optional outputs of lbp_codes & the label image they may depend on.
+// labeled & codes (if not NULL) are C-contiguous arrays of the same shape as
+// the image, so that they can be indexed with the same offsets.
+struct lbp_outputs {
+    npy_uint32* codes;
+    const int* labeled;
+    npy_intp nr_labels;
+    bool isolate;
+    const npy_intp* table;
+    npy_intp* histograms;
+    npy_intp nr_bins;
+};
+
+// Computes the code of every pixel in a single pass. Pixels outside the image
+// are taken to be zero. If ignore_zeros, the code of zero pixels is not
+// computed (it is left as is).
+//
+// If out.histograms is not NULL, the histogram of (out.table mapped) codes of
+// each region of out.labeled (except the background) is accumulated in the
+// same pass. If out.isolate, the pixels of other regions are taken to be zero.
+template <typename T>
+void lbp_codes(const numpy::aligned_array<T> f, const numpy::aligned_array<double> offsets, const bool ignore_zeros, lbp_outputs out) {
+    gil_release nogil;
+    const int nd = f.ndims();
+    npy_intp dims[3] = { 1, 1, 1 };
+    npy_intp strides[3] = { 0, 0, 0 };
+    for (int d = 0; d != nd; ++d) {
+        dims[3 - nd + d] = f.dim(d);
+        strides[3 - nd + d] = f.stride(d);
+    }
+    std::vector<sample_point> samples;
+    npy_intp lower[3], upper[3];
+    build_samples(offsets, nd, strides, samples, lower, upper);
+    const int nr_points = samples.size();
+
+    const T* fdata = f.data();
+    npy_intp i = 0;
+    for (npy_intp z = 0; z != dims[0]; ++z) {
+        const bool z_inside = (z + lower[0] >= 0 && z + upper[0] < dims[0]);
+        for (npy_intp y = 0; y != dims[1]; ++y) {
+            const bool zy_inside = z_inside && (y + lower[1] >= 0 && y + upper[1] < dims[1]);
+            for (npy_intp x = 0; x != dims[2]; ++x, ++i) {
+                const T* centre = fdata + i;
+                const double value = double(*centre);
+                if (ignore_zeros && !*centre) continue;
+                int label = 0;
+                if (out.labeled) {
+                    label = out.labeled[i];
+                    if (label < 0 || label >= out.nr_labels) {
+                        throw PythonException(PyExc_ValueError, "mahotas.features.lbp: label is out of range");
+                    }
+                    if (!label && !out.codes) continue;
+                }
+                const int* centre_label = (out.labeled ? out.labeled + i : 0);
+                const bool isolate = out.isolate && out.labeled;
+                const bool inside = zy_inside && (x + lower[2] >= 0 && x + upper[2] < dims[2]);
+                npy_uint32 code = 0;
+                for (int p = 0; p != nr_points; ++p) {
+                    const std::vector<corner>& corners = samples[p].corners;
+                    double sample = 0.;
+                    for (unsigned c = 0; c != corners.size(); ++c) {
+                        const npy_intp offset = corners[c].offset;
+                        if (!inside) {
+                            bool valid = true;
+                            const npy_intp pos[3] = { z, y, x };
+                            for (int d = 0; d != 3; ++d) {
+                                const npy_intp q = pos[d] + corners[c].delta[d];
+                                if (q < 0 || q >= dims[d]) valid = false;
+                            }
+                            if (!valid) continue;
+                        }
+                        if (isolate && centre_label[offset] != label) continue;
+                        sample += corners[c].weight * double(centre[offset]);
+                    }
+                    if (sample > value) code |= (npy_uint32(1) << p);
+                }
+                if (out.codes) out.codes[i] = code;
+                if (out.histograms && label) ++out.histograms[label * out.nr_bins + out.table[code]];
+            }
+        }
+    }
+}
+
+bool is_carray_of(PyArrayObject* array, const int type, PyArrayObject* shape_of) {
+    return PyArray_Check(array) &&
+        PyArray_TYPE(array) == type &&
+        PyArray_ISCARRAY(array) &&
+        numpy::same_shape(array, shape_of);
+}
+
+PyObject* py_lbp_codes(PyObject* self, PyObject* args) {
+    PyArrayObject* array;
+    PyArrayObject* offsets;
+    PyObject* codes;
+    int ignore_zeros;
+    PyObject* labeled;
+    PyObject* table;
+    PyObject* histograms;
+    int isolate;
+    if (!PyArg_ParseTuple(args,"OOOiOOOi", &array, &offsets, &codes, &ignore_zeros, &labeled, &table, &histograms, &isolate) ||
+        !numpy::are_arrays(array, offsets) ||
+        PyArray_TYPE(offsets) != NPY_DOUBLE || !PyArray_ISCARRAY(offsets) ||
+        !PyArray_ISCARRAY(array) ||
+        PyArray_NDIM(array) < 2 || PyArray_NDIM(array) > 3 ||
+        PyArray_NDIM(offsets) != 2 ||
+        PyArray_DIM(offsets, 1) != PyArray_NDIM(array) ||
+        PyArray_DIM(offsets, 0) > 32) {
+            PyErr_SetString(PyExc_RuntimeError,TypeErrorMsg);
+            return NULL;
+    }
+    lbp_outputs out;
+    out.codes = 0;
+    out.labeled = 0;
+    out.nr_labels = 0;
+    out.isolate = isolate;
+    out.table = 0;
+    out.histograms = 0;
+    out.nr_bins = 0;
+    if (codes != Py_None) {
+        if (!is_carray_of(reinterpret_cast<PyArrayObject*>(codes), NPY_UINT32, array)) {
+            PyErr_SetString(PyExc_RuntimeError,TypeErrorMsg);
+            return NULL;
+        }
+        out.codes = reinterpret_cast<npy_uint32*>(PyArray_DATA(reinterpret_cast<PyArrayObject*>(codes)));
+    }
+    if (histograms != Py_None) {
+        PyArrayObject* labeled_a = reinterpret_cast<PyArrayObject*>(labeled);
+        PyArrayObject* table_a = reinterpret_cast<PyArrayObject*>(table);
+        PyArrayObject* histograms_a = reinterpret_cast<PyArrayObject*>(histograms);
+        if (!is_carray_of(labeled_a, NPY_INT, array) ||
+            !PyArray_Check(table_a) || PyArray_TYPE(table_a) != numpy::index_type_number ||
+            !PyArray_ISCARRAY_RO(table_a) || PyArray_NDIM(table_a) != 1 ||
+            PyArray_DIM(table_a, 0) != (npy_intp(1) << PyArray_DIM(offsets, 0)) ||
+            !PyArray_Check(histograms_a) || PyArray_TYPE(histograms_a) != numpy::index_type_number ||
+            !PyArray_ISCARRAY(histograms_a) || PyArray_NDIM(histograms_a) != 2) {
+            PyErr_SetString(PyExc_RuntimeError,TypeErrorMsg);
+            return NULL;
+        }
+        out.labeled = reinterpret_cast<const int*>(PyArray_DATA(labeled_a));
+        out.table = reinterpret_cast<const npy_intp*>(PyArray_DATA(table_a));
+        out.histograms = reinterpret_cast<npy_intp*>(PyArray_DATA(histograms_a));
+        out.nr_labels = PyArray_DIM(histograms_a, 0);
+        out.nr_bins = PyArray_DIM(histograms_a, 1);
+        const npy_intp table_size = PyArray_DIM(table_a, 0);
+        for (npy_intp t = 0; t != table_size; ++t) {
+            if (out.table[t] < 0 || out.table[t] >= out.nr_bins) {
+                PyErr_SetString(PyExc_RuntimeError,TypeErrorMsg);
+                return NULL;
+            }
+        }
+    }
+
+#define HANDLE(type) \
+    lbp_codes<type>(numpy::aligned_array<type>(array), numpy::aligned_array<double>(offsets), ignore_zeros, out);
+    SAFE_SWITCH_ON_TYPES_OF(array, true);
+#undef HANDLE
+
+    Py_RETURN_NONE;
+}
 
 PyMethodDef methods[] = {
   {"map",(PyCFunction)py_map, METH_VARARGS, NULL},
+  {"lbp_codes",(PyCFunction)py_lbp_codes, METH_VARARGS, NULL},
   {NULL, NULL,0,NULL},
 };
 
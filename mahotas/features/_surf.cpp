@@ -15,6 +15,7 @@
 
 #include <vector>
 #include <algorithm>
+#include <functional>
 #include <cmath>
 #include <limits>
 
@@ -40,7 +41,7 @@ const char TypeErrorMsg[] =
 typedef numpy::aligned_array<double> integral_image_type;
 
 template <typename T>
-double sum_rect(numpy::aligned_array<T> integral, int y0, int x0, int y1, int x1) {
+double sum_rect(const numpy::aligned_array<T>& integral, int y0, int x0, int y1, int x1) {
     y0 = std::max<int>(y0-1, 0);
     x0 = std::max<int>(x0-1, 0);
     y1 = std::min<int>(y1-1, integral.dim(0));
@@ -57,7 +58,7 @@ double sum_rect(numpy::aligned_array<T> integral, int y0, int x0, int y1, int x1
 }
 
 template <typename T>
-double csum_rect(numpy::aligned_array<T> integral, int y, int x, const int dy, const int dx, int h, int w) {
+double csum_rect(const numpy::aligned_array<T>& integral, int y, int x, const int dy, const int dx, int h, int w) {
     int y0 = y + dy - h/2;
     int x0 = x + dx - w/2;
     int y1 = y0 + h;
@@ -322,14 +323,32 @@ inline const interest_point interpolate_point (
     return res;
 }
 
+// Orders points by decreasing score (so that, used as a heap comparison, the
+// weakest point is at the front)
+struct stronger {
+    bool operator()(const interest_point& a, const interest_point& b) const {
+        return a.score > b.score;
+    }
+};
+
+// Appends the points whose score is above threshold to result_points, sorted
+// by decreasing score.
+//
+// If max_points >= 0, only the max_points strongest points are kept: they are
+// kept in a heap, and, once it is full, its weakest point acts as the
+// threshold (so that weaker candidates are rejected without further work).
 void get_interest_points(
     const hessian_pyramid& pyr,
-    double threshold,
+    const double threshold,
     std::vector<interest_point>& result_points,
-    const int initial_step_size) {
+    const int initial_step_size,
+    const int max_points) {
     assert(threshold >= 0);
 
     result_points.clear();
+    const bool bounded = (max_points >= 0);
+    if (max_points == 0) return;
+    double cur_threshold = threshold;
     const int nr_octaves = pyr.nr_octaves();
     const int nr_intervals = pyr.nr_intervals();
 
@@ -365,10 +384,23 @@ void get_interest_points(
 
                     // If the max point we found is really a maximum in its own region and
                     // is big enough then add it to the results.
-                    if (max_val > threshold && is_maximum_in_region(pyr, o, max_i, max_r, max_c)) {
+                    if (max_val > cur_threshold && is_maximum_in_region(pyr, o, max_i, max_r, max_c)) {
                         interest_point sp = interpolate_point(pyr, o, max_i, max_r, max_c, initial_step_size);
-                        if (sp.score > threshold) {
-                            result_points.push_back(sp);
+                        if (sp.score > cur_threshold) {
+                            if (!bounded) {
+                                result_points.push_back(sp);
+                            } else if (result_points.size() < unsigned(max_points)) {
+                                result_points.push_back(sp);
+                                std::push_heap(result_points.begin(), result_points.end(), stronger());
+                                if (result_points.size() == unsigned(max_points)) {
+                                    cur_threshold = std::max(threshold, result_points.front().score);
+                                }
+                            } else {
+                                std::pop_heap(result_points.begin(), result_points.end(), stronger());
+                                result_points.back() = sp;
+                                std::push_heap(result_points.begin(), result_points.end(), stronger());
+                                cur_threshold = std::max(threshold, result_points.front().score);
+                            }
                         }
                     }
                 }
@@ -376,33 +408,75 @@ void get_interest_points(
         }
     }
     // sort all the points by how strong their score is
-    // We want the highest scoring in front, so we sort on rbegin()/rend()
-    std::sort(result_points.rbegin(), result_points.rend());
+    if (bounded) {
+        std::sort_heap(result_points.begin(), result_points.end(), stronger());
+    } else {
+        // We want the highest scoring in front, so we sort on rbegin()/rend()
+        std::sort(result_points.rbegin(), result_points.rend());
+    }
 }
 
+// One of the box filters used to compute the Hessian at (y, x) (the box is
+// that of csum_rect(integral, y, x, dy, dx, h, w)). The corners are stored as
+// offsets (in elements) from &integral(y, x) so that, away from the border,
+// the box sum is just four reads.
+struct box_filter {
+    box_filter() { }
+    box_filter(const int dy, const int dx, const int h, const int w, const npy_intp s0, const npy_intp s1) {
+        y0 = dy - h/2 - 1;
+        x0 = dx - w/2 - 1;
+        y1 = y0 + h;
+        x1 = x0 + w;
+        A = y0*s0 + x0*s1;
+        B = y0*s0 + x1*s1;
+        C = y1*s0 + x0*s1;
+        D = y1*s0 + x1*s1;
+    }
+
+    // Same as csum_rect (when no clamping is needed)
+    template <typename T>
+    double sum(const T* p) const {
+        return (p[D] - p[B]) - (p[C] - p[A]);
+    }
+
+    int y0, x0, y1, x1;
+    npy_intp A, B, C, D;
+};
+
+// Allocates (but does not fill) the pyramid for an (N0 x N1) integral image.
+// Needs the GIL.
+void allocate_pyramid(hessian_pyramid& hpyramid, const int N0, const int N1, const int nr_octaves, const int nr_intervals, const int initial_step_size) {
+    hessian_pyramid::pyramid_type& pyramid = hpyramid.pyr;
+    pyramid.reserve(nr_octaves);
+    for (int o = 0; o < nr_octaves; ++o) {
+        const int step_size = get_step_size(initial_step_size, o);
+        pyramid.push_back(numpy::new_array<double>(nr_intervals, N0/step_size, N1/step_size));
+        PyArray_FILLWBYTE(pyramid[o].raw_array(), 0);
+    }
+}
+
+// Fills the (already allocated) pyramid. The work is split into nr_parts, of
+// which this call does part (part k handles every nr_parts-th row of each
+// layer, starting at the k-th), so that different parts can run in parallel.
 template <typename T>
-void build_pyramid(numpy::aligned_array<T> integral,
+void build_pyramid(const numpy::aligned_array<T>& integral,
                 hessian_pyramid& hpyramid,
-                const int nr_octaves,
                 const int nr_intervals,
-                const int initial_step_size) {
-    assert(nr_octaves > 0);
+                const int initial_step_size,
+                const int part,
+                const int nr_parts) {
     assert(nr_intervals > 0);
     assert(initial_step_size > 0);
+    assert(0 <= part && part < nr_parts);
 
     hessian_pyramid::pyramid_type& pyramid = hpyramid.pyr;
+    const int nr_octaves = pyramid.size();
     const int N0 = integral.dim(0);
     const int N1 = integral.dim(1);
-    // allocate space for the pyramid
-    pyramid.reserve(nr_octaves);
-    for (int o = 0; o < nr_octaves; ++o)
-    {
-        const int step_size = get_step_size(initial_step_size, o);
-        pyramid.push_back(numpy::new_array<double>(nr_intervals, N0/step_size, N1/step_size));
-        PyArray_FILLWBYTE(pyramid[o].raw_array(), 0);
-    }
+    const npy_intp s0 = integral.stride(0);
+    const npy_intp s1 = integral.stride(1);
+    box_filter boxes[8];
 
-    // now fill out the pyramid with data
     for (int o = 0; o < nr_octaves; ++o)
     {
         const int step_size = get_step_size(initial_step_size, o);
@@ -414,19 +488,49 @@ void build_pyramid(numpy::aligned_array<T> integral,
             const double area_inv = 1.0/std::pow(3.0*lobe_size, 2.0);
             const int lobe_offset = lobe_size/2+1;
 
-            for (int y = border_size; y < N0 - border_size; y += step_size) {
-                for (int x = border_size; x < N1 - border_size; x += step_size) {
-
-                    double Dxx =     csum_rect(integral, y, x, 0, 0, 2*lobe_size-1, 3*lobe_size) -
-                                 3.* csum_rect(integral, y, x, 0, 0, 2*lobe_size-1,   lobe_size);
+            boxes[0] = box_filter(0, 0, 2*lobe_size-1, 3*lobe_size, s0, s1);
+            boxes[1] = box_filter(0, 0, 2*lobe_size-1,   lobe_size, s0, s1);
+            boxes[2] = box_filter(0, 0, 3*lobe_size, 2*lobe_size-1, s0, s1);
+            boxes[3] = box_filter(0, 0,   lobe_size, 2*lobe_size-1, s0, s1);
+            boxes[4] = box_filter(-lobe_offset, +lobe_offset, lobe_size, lobe_size, s0, s1);
+            boxes[5] = box_filter(+lobe_offset, -lobe_offset, lobe_size, lobe_size, s0, s1);
+            boxes[6] = box_filter(+lobe_offset, +lobe_offset, lobe_size, lobe_size, s0, s1);
+            boxes[7] = box_filter(-lobe_offset, -lobe_offset, lobe_size, lobe_size, s0, s1);
+
+            // Pixels (y, x) for which no box needs clamping:
+            //      ymin <= y < ymax && xmin <= x < xmax
+            int ymin = 0, ymax = N0, xmin = 0, xmax = N1;
+            for (int b = 0; b != 8; ++b) {
+                ymin = std::max(ymin, -boxes[b].y0);
+                xmin = std::max(xmin, -boxes[b].x0);
+                ymax = std::min(ymax, N0 - boxes[b].y1);
+                xmax = std::min(xmax, N1 - boxes[b].x1);
+            }
 
-                    double Dyy =     csum_rect(integral, y, x, 0, 0, 3*lobe_size, 2*lobe_size-1) -
-                                 3.* csum_rect(integral, y, x, 0, 0,   lobe_size, 2*lobe_size-1);
+            int row = 0;
+            for (int y = border_size; y < N0 - border_size; y += step_size, ++row) {
+                if (row % nr_parts != part) continue;
+                const bool y_inside = (ymin <= y && y < ymax);
+                for (int x = border_size; x < N1 - border_size; x += step_size) {
 
-                    double Dxy =    csum_rect(integral, y, x, -lobe_offset, +lobe_offset, lobe_size, lobe_size)
-                                  + csum_rect(integral, y, x, +lobe_offset, -lobe_offset, lobe_size, lobe_size)
-                                  - csum_rect(integral, y, x, +lobe_offset, +lobe_offset, lobe_size, lobe_size)
-                                  - csum_rect(integral, y, x, -lobe_offset, -lobe_offset, lobe_size, lobe_size);
+                    double Dxx, Dyy, Dxy;
+                    if (y_inside && xmin <= x && x < xmax) {
+                        const T* p = integral.data(y) + x*s1;
+                        Dxx = boxes[0].sum(p) - 3.*boxes[1].sum(p);
+                        Dyy = boxes[2].sum(p) - 3.*boxes[3].sum(p);
+                        Dxy = boxes[4].sum(p) + boxes[5].sum(p) - boxes[6].sum(p) - boxes[7].sum(p);
+                    } else {
+                        Dxx =     csum_rect(integral, y, x, 0, 0, 2*lobe_size-1, 3*lobe_size) -
+                              3.* csum_rect(integral, y, x, 0, 0, 2*lobe_size-1,   lobe_size);
+
+                        Dyy =     csum_rect(integral, y, x, 0, 0, 3*lobe_size, 2*lobe_size-1) -
+                              3.* csum_rect(integral, y, x, 0, 0,   lobe_size, 2*lobe_size-1);
+
+                        Dxy =    csum_rect(integral, y, x, -lobe_offset, +lobe_offset, lobe_size, lobe_size)
+                               + csum_rect(integral, y, x, +lobe_offset, -lobe_offset, lobe_size, lobe_size)
+                               - csum_rect(integral, y, x, +lobe_offset, +lobe_offset, lobe_size, lobe_size)
+                               - csum_rect(integral, y, x, -lobe_offset, -lobe_offset, lobe_size, lobe_size);
+                    }
 
                     // now we normalize the filter responses
                     Dxx *= area_inv;
@@ -460,32 +564,18 @@ void build_pyramid(numpy::aligned_array<T> integral,
     }
 }
 
-template <typename T>
-void integral(numpy::aligned_array<T> array) {
-    gil_release nogil;
-    const int N0 = array.dim(0);
-    const int N1 = array.dim(1);
-    if (N0 == 0 || N1 == 0) return;
-    for (int j = 1; j != N1; ++j) {
-        array.at(0, j) += array.at(0, j - 1);
-    }
-    for (int i = 1; i != N0; ++i) {
-        array.at(i,0) += array.at(i-1,0);
-        for (int j = 1; j != N1; ++j) {
-            array.at(i,j) += array.at(i-1, j) + array.at(i, j-1) - array.at(i-1, j-1);
-        }
-    }
-}
+// The descriptor has 64 elements (or 128 if it is extended)
+const int max_descriptor_size = 128;
 
 struct surf_point {
     interest_point p;
     double angle;
-    double des[64];
-    static const size_t ndoubles = interest_point::ndoubles + 1 + 64;
-    void dump(double out[ndoubles]) const {
+    double des[max_descriptor_size];
+    static const size_t nheader = interest_point::ndoubles + 1;
+    void dump(double* out, const int descriptor_size) const {
         p.dump(out);
         out[interest_point::ndoubles] = angle;
-        std::memcpy(out+interest_point::ndoubles + 1, des, 64 * sizeof(double));
+        std::memcpy(out+nheader, des, descriptor_size * sizeof(double));
     }
 
 };
@@ -506,11 +596,41 @@ bool between_angles(const double a1, double a) {
     return false;
 }
 
+// The Gaussian weights used by compute_dominant_angle & compute_surf_descriptor
+// depend only on the sample position, so they are computed once.
+struct gaussian_tables {
+    gaussian_tables() {
+        for (int r = -6; r <= 6; ++r) {
+            for (int c = -6; c <= 6; ++c) {
+                angle_[r+6][c+6] = gaussian(c, r, 2.5);
+            }
+        }
+        for (int y = -10; y < 10; ++y) {
+            for (int x = -10; x < 10; ++x) {
+                descriptor_[y+10][x+10] = gaussian(x, y, 3.3);
+            }
+        }
+    }
+    // gaussian(c, r, 2.5) for -6 <= r,c <= 6
+    double angle(const int r, const int c) const { return angle_[r+6][c+6]; }
+    // gaussian(x, y, 3.3) for -10 <= y,x < 10
+    double descriptor(const int y, const int x) const { return descriptor_[y+10][x+10]; }
+
+    private:
+    double angle_[13][13];
+    double descriptor_[20][20];
+};
+
+typedef std::vector<std::pair<double, double_v2> > angle_samples;
+
+// samples is used as scratch space (its contents are discarded)
 double compute_dominant_angle(
         const integral_image_type& img,
         const double_v2& center,
-        const double scale) {
-    std::vector<std::pair<double, double_v2> > samples;
+        const double scale,
+        const gaussian_tables& tables,
+        angle_samples& samples) {
+    samples.clear();
 
     // accumulate a bunch of angle and vector samples
     double_v2 vect;
@@ -518,7 +638,7 @@ double compute_dominant_angle(
         for (int c = -6; c <= 6; ++c) {
             if (r*r + c*c < 36) {
                 // compute a Gaussian weighted gradient and the gradient's angle.
-                const double gauss = gaussian(c,r, 2.5);
+                const double gauss = tables.angle(r, c);
                 vect.y() = gauss*haar_y(img, round(scale*r+center.y()), round(scale*c+center.x()), (~1)&static_cast<int>(4*scale+0.5));
                 vect.x() = gauss*haar_x(img, round(scale*r+center.y()), round(scale*c+center.x()), (~1)&static_cast<int>(4*scale+0.5));
 
@@ -579,12 +699,17 @@ double_v2 rotate_point(const double_v2& p, const double sin_angle, const double
 
 // ----------------------------------------------------------------------------------------
 
+// If extended, then each of the sums is split according to the sign of the
+// other component (e.g., the sum of dy is split into the sum of dy where dx < 0
+// and the sum where dx >= 0), for a total of 128 elements (instead of 64).
 void compute_surf_descriptor (
     const integral_image_type& img,
     double_v2 center,
     const double scale,
     const double angle,
-    double des[64]) {
+    const gaussian_tables& tables,
+    const bool extended,
+    double* des) {
     assert(scale > 0);
 
     const double sin_angle = std::sin(angle);
@@ -595,7 +720,9 @@ void compute_surf_descriptor (
     // loop over the 4x4 grid of histogram buckets
     for (int r = -10; r < 10; r += 5) {
         for (int c = -10; c < 10; c += 5) {
-            double_v2 vect, abs_vect;
+            // index 0 is used for negative values of the other component
+            // (only if extended)
+            double_v2 vect[2], abs_vect[2];
 
             // now loop over 25 points in this bucket and sum their features
             for (int y = r; y < r+5; ++y) {
@@ -604,7 +731,7 @@ void compute_surf_descriptor (
                     double_v2 p = rotate_point(double_v2(x*scale, y*scale), sin_angle, cos_angle);
                     p += center;
 
-                    const double gauss = gaussian(x,y, 3.3);
+                    const double gauss = tables.descriptor(y, x);
                     double_v2 temp(
                             gauss*haar_x(img, int(p.y()), int(p.x()), static_cast<int>(2*scale+0.5)),
                             gauss*haar_y(img, int(p.y()), int(p.x()), static_cast<int>(2*scale+0.5)));
@@ -614,100 +741,131 @@ void compute_surf_descriptor (
                     // sin(-a) = -sin(a) & cos(-a) = cos(a))
                     temp = rotate_point(temp, -sin_angle, cos_angle);
 
-                    vect += temp;
-                    abs_vect += temp.abs();
+                    if (extended) {
+                        const int yi = (temp.x() >= 0);
+                        const int xi = (temp.y() >= 0);
+                        vect[yi].y() += temp.y();
+                        abs_vect[yi].y() += std::abs(temp.y());
+                        vect[xi].x() += temp.x();
+                        abs_vect[xi].x() += std::abs(temp.x());
+                    } else {
+                        vect[1] += temp;
+                        abs_vect[1] += temp.abs();
+                    }
                 }
             }
 
-            des[count++] = vect.y();
-            des[count++] = vect.x();
-            des[count++] = abs_vect.y();
-            des[count++] = abs_vect.x();
+            if (extended) {
+                des[count++] = vect[0].y();
+                des[count++] = vect[1].y();
+                des[count++] = vect[0].x();
+                des[count++] = vect[1].x();
+                des[count++] = abs_vect[0].y();
+                des[count++] = abs_vect[1].y();
+                des[count++] = abs_vect[0].x();
+                des[count++] = abs_vect[1].x();
+            } else {
+                des[count++] = vect[1].y();
+                des[count++] = vect[1].x();
+                des[count++] = abs_vect[1].y();
+                des[count++] = abs_vect[1].x();
+            }
         }
     }
 
-    assert(count == 64);
+    assert(count == (extended ? 128 : 64));
 
     // Return the length normalized descriptor.  Add a small number
     // to guard against division by zero.
     double len = 1e-7;
-    for (int i = 0; i != 64; ++i) len += des[i]*des[i];
+    for (int i = 0; i != count; ++i) len += des[i]*des[i];
     len = std::sqrt(len);
-    for (int i = 0; i != 64; ++i) des[i] /= len;
+    for (int i = 0; i != count; ++i) des[i] /= len;
 }
 
-std::vector<surf_point> compute_descriptors(
+// Computes the descriptors of points[part], points[part + nr_parts], ...
+// (so that different parts can run in parallel) into out (one row of
+// surf_point::nheader + descriptor_size doubles per point). Points that are
+// too close to the border are skipped: valid[i] is set to whether the
+// descriptor of points[i] was computed.
+//
+// If upright, the dominant orientation is not computed (it is taken to be zero).
+void compute_descriptors(
             const integral_image_type& int_img,
             const std::vector<interest_point>& points,
-            const int max_points) {
-    std::vector<surf_point> spoints;
+            double* out,
+            bool* valid,
+            const bool upright,
+            const bool extended,
+            const int part,
+            const int nr_parts) {
     const int N0 = int_img.dim(0);
     const int N1 = int_img.dim(1);
-    for (unsigned i = 0; i < std::min(size_t(max_points), points.size()); ++i)
+    const int descriptor_size = (extended ? 128 : 64);
+    const gaussian_tables tables;
+    angle_samples samples;
+    surf_point sp;
+    for (unsigned i = part; i < points.size(); i += nr_parts)
     {
         // ignore points that are close to the edge of the image
         const double border = 31;
         const interest_point& p = points[i];
         const unsigned long border_size = static_cast<unsigned long>(border*points[i].scale)/2;
-        if (border_size <= p.y() && (p.y() + border_size) < N0 &&
-            border_size <= p.x() && (p.x() + border_size) < N1) {
-            surf_point sp;
-
-            sp.angle = compute_dominant_angle(int_img, p.center(), p.scale);
-            compute_surf_descriptor(int_img, p.center(), p.scale, sp.angle, sp.des);
+        valid[i] = (border_size <= p.y() && (p.y() + border_size) < N0 &&
+                    border_size <= p.x() && (p.x() + border_size) < N1);
+        if (valid[i]) {
+            sp.angle = (upright ? 0. : compute_dominant_angle(int_img, p.center(), p.scale, tables, samples));
+            compute_surf_descriptor(int_img, p.center(), p.scale, sp.angle, tables, extended, sp.des);
             sp.p = p;
-            spoints.push_back(sp);
+            sp.dump(out + i*(surf_point::nheader + descriptor_size), descriptor_size);
         }
     }
-    return spoints;
 }
 
-template<typename T>
-std::vector<surf_point> get_surf_points(const numpy::aligned_array<T>& int_img, const int nr_octaves, const int nr_intervals, const int initial_step_size, const float threshold, const int max_points) {
-    assert(max_points > 0);
-    hessian_pyramid pyramid;
-
-    gil_release nogil;
-    std::vector<interest_point> points;
-    build_pyramid<T>(int_img, pyramid, nr_octaves, nr_intervals, initial_step_size);
-    get_interest_points(pyramid, threshold, points, initial_step_size);
-    // compute descriptors and return
-    return compute_descriptors(int_img, points, max_points);
-}
-
-PyObject* py_surf(PyObject* self, PyObject* args) {
+PyObject* py_descriptors(PyObject* self, PyObject* args) {
     PyArrayObject* array;
-    PyArrayObject* res;
-    int nr_octaves;
-    int nr_intervals;
-    int initial_step_size;
-    float threshold;
-    int max_points;
-    if (!PyArg_ParseTuple(args,"Oiiifi", &array, &nr_octaves, &nr_intervals, &initial_step_size, &threshold, &max_points)) return NULL;
-    if (!PyArray_Check(array) ||
-        PyArray_NDIM(array) != 2 ||
-        PyArray_TYPE(array) != NPY_DOUBLE) {
+    PyArrayObject* points_arr;
+    PyArrayObject* output;
+    PyArrayObject* valid;
+    int upright;
+    int extended;
+    int part;
+    int nr_parts;
+    if (!PyArg_ParseTuple(args,"OOOOiiii", &array, &points_arr, &output, &valid, &upright, &extended, &part, &nr_parts)) return NULL;
+    const int descriptor_size = (extended ? 128 : 64);
+    if (!PyArray_Check(array) || !PyArray_Check(points_arr) ||
+        !PyArray_Check(output) || !PyArray_Check(valid) ||
+        PyArray_NDIM(array) != 2 || PyArray_NDIM(points_arr) != 2 ||
+        PyArray_DIM(points_arr,1) != npy_intp(interest_point::ndoubles) ||
+        PyArray_TYPE(array) != NPY_DOUBLE ||
+        PyArray_TYPE(points_arr) != NPY_DOUBLE ||
+        PyArray_TYPE(output) != NPY_DOUBLE || !PyArray_ISCARRAY(output) ||
+        PyArray_NDIM(output) != 2 ||
+        PyArray_DIM(output, 0) != PyArray_DIM(points_arr, 0) ||
+        PyArray_DIM(output, 1) != npy_intp(surf_point::nheader + descriptor_size) ||
+        PyArray_TYPE(valid) != NPY_BOOL || !PyArray_ISCARRAY(valid) ||
+        PyArray_NDIM(valid) != 1 || PyArray_DIM(valid, 0) != PyArray_DIM(points_arr, 0) ||
+        part < 0 || nr_parts <= part) {
         PyErr_SetString(PyExc_RuntimeError, TypeErrorMsg);
         return NULL;
     }
-    holdref array_ref(array);
+    // Nothing to do (this must be checked while holding the GIL, as
+    // Py_RETURN_NONE touches the reference count of None)
+    if (!PyArray_DIM(points_arr, 0)) Py_RETURN_NONE;
     try {
-        std::vector<surf_point> spoints;
-        spoints = get_surf_points<double>(
-                        numpy::aligned_array<double>(array),
-                        nr_octaves,
-                        nr_intervals,
-                        initial_step_size,
-                        threshold,
-                        max_points);
-
-        numpy::aligned_array<double> arr = numpy::new_array<double>(spoints.size(), surf_point::ndoubles);
-        for (unsigned int i = 0; i != spoints.size(); ++i) {
-            spoints[i].dump(arr.data(i));
+        const integral_image_type int_img(array);
+        const numpy::aligned_array<double> points_raw(points_arr);
+        const unsigned npoints = points_raw.dim(0);
+        double* out = static_cast<double*>(PyArray_DATA(output));
+        bool* valid_data = static_cast<bool*>(PyArray_DATA(valid));
+
+        gil_release nogil;
+        std::vector<interest_point> points;
+        points.reserve(npoints);
+        for (unsigned int i = 0; i != npoints; ++i) {
+            points.push_back(interest_point::load(points_raw.data(i)));
         }
-        res = arr.raw_array();
-        Py_INCREF(res);
-        return PyArray_Return(res);
+        compute_descriptors(int_img, points, out, valid_data, upright, extended, part, nr_parts);
     } catch (const std::bad_alloc&) {
         PyErr_NoMemory();
         return NULL;
@@ -715,80 +873,89 @@ PyObject* py_surf(PyObject* self, PyObject* args) {
         PyErr_SetString(exc.type(), exc.message());
         return NULL;
     }
+    Py_RETURN_NONE;
 }
 
-PyObject* py_descriptors(PyObject* self, PyObject* args) {
-    PyArrayObject* array;
-    PyArrayObject* points_arr;
-    PyArrayObject* res;
-    if (!PyArg_ParseTuple(args,"OO", &array, &points_arr)) return NULL;
-    if (!PyArray_Check(array) || !PyArray_Check(points_arr) ||
-        PyArray_NDIM(array) != 2 || PyArray_NDIM(points_arr) != 2 ||
-        PyArray_DIM(points_arr,1) != npy_intp(interest_point::ndoubles) ||
-        PyArray_TYPE(array) != NPY_DOUBLE ||
-        PyArray_TYPE(points_arr) != NPY_DOUBLE) {
+// Wraps the arrays in list (which must have been allocated as in
+// allocate_pyramid) in hpyramid
+bool load_pyramid(PyObject* list, hessian_pyramid& hpyramid) {
+    if (!PyList_Check(list) || PyList_GET_SIZE(list) == 0) return false;
+    const Py_ssize_t nr_octaves = PyList_GET_SIZE(list);
+    for (Py_ssize_t o = 0; o != nr_octaves; ++o) {
+        PyArrayObject* layer = reinterpret_cast<PyArrayObject*>(PyList_GET_ITEM(list, o));
+        if (!PyArray_Check(layer) ||
+            PyArray_TYPE(layer) != NPY_DOUBLE ||
+            !PyArray_ISCARRAY(layer) ||
+            PyArray_NDIM(layer) != 3 ||
+            PyArray_DIM(layer, 0) != PyArray_DIM(reinterpret_cast<PyArrayObject*>(PyList_GET_ITEM(list, 0)), 0)) {
+            return false;
+        }
+        hpyramid.pyr.push_back(numpy::aligned_array<double>(layer));
+    }
+    return true;
+}
+
+// Checks that the pyramid has the shape that allocate_pyramid would give it
+bool check_pyramid(const hessian_pyramid& hpyramid, PyArrayObject* integral, const int nr_intervals, const int initial_step_size) {
+    if (hpyramid.nr_intervals() != nr_intervals || initial_step_size <= 0) return false;
+    for (int o = 0; o != hpyramid.nr_octaves(); ++o) {
+        const int step_size = get_step_size(initial_step_size, o);
+        if (hpyramid.nr(o) != PyArray_DIM(integral, 0)/step_size ||
+            hpyramid.nc(o) != PyArray_DIM(integral, 1)/step_size) return false;
+    }
+    return true;
+}
+
+PyObject* py_allocate_pyramid(PyObject* self, PyObject* args) {
+    int N0, N1;
+    int nr_octaves;
+    int nr_intervals;
+    int initial_step_size;
+    if (!PyArg_ParseTuple(args,"iiiii", &N0, &N1, &nr_octaves, &nr_intervals, &initial_step_size)) return NULL;
+    if (N0 < 0 || N1 < 0 || nr_octaves <= 0 || nr_intervals <= 0 || initial_step_size <= 0) {
         PyErr_SetString(PyExc_RuntimeError, TypeErrorMsg);
         return NULL;
     }
-    holdref array_ref(array);
+    hessian_pyramid pyramid;
     try {
-
-        std::vector<surf_point> spoints;
-        { // no gil block
-            gil_release nogil;
-            numpy::aligned_array<double> points_raw(points_arr);
-            const unsigned npoints = points_raw.dim(0);
-            std::vector<interest_point> points;
-            for (unsigned int i = 0; i != npoints; ++i) {
-                points.push_back(interest_point::load(points_raw.data(i)));
-            }
-            spoints = compute_descriptors(integral_image_type(array), points, npoints);
-        }
-
-        numpy::aligned_array<double> arr = numpy::new_array<double>(spoints.size(), surf_point::ndoubles);
-        for (unsigned int i = 0; i != spoints.size(); ++i) {
-            spoints[i].dump(arr.data(i));
-        }
-        res = arr.raw_array();
-        Py_INCREF(res);
-        return PyArray_Return(res);
+        allocate_pyramid(pyramid, N0, N1, nr_octaves, nr_intervals, initial_step_size);
     } catch (const std::bad_alloc&) {
         PyErr_NoMemory();
         return NULL;
-    } catch (const PythonException& exc) {
-        PyErr_SetString(exc.type(), exc.message());
-        return NULL;
     }
+    PyObject* pyramid_list = PyList_New(nr_octaves);
+    if (!pyramid_list) return NULL;
+    for (int o = 0; o != nr_octaves; ++o) {
+        PyObject* arr = reinterpret_cast<PyObject*>(pyramid.pyr.at(o).raw_array());
+        Py_INCREF(arr);
+        PyList_SET_ITEM(pyramid_list, o, arr);
+    }
+    return pyramid_list;
 }
 
-
-PyObject* py_interest_points(PyObject* self, PyObject* args) {
+PyObject* py_fill_pyramid(PyObject* self, PyObject* args) {
     PyArrayObject* array;
-    PyArrayObject* res;
-    int nr_octaves;
+    PyObject* pyramid_list;
     int nr_intervals;
     int initial_step_size;
-    int max_points;
-    float threshold;
-    if (!PyArg_ParseTuple(args,"Oiiifi", &array, &nr_octaves, &nr_intervals, &initial_step_size, &threshold, &max_points)) return NULL;
-    if (!PyArray_Check(array) || PyArray_NDIM(array) != 2) {
+    int part;
+    int nr_parts;
+    if (!PyArg_ParseTuple(args,"OOiiii", &array, &pyramid_list, &nr_intervals, &initial_step_size, &part, &nr_parts)) return NULL;
+    hessian_pyramid pyramid;
+    if (!PyArray_Check(array) || PyArray_NDIM(array) != 2 ||
+        !load_pyramid(pyramid_list, pyramid) ||
+        !check_pyramid(pyramid, array, nr_intervals, initial_step_size) ||
+        part < 0 || nr_parts <= part) {
         PyErr_SetString(PyExc_RuntimeError, TypeErrorMsg);
         return NULL;
     }
     holdref array_ref(array);
-    hessian_pyramid pyramid;
-    std::vector<interest_point> interest_points;
     try {
         switch(PyArray_TYPE(array)) {
-        #define HANDLE(type) {\
+        #define HANDLE(type) { \
+            numpy::aligned_array<type> integral(array); \
             gil_release nogil; \
-            build_pyramid<type>(numpy::aligned_array<type>(array), pyramid, nr_octaves, nr_intervals, initial_step_size); \
-            get_interest_points(pyramid, threshold, interest_points, initial_step_size); \
-            if (max_points >= 0 && interest_points.size() > unsigned(max_points)) { \
-                interest_points.erase( \
-                            interest_points.begin() + max_points, \
-                            interest_points.end()); \
-            } \
+            build_pyramid<type>(integral, pyramid, nr_intervals, initial_step_size, part, nr_parts); \
         }
 
             HANDLE_TYPES();
@@ -797,12 +964,6 @@ PyObject* py_interest_points(PyObject* self, PyObject* args) {
             PyErr_SetString(PyExc_RuntimeError, TypeErrorMsg);
             return NULL;
         }
-        numpy::aligned_array<double> arr = numpy::new_array<double>(interest_points.size(), interest_point::ndoubles);
-        for (unsigned int i = 0; i != interest_points.size(); ++i) {
-            interest_points[i].dump(arr.data(i));
-        }
-        res = arr.raw_array();
-        Py_INCREF(res);
     } catch (const std::bad_alloc&) {
         PyErr_NoMemory();
         return NULL;
@@ -810,32 +971,33 @@ PyObject* py_interest_points(PyObject* self, PyObject* args) {
         PyErr_SetString(exc.type(), exc.message());
         return NULL;
     }
-    return PyArray_Return(res);
+    Py_RETURN_NONE;
 }
 
-PyObject* py_pyramid(PyObject* self, PyObject* args) {
-    PyArrayObject* array;
-    int nr_octaves;
-    int nr_intervals;
+PyObject* py_interest_points(PyObject* self, PyObject* args) {
+    PyObject* pyramid_list;
+    PyArrayObject* res;
     int initial_step_size;
-    if (!PyArg_ParseTuple(args,"Oiii", &array, &nr_octaves, &nr_intervals, &initial_step_size)) return NULL;
-    if (!PyArray_Check(array) || PyArray_NDIM(array) != 2) {
+    int max_points;
+    double threshold;
+    if (!PyArg_ParseTuple(args,"Oidi", &pyramid_list, &initial_step_size, &threshold, &max_points)) return NULL;
+    hessian_pyramid pyramid;
+    if (!load_pyramid(pyramid_list, pyramid) || initial_step_size <= 0 || threshold < 0) {
         PyErr_SetString(PyExc_RuntimeError, TypeErrorMsg);
         return NULL;
     }
-    holdref array_ref(array);
-    hessian_pyramid pyramid;
+    std::vector<interest_point> interest_points;
     try {
-        switch(PyArray_TYPE(array)) {
-        #define HANDLE(type) \
-            build_pyramid<type>(numpy::aligned_array<type>(array), pyramid, nr_octaves, nr_intervals, initial_step_size);
-
-            HANDLE_TYPES();
-        #undef HANDLE
-            default:
-            PyErr_SetString(PyExc_RuntimeError, TypeErrorMsg);
-            return NULL;
+        {
+            gil_release nogil;
+            get_interest_points(pyramid, threshold, interest_points, initial_step_size, max_points);
         }
+        numpy::aligned_array<double> arr = numpy::new_array<double>(interest_points.size(), interest_point::ndoubles);
+        for (unsigned int i = 0; i != interest_points.size(); ++i) {
+            interest_points[i].dump(arr.data(i));
+        }
+        res = arr.raw_array();
+        Py_INCREF(res);
     } catch (const std::bad_alloc&) {
         PyErr_NoMemory();
         return NULL;
@@ -843,28 +1005,23 @@ PyObject* py_pyramid(PyObject* self, PyObject* args) {
         PyErr_SetString(exc.type(), exc.message());
         return NULL;
     }
-    PyObject* pyramid_list = PyList_New(nr_octaves);
-    if (!pyramid_list) return NULL;
-    for (int o = 0; o != nr_octaves; ++o) {
-        PyObject* arr = reinterpret_cast<PyObject*>(pyramid.pyr.at(o).raw_array());
-        Py_INCREF(arr);
-        PyList_SET_ITEM(pyramid_list, o, arr);
-    }
-    return pyramid_list;
+    return PyArray_Return(res);
 }
 
 
-PyObject* py_integral(PyObject* self, PyObject* args) {
+PyObject* py_sum_rect(PyObject* self, PyObject* args) {
     PyArrayObject* array;
-    if (!PyArg_ParseTuple(args,"O", &array)) return NULL;
+    int y0, x0, y1, x1;
+    if (!PyArg_ParseTuple(args,"Oiiii", &array, &y0, &x0, &y1, &x1)) return NULL;
     if (!PyArray_Check(array) || PyArray_NDIM(array) != 2) {
         PyErr_SetString(PyExc_RuntimeError, TypeErrorMsg);
         return NULL;
     }
-    Py_INCREF(array);
+    holdref a_ref(array);
+    double res;
     switch(PyArray_TYPE(array)) {
     #define HANDLE(type) \
-        integral<type>(numpy::aligned_array<type>(array));
+        res = sum_rect<type>(numpy::aligned_array<type>(array), y0, x0, y1, x1);
 
         HANDLE_TYPES();
     #undef HANDLE
@@ -872,38 +1029,331 @@ PyObject* py_integral(PyObject* self, PyObject* args) {
         PyErr_SetString(PyExc_RuntimeError, TypeErrorMsg);
         return NULL;
     }
-    return PyArray_Return(array);
+    return PyFloat_FromDouble(res);
 }
-PyObject* py_sum_rect(PyObject* self, PyObject* args) {
-    PyArrayObject* array;
-    int y0, x0, y1, x1;
-    if (!PyArg_ParseTuple(args,"Oiiii", &array, &y0, &x0, &y1, &x1)) return NULL;
-    if (!PyArray_Check(array) || PyArray_NDIM(array) != 2) {
+
+// ----------------------------------------------------------------------------------------
+// Descriptor matching
+
+// Squared L2 distance between a & b, but computation stops as soon as it
+// exceeds bound (the result is then some value larger than bound).
+//
+// The loop is written four elements at a time (in independent accumulators)
+// so that the compiler can vectorize it.
+inline
+double squared_distance(const double* a, const double* b, const int D, const double bound) {
+    double d = 0.;
+    int i = 0;
+    while (i + 16 <= D) {
+        double d0 = 0., d1 = 0., d2 = 0., d3 = 0.;
+        for (const int e = i + 16; i != e; i += 4) {
+            const double t0 = a[i] - b[i];
+            const double t1 = a[i+1] - b[i+1];
+            const double t2 = a[i+2] - b[i+2];
+            const double t3 = a[i+3] - b[i+3];
+            d0 += t0*t0;
+            d1 += t1*t1;
+            d2 += t2*t2;
+            d3 += t3*t3;
+        }
+        d += (d0 + d1) + (d2 + d3);
+        if (d > bound) return d;
+    }
+    for ( ; i != D; ++i) {
+        const double t = a[i] - b[i];
+        d += t*t;
+    }
+    return d;
+}
+
+// The two nearest neighbours seen so far
+struct nearest_two {
+    nearest_two()
+        :best(-1)
+        ,best_dist(std::numeric_limits<double>::max())
+        ,second_dist(std::numeric_limits<double>::max())
+        { }
+
+    void add(const npy_intp j, const double dist) {
+        if (dist < best_dist) {
+            second_dist = best_dist;
+            best_dist = dist;
+            best = j;
+        } else if (dist < second_dist) {
+            second_dist = dist;
+        }
+    }
+
+    npy_intp best;
+    double best_dist;
+    double second_dist;
+};
+
+// A kd-tree over the rows of a data array is stored in three arrays:
+//
+//    nodes: (nr_nodes x 3) of npy_intp, each row is (dim, left, right). For
+//           leaves, dim is -1 and the leaf contains the points
+//           perm[left:right]
+//    splits: nr_nodes doubles: points in the left child have data[dim] <= split
+//    perm: a permutation of the rows of data
+//
+// Node 0 is the root.
+struct kdtree_builder {
+    kdtree_builder(const numpy::aligned_array<double>& data, const int leaf_size)
+        :data_(data)
+        ,leaf_size_(leaf_size)
+        ,perm_(data.dim(0))
+        {
+            for (npy_intp i = 0; i != npy_intp(perm_.size()); ++i) perm_[i] = i;
+            if (!perm_.empty()) build(0, perm_.size());
+        }
+
+    std::vector<npy_intp> nodes_;
+    std::vector<double> splits_;
+
+    private:
+    struct compare_dim {
+        compare_dim(const numpy::aligned_array<double>& data, const int dim)
+            :data_(data)
+            ,dim_(dim)
+            { }
+        bool operator()(const npy_intp a, const npy_intp b) const {
+            return data_.at(a, dim_) < data_.at(b, dim_);
+        }
+        const numpy::aligned_array<double>& data_;
+        const int dim_;
+    };
+
+    npy_intp new_node(const npy_intp dim, const npy_intp left, const npy_intp right, const double split) {
+        const npy_intp n = splits_.size();
+        nodes_.push_back(dim);
+        nodes_.push_back(left);
+        nodes_.push_back(right);
+        splits_.push_back(split);
+        return n;
+    }
+
+    // Splits perm[begin:end] along the dimension of largest variance
+    npy_intp build(const npy_intp begin, const npy_intp end) {
+        if (end - begin <= leaf_size_) return new_node(-1, begin, end, 0.);
+        const int D = data_.dim(1);
+        int best_dim = 0;
+        double best_var = -1.;
+        for (int d = 0; d != D; ++d) {
+            double s = 0., s2 = 0.;
+            for (npy_intp i = begin; i != end; ++i) {
+                const double v = data_.at(perm_[i], d);
+                s += v;
+                s2 += v*v;
+            }
+            const double var = s2 - s*s/(end - begin);
+            if (var > best_var) {
+                best_var = var;
+                best_dim = d;
+            }
+        }
+        const npy_intp mid = begin + (end - begin)/2;
+        std::nth_element(perm_.begin() + begin, perm_.begin() + mid, perm_.begin() + end, compare_dim(data_, best_dim));
+        const double split = data_.at(perm_[mid], best_dim);
+        // perm[begin:mid] <= split <= perm[mid:end]
+        const npy_intp n = new_node(best_dim, 0, 0, split);
+        const npy_intp left = build(begin, mid);
+        const npy_intp right = build(mid, end);
+        nodes_[3*n + 1] = left;
+        nodes_[3*n + 2] = right;
+        return n;
+    }
+
+    const numpy::aligned_array<double>& data_;
+    const npy_intp leaf_size_;
+    public:
+    std::vector<npy_intp> perm_;
+};
+
+// Best-bin-first search: the branches not taken are visited in order of their
+// (lower bound) distance to the query. If max_checks is positive, the search
+// stops after that many points have been compared (approximate search);
+// otherwise, the search is exact.
+void kdtree_search(
+        const numpy::aligned_array<double>& data,
+        const npy_intp* nodes,
+        const double* splits,
+        const npy_intp* perm,
+        const double* query,
+        const int max_checks,
+        std::vector<std::pair<double, npy_intp> >& queue,
+        nearest_two& res) {
+    const int D = data.dim(1);
+    int checks = 0;
+    queue.clear();
+    queue.push_back(std::make_pair(0., npy_intp(0)));
+    while (!queue.empty()) {
+        std::pop_heap(queue.begin(), queue.end(), std::greater<std::pair<double, npy_intp> >());
+        const double bound = queue.back().first;
+        npy_intp n = queue.back().second;
+        queue.pop_back();
+        if (bound >= res.second_dist) break;
+        while (nodes[3*n] >= 0) {
+            const npy_intp dim = nodes[3*n];
+            const double delta = query[dim] - splits[n];
+            const npy_intp near = nodes[3*n + (delta <= 0 ? 1 : 2)];
+            const npy_intp far = nodes[3*n + (delta <= 0 ? 2 : 1)];
+            const double far_bound = std::max(bound, delta*delta);
+            if (far_bound < res.second_dist) {
+                queue.push_back(std::make_pair(far_bound, far));
+                std::push_heap(queue.begin(), queue.end(), std::greater<std::pair<double, npy_intp> >());
+            }
+            n = near;
+        }
+        for (npy_intp i = nodes[3*n + 1]; i != nodes[3*n + 2]; ++i) {
+            const npy_intp j = perm[i];
+            res.add(j, squared_distance(query, data.data(j), D, res.second_dist));
+        }
+        checks += nodes[3*n + 2] - nodes[3*n + 1];
+        if (max_checks > 0 && checks >= max_checks) break;
+    }
+}
+
+// Builds the kd-tree into nodes, splits & perm, which must have room for
+// 2*N - 1 nodes (the maximum possible). Returns the actual number of nodes.
+PyObject* py_build_kdtree(PyObject* self, PyObject* args) {
+    PyArrayObject* data_arr;
+    int leaf_size;
+    PyArrayObject* nodes_arr;
+    PyArrayObject* splits_arr;
+    PyArrayObject* perm_arr;
+    if (!PyArg_ParseTuple(args,"OiOOO", &data_arr, &leaf_size, &nodes_arr, &splits_arr, &perm_arr)) return NULL;
+    if (!numpy::are_arrays(data_arr, nodes_arr, splits_arr) || !PyArray_Check(perm_arr) ||
+        PyArray_TYPE(data_arr) != NPY_DOUBLE ||
+        PyArray_NDIM(data_arr) != 2 ||
+        PyArray_TYPE(nodes_arr) != numpy::index_type_number || !PyArray_ISCARRAY(nodes_arr) ||
+        PyArray_TYPE(splits_arr) != NPY_DOUBLE || !PyArray_ISCARRAY(splits_arr) ||
+        PyArray_TYPE(perm_arr) != numpy::index_type_number || !PyArray_ISCARRAY(perm_arr) ||
+        PyArray_NDIM(nodes_arr) != 2 || PyArray_DIM(nodes_arr, 1) != 3 ||
+        PyArray_DIM(nodes_arr, 0) < 2*PyArray_DIM(data_arr, 0) - 1 ||
+        PyArray_DIM(splits_arr, 0) != PyArray_DIM(nodes_arr, 0) ||
+        PyArray_DIM(perm_arr, 0) != PyArray_DIM(data_arr, 0) ||
+        leaf_size < 1) {
         PyErr_SetString(PyExc_RuntimeError, TypeErrorMsg);
         return NULL;
     }
-    holdref a_ref(array);
-    double res;
-    switch(PyArray_TYPE(array)) {
-    #define HANDLE(type) \
-        res = sum_rect<type>(numpy::aligned_array<type>(array), y0, x0, y1, x1);
+    npy_intp nr_nodes;
+    try {
+        const numpy::aligned_array<double> data(data_arr);
+        gil_release nogil;
+        kdtree_builder builder(data, leaf_size);
+        nr_nodes = builder.splits_.size();
+        std::copy(builder.nodes_.begin(), builder.nodes_.end(), static_cast<npy_intp*>(PyArray_DATA(nodes_arr)));
+        std::copy(builder.splits_.begin(), builder.splits_.end(), static_cast<double*>(PyArray_DATA(splits_arr)));
+        std::copy(builder.perm_.begin(), builder.perm_.end(), static_cast<npy_intp*>(PyArray_DATA(perm_arr)));
+    } catch (const std::bad_alloc&) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+    return PyLong_FromLong(nr_nodes);
+}
 
-        HANDLE_TYPES();
-    #undef HANDLE
-        default:
+// For each row i of queries (with i % nr_parts == part), matches[i] is set to
+// the index of its nearest neighbour among the rows of data if it passes the
+// ratio test (and to -1 otherwise); distances[i] is the distance to it.
+//
+// If nodes is None, then the search is by brute force, otherwise it uses the
+// kd-tree (nodes, splits, perm) over data built by py_build_kdtree.
+PyObject* py_match(PyObject* self, PyObject* args) {
+    PyArrayObject* queries_arr;
+    PyArrayObject* data_arr;
+    double ratio;
+    int max_checks;
+    PyObject* nodes_obj;
+    PyObject* splits_obj;
+    PyObject* perm_obj;
+    PyArrayObject* matches_arr;
+    PyArrayObject* distances_arr;
+    int part;
+    int nr_parts;
+    if (!PyArg_ParseTuple(args,"OOdiOOOOOii",
+                &queries_arr, &data_arr, &ratio, &max_checks,
+                &nodes_obj, &splits_obj, &perm_obj,
+                &matches_arr, &distances_arr, &part, &nr_parts)) return NULL;
+    const bool use_tree = (nodes_obj != Py_None);
+    if (!PyArray_Check(queries_arr) || !PyArray_Check(data_arr) ||
+        !PyArray_Check(matches_arr) || !PyArray_Check(distances_arr) ||
+        PyArray_TYPE(queries_arr) != NPY_DOUBLE || !PyArray_ISCARRAY_RO(queries_arr) ||
+        PyArray_TYPE(data_arr) != NPY_DOUBLE || !PyArray_ISCARRAY_RO(data_arr) ||
+        PyArray_NDIM(queries_arr) != 2 || PyArray_NDIM(data_arr) != 2 ||
+        PyArray_DIM(queries_arr, 1) != PyArray_DIM(data_arr, 1) ||
+        PyArray_TYPE(matches_arr) != numpy::index_type_number || !PyArray_ISCARRAY(matches_arr) ||
+        PyArray_TYPE(distances_arr) != NPY_DOUBLE || !PyArray_ISCARRAY(distances_arr) ||
+        PyArray_NDIM(matches_arr) != 1 || PyArray_DIM(matches_arr, 0) != PyArray_DIM(queries_arr, 0) ||
+        PyArray_NDIM(distances_arr) != 1 || PyArray_DIM(distances_arr, 0) != PyArray_DIM(queries_arr, 0) ||
+        part < 0 || nr_parts <= part) {
         PyErr_SetString(PyExc_RuntimeError, TypeErrorMsg);
         return NULL;
     }
-    return PyFloat_FromDouble(res);
+    if (use_tree) {
+        if (!PyArray_Check(nodes_obj) || !PyArray_Check(splits_obj) || !PyArray_Check(perm_obj)) {
+            PyErr_SetString(PyExc_RuntimeError, TypeErrorMsg);
+            return NULL;
+        }
+        PyArrayObject* nodes_arr = reinterpret_cast<PyArrayObject*>(nodes_obj);
+        PyArrayObject* splits_arr = reinterpret_cast<PyArrayObject*>(splits_obj);
+        PyArrayObject* perm_arr = reinterpret_cast<PyArrayObject*>(perm_obj);
+        if (PyArray_TYPE(nodes_arr) != numpy::index_type_number || !PyArray_ISCARRAY_RO(nodes_arr) ||
+            PyArray_TYPE(splits_arr) != NPY_DOUBLE || !PyArray_ISCARRAY_RO(splits_arr) ||
+            PyArray_TYPE(perm_arr) != numpy::index_type_number || !PyArray_ISCARRAY_RO(perm_arr) ||
+            PyArray_NDIM(nodes_arr) != 2 || PyArray_DIM(nodes_arr, 1) != 3 ||
+            PyArray_DIM(splits_arr, 0) != PyArray_DIM(nodes_arr, 0) ||
+            PyArray_DIM(perm_arr, 0) != PyArray_DIM(data_arr, 0) ||
+            PyArray_DIM(nodes_arr, 0) == 0) {
+            PyErr_SetString(PyExc_RuntimeError, TypeErrorMsg);
+            return NULL;
+        }
+    }
+    try {
+        const numpy::aligned_array<double> queries(queries_arr);
+        const numpy::aligned_array<double> data(data_arr);
+        const npy_intp* nodes = (use_tree ? static_cast<const npy_intp*>(PyArray_DATA((PyArrayObject*)nodes_obj)) : 0);
+        const double* splits = (use_tree ? static_cast<const double*>(PyArray_DATA((PyArrayObject*)splits_obj)) : 0);
+        const npy_intp* perm = (use_tree ? static_cast<const npy_intp*>(PyArray_DATA((PyArrayObject*)perm_obj)) : 0);
+        npy_intp* matches = static_cast<npy_intp*>(PyArray_DATA(matches_arr));
+        double* distances = static_cast<double*>(PyArray_DATA(distances_arr));
+
+        gil_release nogil;
+        const npy_intp N = queries.dim(0);
+        const npy_intp M = data.dim(0);
+        const int D = queries.dim(1);
+        // The ratio test is performed on squared distances
+        const double ratio2 = ratio*ratio;
+        std::vector<std::pair<double, npy_intp> > queue;
+        for (npy_intp i = part; i < N; i += nr_parts) {
+            const double* q = queries.data(i);
+            nearest_two res;
+            if (use_tree) {
+                kdtree_search(data, nodes, splits, perm, q, max_checks, queue, res);
+            } else {
+                for (npy_intp j = 0; j != M; ++j) {
+                    res.add(j, squared_distance(q, data.data(j), D, res.second_dist));
+                }
+            }
+            const bool ok = (res.best >= 0 && res.best_dist < ratio2 * res.second_dist);
+            matches[i] = (ok ? res.best : -1);
+            distances[i] = (res.best >= 0 ? std::sqrt(res.best_dist) : std::numeric_limits<double>::infinity());
+        }
+    } catch (const std::bad_alloc&) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+    Py_RETURN_NONE;
 }
 
 PyMethodDef methods[] = {
-  {"integral",(PyCFunction)py_integral, METH_VARARGS, NULL},
-  {"pyramid",(PyCFunction)py_pyramid, METH_VARARGS, NULL},
+  {"allocate_pyramid",(PyCFunction)py_allocate_pyramid, METH_VARARGS, NULL},
+  {"fill_pyramid",(PyCFunction)py_fill_pyramid, METH_VARARGS, NULL},
   {"interest_points",(PyCFunction)py_interest_points, METH_VARARGS, NULL},
   {"sum_rect",(PyCFunction)py_sum_rect, METH_VARARGS, NULL},
   {"descriptors",(PyCFunction)py_descriptors, METH_VARARGS, NULL},
-  {"surf",(PyCFunction)py_surf, METH_VARARGS, NULL},
+  {"build_kdtree",(PyCFunction)py_build_kdtree, METH_VARARGS, NULL},
+  {"match",(PyCFunction)py_match, METH_VARARGS, NULL},
   {NULL, NULL,0,NULL},
 };
 
@@ -0,0 +1,194 @@
+// Copyright (C) 2012, Luis Pedro Coelho <luis@luispedro.org>
+// vim: set ts=4 sts=4 sw=4 expandtab smartindent:
+//
+// License: MIT (see COPYING file)
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "../numpypp/array.hpp"
+#include "../numpypp/dispatch.hpp"
+#include "../utils.hpp"
+
+extern "C" {
+    #include <Python.h>
+    #include <numpy/ndarrayobject.h>
+}
+
+namespace{
+
+const char TypeErrorMsg[] =
+    "Type not understood. "
+    "This is caused by either a direct call to _tas (which is dangerous: types are not checked!) or a bug in tas.py.\n";
+
+// Same computation as mahotas.thresholding.otsu
+template <typename T>
+T otsu(const std::vector<T>& values, const T maxval) {
+    std::vector<double> hist(npy_intp(maxval) + 1);
+    for (unsigned i = 0; i != values.size(); ++i) ++hist[npy_intp(values[i])];
+    const double Hsum = values.size() - hist[0];
+    if (Hsum == 0) return 0;
+    const npy_intp Ng = hist.size();
+    std::vector<double> nB(Ng), nO(Ng);
+    double cumsum = 0.;
+    for (npy_intp i = 0; i != Ng; ++i) {
+        cumsum += hist[i];
+        nB[i] = cumsum;
+    }
+    for (npy_intp i = 0; i != Ng; ++i) nO[i] = nB[Ng - 1] - nB[i];
+
+    double mu_B = 0.;
+    double mu_O = 0.;
+    for (npy_intp i = 1; i != Ng; ++i) mu_O += i*hist[i];
+    mu_O /= Hsum;
+    double best = nB[0]*nO[0]*(mu_B-mu_O)*(mu_B-mu_O);
+    npy_intp bestT = 0;
+    for (npy_intp t = 1; t != Ng; ++t) {
+        if (nB[t] == 0) continue;
+        if (nO[t] == 0) break;
+        mu_B = (mu_B*nB[t-1] + t*hist[t]) / nB[t];
+        mu_O = (mu_O*nO[t-1] - t*hist[t]) / nO[t];
+        const double sigma_between = nB[t]*nO[t]*(mu_B-mu_O)*(mu_B-mu_O);
+        if (sigma_between > best) {
+            best = sigma_between;
+            bestT = t;
+        }
+    }
+    return T(bestT);
+}
+
+// Threshold adjacency statistics of binary image b (N0 x N1): the
+// (normalised) histogram of the number of neighbours (out of 8) which differ
+// from the centre, over all pixels equal to `centre`. The image is extended
+// by repeating the border (as convolve() does in 'reflect' mode).
+void tas_counts(const std::vector<bool>& b, const npy_intp N0, const npy_intp N1, const bool centre, double* out) {
+    std::fill(out, out + 9, 0.);
+    for (npy_intp y = 0; y != N0; ++y) {
+        for (npy_intp x = 0; x != N1; ++x) {
+            if (b[y*N1 + x] != centre) continue;
+            int n = 0;
+            for (int dy = -1; dy <= 1; ++dy) {
+                const npy_intp ny = std::min<npy_intp>(std::max<npy_intp>(y + dy, 0), N0 - 1);
+                for (int dx = -1; dx <= 1; ++dx) {
+                    const npy_intp nx = std::min<npy_intp>(std::max<npy_intp>(x + dx, 0), N1 - 1);
+                    n += (b[ny*N1 + nx] != centre);
+                }
+            }
+            ++out[n];
+        }
+    }
+    double total = 0.;
+    for (int i = 0; i != 9; ++i) total += out[i];
+    if (total > 0) {
+        for (int i = 0; i != 9; ++i) out[i] /= total;
+    }
+}
+
+// Parameter free TAS of objects label0 .. label1-1: the features of object
+// `label` are those that pftas() computes for its bounding box with the
+// pixels of other objects set to zero. output is a C-contiguous
+// (nr_labels x 54) array.
+template<typename T>
+void labeled_pftas(const numpy::aligned_array<T> f, const numpy::aligned_array<int> labeled, const npy_intp* bboxes, const int label0, const int label1, double* output) {
+    gil_release nogil;
+    std::vector<T> values;
+    std::vector<bool> b;
+    for (int label = label0; label != label1; ++label) {
+        const npy_intp* bbox = bboxes + 4*label;
+        if (bbox[1] == bbox[0]) continue;
+        const npy_intp N0 = bbox[1] - bbox[0];
+        const npy_intp N1 = bbox[3] - bbox[2];
+        values.resize(N0*N1);
+        T maxval = 0;
+        for (npy_intp y = 0; y != N0; ++y) {
+            for (npy_intp x = 0; x != N1; ++x) {
+                const npy_intp py = bbox[0] + y;
+                const npy_intp px = bbox[2] + x;
+                const T v = (labeled.at(py, px) == label ? f.at(py, px) : T(0));
+                values[y*N1 + x] = v;
+                maxval = std::max(maxval, v);
+            }
+        }
+        const T thresh = otsu(values, maxval);
+
+        // mean & standard deviation of the pixels above the threshold
+        double total = 0., sum = 0.;
+        for (unsigned i = 0; i != values.size(); ++i) {
+            if (values[i] > thresh) {
+                ++total;
+                sum += values[i];
+            }
+        }
+        const double mean = sum/total;
+        double var = 0.;
+        for (unsigned i = 0; i != values.size(); ++i) {
+            if (values[i] > thresh) var += (values[i] - mean)*(values[i] - mean);
+        }
+        const double margin = std::sqrt(var/total);
+        const double mu = sum / (total + 1e-8);
+
+        double* out = output + 54*label;
+        b.resize(values.size());
+        for (int t = 0; t != 3; ++t) {
+            for (unsigned i = 0; i != values.size(); ++i) {
+                const double v = values[i];
+                if (t == 0) b[i] = (v > mu - margin) && (v < mu + margin);
+                else if (t == 1) b[i] = (v > mu - margin);
+                else b[i] = (v > mu);
+            }
+            tas_counts(b, N0, N1, false, out + 9*t);
+            tas_counts(b, N0, N1, true, out + 27 + 9*t);
+        }
+    }
+}
+
+PyObject* py_labeled_pftas(PyObject* self, PyObject* args) {
+    PyArrayObject* array;
+    PyArrayObject* labeled;
+    PyArrayObject* bboxes;
+    int label0, label1;
+    PyArrayObject* output;
+    if (!PyArg_ParseTuple(args,"OOOiiO", &array, &labeled, &bboxes, &label0, &label1, &output)) return NULL;
+    if (!numpy::are_arrays(array, labeled, bboxes) || !numpy::are_arrays(output) ||
+        PyArray_NDIM(array) != 2 || !numpy::same_shape(array, labeled) ||
+        PyArray_TYPE(labeled) != NPY_INT ||
+        PyArray_TYPE(bboxes) != numpy::index_type_number || !PyArray_ISCARRAY(bboxes) ||
+        PyArray_NDIM(bboxes) != 2 || PyArray_DIM(bboxes, 1) != 4 ||
+        PyArray_TYPE(output) != NPY_DOUBLE || !PyArray_ISCARRAY(output) ||
+        PyArray_NDIM(output) != 2 || PyArray_DIM(output, 0) != PyArray_DIM(bboxes, 0) ||
+        PyArray_DIM(output, 1) != 54 ||
+        label0 < 0 || label1 < label0 || label1 > PyArray_DIM(bboxes, 0)) {
+        PyErr_SetString(PyExc_RuntimeError, TypeErrorMsg);
+        return NULL;
+    }
+    const npy_intp* bboxes_data = static_cast<const npy_intp*>(PyArray_DATA(bboxes));
+    double* output_data = static_cast<double*>(PyArray_DATA(output));
+    try {
+    switch(PyArray_TYPE(array)) {
+#define HANDLE(type) \
+        labeled_pftas<type>(numpy::aligned_array<type>(array), numpy::aligned_array<int>(labeled), bboxes_data, label0, label1, output_data); \
+        break;
+
+        case NPY_UBYTE: HANDLE(unsigned char)
+        case NPY_USHORT: HANDLE(unsigned short)
+        case NPY_UINT: HANDLE(unsigned int)
+        case NPY_ULONG: HANDLE(npy_ulong)
+#undef HANDLE
+        default:
+        PyErr_SetString(PyExc_RuntimeError, TypeErrorMsg);
+        return NULL;
+    }
+    }
+    CATCH_PYTHON_EXCEPTIONS(true)
+    Py_RETURN_NONE;
+}
+
+PyMethodDef methods[] = {
+  {"labeled_pftas",(PyCFunction)py_labeled_pftas, METH_VARARGS, NULL},
+  {NULL, NULL,0,NULL},
+};
+
+} // namespace
+
+DECLARE_MODULE(_tas)
@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <cmath>
 #include <queue>
 #include <vector>
 #include <cstdio>
@@ -78,33 +79,778 @@ PyObject* py_cooccurent(PyObject* self, PyObject* args) {
     }
     Py_RETURN_NONE;
 }
-PyObject* py_compute_plus_minus(PyObject* self, PyObject* args) {
-    PyArrayObject* p_;
-    PyArrayObject* px_plus_y_;
-    PyArrayObject* px_minus_y_;
-    if (!PyArg_ParseTuple(args,"OOO", &p_, &px_plus_y_, &px_minus_y_)) return NULL;
-    numpy::aligned_array<double> p(p_);
-    numpy::aligned_array<double> px_plus_y(px_plus_y_);
-    numpy::aligned_array<double> px_minus_y(px_minus_y_);
-    const int N = p.size(0);
-    if (p.size(1) != N) {
-        PyErr_SetString(PyExc_RuntimeError, "compute_plus_minus: p is not square.");
+// Maps pixel values to grey levels: either the values themselves or, if
+// levels is non-zero, floor(value * levels / divisor) (clipped to levels - 1).
+// The product is computed exactly in 64 bit integers unless it would
+// overflow.
+template <typename T>
+struct grey_levels {
+    grey_levels(const npy_intp levels, const unsigned long long divisor)
+        :levels_(levels)
+        ,divisor_(divisor)
+        ,max_exact_(levels ? std::numeric_limits<unsigned long long>::max() / levels : 0)
+        { }
+    npy_intp operator()(const T v) const {
+        if (!levels_) return npy_intp(v);
+        const unsigned long long uv = v;
+        const npy_intp level = (uv <= max_exact_ ?
+                        npy_intp((uv * levels_) / divisor_) :
+                        npy_intp(std::floor((long double)(uv) * levels_ / divisor_)));
+        return std::min<npy_intp>(level, levels_ - 1);
+    }
+    const npy_intp levels_;
+    const unsigned long long divisor_;
+    const unsigned long long max_exact_;
+};
+
+// Visits the pixel pairs for all directions in a single pass over the rows of
+// a 3-D image (2-D images are passed in with an extra leading axis), calling
+// sink.add(direction, level, neighbour_level) for each pair. deltas is a
+// C-contiguous (nr_dirs x 3) array. If ignore_zeros, pairs including a zero
+// pixel are skipped.
+//
+// Image is either a numpy::aligned_array<T> or a crop_buffer<T>.
+template<typename T, typename Image, typename Sink>
+void visit_pairs(const Image& f, const npy_intp* deltas, const npy_intp nr_dirs, const bool ignore_zeros, const grey_levels<T>& level, Sink& sink) {
+    const npy_intp N0 = f.dim(0);
+    const npy_intp N1 = f.dim(1);
+    const npy_intp N2 = f.dim(2);
+    const npy_intp step = f.stride(2);
+    for (npy_intp z = 0; z != N0; ++z) {
+        for (npy_intp y = 0; y != N1; ++y) {
+            const T* row = f.data(z, y);
+            for (npy_intp d = 0; d != nr_dirs; ++d) {
+                const npy_intp nz = z + deltas[3*d];
+                const npy_intp ny = y + deltas[3*d + 1];
+                const npy_intp dx = deltas[3*d + 2];
+                if (nz < 0 || nz >= N0 || ny < 0 || ny >= N1) continue;
+                const T* nrow = f.data(nz, ny);
+                const npy_intp x0 = std::max<npy_intp>(0, -dx);
+                const npy_intp x1 = std::min<npy_intp>(N2, N2 - dx);
+                for (npy_intp x = x0; x < x1; ++x) {
+                    const T v = row[x*step];
+                    const T nv = nrow[(x + dx)*step];
+                    if (ignore_zeros && (!v || !nv)) continue;
+                    sink.add(d, level(v), level(nv));
+                }
+            }
+        }
+    }
+}
+
+// Dense co-occurrence matrices: cmats is a C-contiguous (nr_dirs x fm1 x fm1)
+// array
+struct dense_sink {
+    dense_sink(npy_int32* cmats, const npy_intp fm1)
+        :cmats_(cmats)
+        ,fm1_(fm1)
+        { }
+    void add(const npy_intp d, const npy_intp i, const npy_intp j) {
+        ++cmats_[(d*fm1_ + i)*fm1_ + j];
+    }
+    npy_int32* cmats_;
+    const npy_intp fm1_;
+};
+
+// Sparse co-occurrence matrices: the pairs of each direction are collected
+// (encoded as smaller_level * fm1 + larger_level) and later sorted into runs.
+struct sparse_sink {
+    sparse_sink(const npy_intp nr_dirs, const npy_intp fm1)
+        :pairs_(nr_dirs)
+        ,fm1_(fm1)
+        { }
+    void add(const npy_intp d, const npy_intp i, const npy_intp j) {
+        pairs_[d].push_back(i < j ? i*fm1_ + j : j*fm1_ + i);
+    }
+    std::vector<std::vector<npy_intp> > pairs_;
+    const npy_intp fm1_;
+};
+
+// An entry (i, j, count) of a symmetric co-occurrence matrix, with i <= j
+// (which stands for both (i, j) and (j, i))
+struct cooc_entry {
+    cooc_entry(const npy_intp i, const npy_intp j, const npy_intp count)
+        :i(i)
+        ,j(j)
+        ,count(count)
+        { }
+    npy_intp i, j;
+    npy_intp count;
+};
+
+// Upper triangle of the symmetric co-occurrence matrix (as a list of its
+// non-zero entries) from the pairs in a sparse_sink
+void sparse_cooccurence(std::vector<npy_intp>& pairs, const npy_intp fm1, std::vector<cooc_entry>& entries) {
+    std::sort(pairs.begin(), pairs.end());
+    entries.clear();
+    for (unsigned s = 0; s != pairs.size(); ) {
+        unsigned e = s + 1;
+        while (e != pairs.size() && pairs[e] == pairs[s]) ++e;
+        const npy_intp i = pairs[s] / fm1;
+        const npy_intp j = pairs[s] % fm1;
+        // Diagonal entries are counted twice when p is symmetrised
+        entries.push_back(cooc_entry(i, j, (i == j ? 2 : 1)*npy_intp(e - s)));
+        s = e;
+    }
+}
+
+// Non-zero values of a distribution (as index, probability pairs, sorted by
+// index)
+typedef std::vector<std::pair<npy_intp, double> > marginal;
+
+double entropy(const marginal& p) {
+    double res = 0.;
+    for (unsigned i = 0; i != p.size(); ++i) {
+        if (p[i].second != 0.) res -= p[i].second * std::log(p[i].second);
+    }
+    return res/std::log(2.);
+}
+
+// Sums over the entries of p which are needed for the Haralick features
+struct cooc_sums {
+    cooc_sums()
+        :asm_(0.)
+        ,sum_ij(0.)
+        ,idm(0.)
+        ,plogp(0.)
+        { }
+    void add(const npy_intp i, const npy_intp j, const double p) {
+        asm_ += p*p;
+        sum_ij += double(i)*j*p;
+        idm += p/(1. + double(i - j)*(i - j));
+        plogp -= p*std::log(p);
+    }
+    double asm_, sum_ij, idm, plogp;
+};
+
+// Computes the first 13 Haralick features from the marginals of a
+// (symmetric) co-occurrence matrix p with fm1 grey levels (see texture.py for
+// the definitions).
+//
+// As p is symmetric, HXY1 & HXY2 can be computed from the marginals alone,
+// without building the outer product of px & py:
+//
+//      HXY1 = -sum_ij p_ij log(px_i py_j) = -sum_i py_i log(px_i) - sum_j px_j log(py_j)
+//      HXY2 = -sum_ij px_i py_j log(px_i py_j) = HX sum(py) + HY sum(px)
+void haralick_features(const cooc_sums& sums, const marginal& px, const marginal& py, const marginal& px_plus_y, const marginal& px_minus_y, const npy_intp fm1, const bool preserve_haralick_bug, double* feats) {
+    double ux = 0., uy = 0., vx = 0., vy = 0.;
+    for (unsigned k = 0; k != px.size(); ++k) {
+        ux += px[k].first*px[k].second;
+        vx += double(px[k].first)*px[k].first*px[k].second;
+    }
+    for (unsigned k = 0; k != py.size(); ++k) {
+        uy += py[k].first*py[k].second;
+        vy += double(py[k].first)*py[k].first*py[k].second;
+    }
+    vx -= ux*ux;
+    vy -= uy*uy;
+    const double sx = std::sqrt(vx);
+    const double sy = std::sqrt(vy);
+
+    feats[0] = sums.asm_;
+    double contrast = 0.;
+    for (unsigned k = 0; k != px_minus_y.size(); ++k) {
+        contrast += double(px_minus_y[k].first)*px_minus_y[k].first*px_minus_y[k].second;
+    }
+    feats[1] = contrast;
+    if (sx == 0. || sy == 0.) feats[2] = 1.;
+    else feats[2] = (1./sx/sy) * (sums.sum_ij - ux*uy);
+    feats[3] = vx;
+    feats[4] = sums.idm;
+    double sum_avg = 0., sum_sq = 0.;
+    for (unsigned k = 0; k != px_plus_y.size(); ++k) {
+        const double v = px_plus_y[k].first;
+        sum_avg += v*px_plus_y[k].second;
+        sum_sq += v*v*px_plus_y[k].second;
+    }
+    feats[5] = sum_avg;
+    feats[7] = entropy(px_plus_y);
+    // See the comment in texture.py about Haralick's typo
+    if (preserve_haralick_bug) {
+        double s = 0.;
+        for (unsigned k = 0; k != px_plus_y.size(); ++k) {
+            const double delta = px_plus_y[k].first - feats[7];
+            s += delta*delta*px_plus_y[k].second;
+        }
+        feats[6] = s;
+    } else {
+        feats[6] = sum_sq - sum_avg*sum_avg;
+    }
+    feats[8] = sums.plogp/std::log(2.);
+
+    // Variance of the fm1 values of px_minus_y (including the zeros, which
+    // are not in the list)
+    double mean = 0.;
+    for (unsigned k = 0; k != px_minus_y.size(); ++k) mean += px_minus_y[k].second;
+    mean /= fm1;
+    double var = (fm1 - npy_intp(px_minus_y.size()))*mean*mean;
+    for (unsigned k = 0; k != px_minus_y.size(); ++k) {
+        var += (px_minus_y[k].second - mean)*(px_minus_y[k].second - mean);
+    }
+    feats[9] = var/fm1;
+    feats[10] = entropy(px_minus_y);
+
+    double HX = 0., HY = 0., HXY1 = 0., sum_px = 0., sum_py = 0.;
+    // px & py have the same support (p is symmetric)
+    for (unsigned k = 0; k != px.size(); ++k) {
+        const double log_px = std::log(px[k].second);
+        const double log_py = std::log(py[k].second);
+        HX -= px[k].second*log_px;
+        HY -= py[k].second*log_py;
+        HXY1 -= py[k].second*log_px;
+        HXY1 -= px[k].second*log_py;
+        sum_px += px[k].second;
+        sum_py += py[k].second;
+    }
+    HX /= std::log(2.);
+    HY /= std::log(2.);
+    HXY1 /= std::log(2.);
+    const double HXY2 = HX*sum_py + HY*sum_px;
+    const double maxH = std::max(HX, HY);
+    feats[11] = (maxH == 0. ? (feats[8] - HXY1) : (feats[8] - HXY1)/maxH);
+    // HXY2 >= HXY, but in a flat window both are zero and the difference may
+    // round to a tiny negative value
+    feats[12] = std::sqrt(1. - std::exp(-2. * std::max(0., HXY2 - feats[8])));
+}
+
+void nonzeros(const std::vector<double>& dense, marginal& res, const double scale = 1.) {
+    res.clear();
+    for (unsigned k = 0; k != dense.size(); ++k) {
+        if (dense[k] != 0.) res.push_back(std::make_pair(npy_intp(k), scale*dense[k]));
+    }
+}
+
+// Features of a dense (symmetric) co-occurrence matrix
+void dense_haralick_features(const npy_int32* cmat, const npy_intp fm1, const bool preserve_haralick_bug, double* feats) {
+    double total = 0.;
+    for (npy_intp i = 0; i != fm1*fm1; ++i) total += cmat[i];
+    if (total == 0.) return;
+
+    std::vector<double> px(fm1), py(fm1), px_plus_y(2*fm1), px_minus_y(fm1);
+    cooc_sums sums;
+    for (npy_intp i = 0; i != fm1; ++i) {
+        const npy_int32* crow = cmat + i*fm1;
+        for (npy_intp j = 0; j != fm1; ++j) {
+            if (!crow[j]) continue;
+            const double p = crow[j] / total;
+            px[j] += p;
+            py[i] += p;
+            px_plus_y[i + j] += p;
+            px_minus_y[std::abs(i - j)] += p;
+            sums.add(i, j, p);
+        }
+    }
+    marginal mpx, mpy, mpx_plus_y, mpx_minus_y;
+    nonzeros(px, mpx);
+    nonzeros(py, mpy);
+    nonzeros(px_plus_y, mpx_plus_y);
+    nonzeros(px_minus_y, mpx_minus_y);
+    haralick_features(sums, mpx, mpy, mpx_plus_y, mpx_minus_y, fm1, preserve_haralick_bug, feats);
+}
+
+// Features of a sparse co-occurrence matrix. Only the matrix needs to be
+// sparse: the marginals have O(fm1) entries.
+void sparse_haralick_features(const std::vector<cooc_entry>& entries, const npy_intp fm1, const bool preserve_haralick_bug, double* feats) {
+    double total = 0.;
+    for (unsigned e = 0; e != entries.size(); ++e) {
+        total += (entries[e].i == entries[e].j ? 1 : 2) * entries[e].count;
+    }
+    if (total == 0.) return;
+
+    std::vector<double> py(fm1), px_plus_y(2*fm1), px_minus_y(fm1);
+    cooc_sums sums;
+    for (unsigned e = 0; e != entries.size(); ++e) {
+        const npy_intp i = entries[e].i;
+        const npy_intp j = entries[e].j;
+        const double p = entries[e].count / total;
+        py[i] += p;
+        sums.add(i, j, p);
+        if (i == j) {
+            px_plus_y[2*i] += p;
+            px_minus_y[0] += p;
+        } else {
+            py[j] += p;
+            sums.add(j, i, p);
+            px_plus_y[i + j] += 2*p;
+            px_minus_y[j - i] += 2*p;
+        }
+    }
+    marginal mpy, mpx_plus_y, mpx_minus_y;
+    nonzeros(py, mpy);
+    nonzeros(px_plus_y, mpx_plus_y);
+    nonzeros(px_minus_y, mpx_minus_y);
+    // p is symmetric, so px == py
+    haralick_features(sums, mpy, mpy, mpx_plus_y, mpx_minus_y, fm1, preserve_haralick_bug, feats);
+}
+
+// Symmetrises the co-occurrence matrices filled in by a dense_sink and
+// computes their features
+void dense_features(npy_int32* cmats, const npy_intp nr_dirs, const npy_intp fm1, const bool preserve_haralick_bug, double* feats, const npy_intp nr_feats) {
+    for (npy_intp d = 0; d != nr_dirs; ++d) {
+        npy_int32* cmat = cmats + d*fm1*fm1;
+        for (npy_intp i = 0; i != fm1; ++i) {
+            for (npy_intp j = i; j != fm1; ++j) {
+                const npy_int32 total = cmat[i*fm1 + j] + cmat[j*fm1 + i];
+                cmat[i*fm1 + j] = total;
+                cmat[j*fm1 + i] = total;
+            }
+        }
+        dense_haralick_features(cmat, fm1, preserve_haralick_bug, feats + d*nr_feats);
+    }
+}
+
+// Builds the co-occurrence matrices from the pairs collected by a
+// sparse_sink and computes their features
+void sparse_features(sparse_sink& sink, const npy_intp nr_dirs, const npy_intp fm1, std::vector<std::vector<cooc_entry> >& entries, const bool preserve_haralick_bug, double* feats, const npy_intp nr_feats) {
+    for (npy_intp d = 0; d != nr_dirs; ++d) {
+        sparse_cooccurence(sink.pairs_[d], fm1, entries[d]);
+        std::vector<npy_intp>().swap(sink.pairs_[d]);
+        sparse_haralick_features(entries[d], fm1, preserve_haralick_bug, feats + d*nr_feats);
+    }
+}
+
+template<typename T>
+void haralick(const numpy::aligned_array<T> f, const npy_intp* deltas, const npy_intp nr_dirs, npy_int32* cmats, const npy_intp fm1, double* feats, const npy_intp nr_feats, const bool ignore_zeros, const bool preserve_haralick_bug, const npy_intp levels, const unsigned long long divisor) {
+    gil_release nogil;
+    std::fill(cmats, cmats + nr_dirs*fm1*fm1, 0);
+    dense_sink sink(cmats, fm1);
+    visit_pairs(f, deltas, nr_dirs, ignore_zeros, grey_levels<T>(levels, divisor), sink);
+    dense_features(cmats, nr_dirs, fm1, preserve_haralick_bug, feats, nr_feats);
+}
+
+template<typename T>
+void haralick_sparse(const numpy::aligned_array<T> f, const npy_intp* deltas, const npy_intp nr_dirs, std::vector<std::vector<cooc_entry> >& entries, const npy_intp fm1, double* feats, const npy_intp nr_feats, const bool ignore_zeros, const bool preserve_haralick_bug, const npy_intp levels, const unsigned long long divisor) {
+    gil_release nogil;
+    sparse_sink sink(nr_dirs, fm1);
+    visit_pairs(f, deltas, nr_dirs, ignore_zeros, grey_levels<T>(levels, divisor), sink);
+    sparse_features(sink, nr_dirs, fm1, entries, preserve_haralick_bug, feats, nr_feats);
+}
+
+// A copy of the pixels of a single object (inside its bounding box). Pixels
+// which belong to other objects are set to zero.
+template<typename T>
+struct crop_buffer {
+    // bbox is [min_0, max_0, min_1, max_1, min_2, max_2]
+    crop_buffer(const numpy::aligned_array<T>& f, const numpy::aligned_array<int>& labeled, const npy_intp* bbox, const int label)
+        :max_(0) {
+        for (int d = 0; d != 3; ++d) dims_[d] = bbox[2*d + 1] - bbox[2*d];
+        // std::vector<bool> cannot be used as a plain buffer
+        values_ = new T[dims_[0]*dims_[1]*dims_[2]];
+        T* out = values_;
+        for (npy_intp z = bbox[0]; z != bbox[1]; ++z) {
+            for (npy_intp y = bbox[2]; y != bbox[3]; ++y) {
+                const T* row = f.data(z, y);
+                const int* lrow = labeled.data(z, y);
+                for (npy_intp x = bbox[4]; x != bbox[5]; ++x, ++out) {
+                    *out = (lrow[x*labeled.stride(2)] == label ? row[x*f.stride(2)] : T(0));
+                    if (*out > max_) max_ = *out;
+                }
+            }
+        }
+    }
+    ~crop_buffer() {
+        delete [] values_;
+    }
+    npy_intp dim(const int d) const { return dims_[d]; }
+    npy_intp stride(const int d) const { return (d == 2 ? 1 : (d == 1 ? dims_[2] : dims_[1]*dims_[2])); }
+    const T* data(const npy_intp z, const npy_intp y) const { return &values_[(z*dims_[1] + y)*dims_[2]]; }
+    T max() const { return max_; }
+
+    private:
+    npy_intp dims_[3];
+    T* values_;
+    T max_;
+
+    // Not copyable
+    crop_buffer(const crop_buffer&);
+    crop_buffer& operator=(const crop_buffer&);
+};
+
+// Haralick features of objects label0 .. label1-1: the features of object
+// `label` are those of its bounding box with the pixels of other objects set
+// to zero. feats is a C-contiguous (nr_labels x nr_dirs x nr_feats) array.
+template<typename T>
+void labeled_haralick(const numpy::aligned_array<T> f, const numpy::aligned_array<int> labeled, const npy_intp* bboxes, const int label0, const int label1, const npy_intp* deltas, const npy_intp nr_dirs, double* feats, const npy_intp nr_feats, const bool ignore_zeros, const bool preserve_haralick_bug, const npy_intp max_dense_levels) {
+    gil_release nogil;
+    std::vector<npy_int32> cmats;
+    std::vector<std::vector<cooc_entry> > entries(nr_dirs);
+    const grey_levels<T> level(0, 1);
+    for (int label = label0; label != label1; ++label) {
+        const npy_intp* bbox = bboxes + 6*label;
+        if (bbox[1] == bbox[0]) continue;
+        crop_buffer<T> crop(f, labeled, bbox, label);
+        const npy_intp fm1 = npy_intp(crop.max()) + 1;
+        const npy_intp size = crop.dim(0)*crop.dim(1)*crop.dim(2);
+        double* ofeats = feats + label*nr_dirs*nr_feats;
+        if (fm1 <= max_dense_levels || (fm1 <= 8*max_dense_levels && fm1*fm1 <= size)) {
+            cmats.assign(nr_dirs*fm1*fm1, 0);
+            dense_sink sink(&cmats[0], fm1);
+            visit_pairs(crop, deltas, nr_dirs, ignore_zeros, level, sink);
+            dense_features(&cmats[0], nr_dirs, fm1, preserve_haralick_bug, ofeats, nr_feats);
+        } else {
+            sparse_sink sink(nr_dirs, fm1);
+            visit_pairs(crop, deltas, nr_dirs, ignore_zeros, level, sink);
+            sparse_features(sink, nr_dirs, fm1, entries, preserve_haralick_bug, ofeats, nr_feats);
+        }
+    }
+}
+
+PyObject* py_haralick(PyObject* self, PyObject* args) {
+    PyArrayObject* array;
+    PyArrayObject* deltas;
+    PyObject* cmats_obj;
+    PyArrayObject* feats;
+    int ignore_zeros;
+    int preserve_haralick_bug;
+    Py_ssize_t fm1;
+    Py_ssize_t levels;
+    unsigned long long divisor;
+    int return_entries;
+    if (!PyArg_ParseTuple(args,"OOOOiinnKi", &array, &deltas, &cmats_obj, &feats, &ignore_zeros, &preserve_haralick_bug, &fm1, &levels, &divisor, &return_entries)) return NULL;
+    // cmats is None for the sparse representation
+    PyArrayObject* cmats = (cmats_obj == Py_None ? 0 : reinterpret_cast<PyArrayObject*>(cmats_obj));
+    if (!PyArray_Check(array) || !PyArray_Check(deltas) || (cmats && !PyArray_Check(cmats)) || !PyArray_Check(feats) ||
+        PyArray_NDIM(array) != 3 ||
+        PyArray_TYPE(deltas) != numpy::index_type_number || !PyArray_ISCARRAY(deltas) ||
+        PyArray_NDIM(deltas) != 2 || PyArray_DIM(deltas, 1) != 3 ||
+        (cmats && (
+            PyArray_TYPE(cmats) != NPY_INT32 || !PyArray_ISCARRAY(cmats) ||
+            PyArray_NDIM(cmats) != 3 || PyArray_DIM(cmats, 0) != PyArray_DIM(deltas, 0) ||
+            PyArray_DIM(cmats, 1) != fm1 || PyArray_DIM(cmats, 2) != fm1)) ||
+        PyArray_TYPE(feats) != NPY_DOUBLE || !PyArray_ISCARRAY(feats) ||
+        PyArray_NDIM(feats) != 2 || PyArray_DIM(feats, 0) != PyArray_DIM(deltas, 0) ||
+        PyArray_DIM(feats, 1) < 13 ||
+        !divisor) {
+        PyErr_SetString(PyExc_RuntimeError, TypeErrorMsg);
         return NULL;
     }
-    for (int i = 0; i != N; ++i) {
-        for (int j = 0; j != N; ++j) {
-            px_plus_y.at(i+j) += p.at(i,j);
-            px_minus_y.at(std::abs(i-j)) += p.at(i,j);
+    const npy_intp nr_dirs = PyArray_DIM(deltas, 0);
+    const npy_intp nr_feats = PyArray_DIM(feats, 1);
+    const npy_intp* deltas_data = static_cast<const npy_intp*>(PyArray_DATA(deltas));
+    double* feats_data = static_cast<double*>(PyArray_DATA(feats));
+    if (cmats) {
+        npy_int32* cmats_data = static_cast<npy_int32*>(PyArray_DATA(cmats));
+#define HANDLE(type) \
+        haralick<type>(numpy::aligned_array<type>(array), deltas_data, nr_dirs, cmats_data, fm1, feats_data, nr_feats, ignore_zeros, preserve_haralick_bug, levels, divisor);
+        SAFE_SWITCH_ON_INTEGER_TYPES_OF(array, true)
+#undef HANDLE
+        Py_RETURN_NONE;
+    }
+
+    std::vector<std::vector<cooc_entry> > entries(nr_dirs);
+    try {
+#define HANDLE(type) \
+        haralick_sparse<type>(numpy::aligned_array<type>(array), deltas_data, nr_dirs, entries, fm1, feats_data, nr_feats, ignore_zeros, preserve_haralick_bug, levels, divisor);
+        SAFE_SWITCH_ON_INTEGER_TYPES_OF(array, true)
+#undef HANDLE
+    } catch (const std::bad_alloc&) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+    if (!return_entries) Py_RETURN_NONE;
+
+    // Returns a list with one (nr_entries x 3) array of (i, j, count) per
+    // direction (only the entries with i <= j)
+    PyObject* res = PyList_New(nr_dirs);
+    if (!res) return NULL;
+    for (npy_intp d = 0; d != nr_dirs; ++d) {
+        npy_intp dims[2];
+        dims[0] = entries[d].size();
+        dims[1] = 3;
+        PyObject* arr = PyArray_SimpleNew(2, dims, NPY_INTP);
+        if (!arr) {
+            Py_DECREF(res);
+            return NULL;
+        }
+        npy_intp* data = static_cast<npy_intp*>(PyArray_DATA(reinterpret_cast<PyArrayObject*>(arr)));
+        for (unsigned e = 0; e != entries[d].size(); ++e) {
+            *data++ = entries[d][e].i;
+            *data++ = entries[d][e].j;
+            *data++ = entries[d][e].count;
+        }
+        PyList_SET_ITEM(res, d, arr);
+    }
+    return res;
+}
+
+
+// Co-occurrence statistics of a window (for a single direction) which can be
+// updated pair by pair: the counts of the (symmetric) co-occurrence matrix,
+// its marginals, and the sums needed for the Haralick features are kept in
+// counts (not probabilities) so that adding & removing pairs is O(1).
+//
+// clogc is a table of c log(c) for all possible counts.
+struct window_cooccurence {
+    window_cooccurence(const npy_intp fm1, const std::vector<double>& clogc)
+        :fm1_(fm1)
+        ,clogc_table_(clogc)
+        ,counts_(fm1*fm1)
+        ,marginal_(fm1)
+        ,plus_(2*fm1)
+        ,minus_(fm1)
+        { clear(); }
+
+    void clear() {
+        std::fill(counts_.begin(), counts_.end(), 0);
+        std::fill(marginal_.begin(), marginal_.end(), 0.);
+        std::fill(plus_.begin(), plus_.end(), 0.);
+        std::fill(minus_.begin(), minus_.end(), 0.);
+        total_ = 0.;
+        sum_sq_ = 0.;
+        sum_ij_ = 0.;
+        idm_ = 0.;
+        clogc_ = 0.;
+        nr_nonzero_ = 0;
+    }
+
+    // Adds (sign = +1) or removes (sign = -1) the pair (i, j), which counts
+    // for both (i, j) and (j, i)
+    void add_pair(const npy_intp i, const npy_intp j, const int sign) {
+        if (i == j) {
+            update(i, i, 2*sign);
+        } else {
+            update(i, j, sign);
+            update(j, i, sign);
+        }
+    }
+
+    void features(const bool preserve_haralick_bug, double* feats) {
+        if (total_ == 0.) {
+            std::fill(feats, feats + 13, 0.);
+            return;
+        }
+        cooc_sums sums;
+        sums.asm_ = sum_sq_/total_/total_;
+        sums.sum_ij = sum_ij_/total_;
+        sums.idm = idm_/total_;
+        // -sum_ij p_ij log(p_ij) with p_ij = c_ij/total (which cannot be
+        // negative, except through rounding). With a single non-zero cell it
+        // is exactly zero (as computed by haralick), not a rounding residue.
+        sums.plogp = (nr_nonzero_ == 1 ? 0. : std::max(0., std::log(total_) - clogc_/total_));
+        const double scale = 1./total_;
+        nonzeros(marginal_, px_, scale);
+        nonzeros(plus_, px_plus_y_, scale);
+        nonzeros(minus_, px_minus_y_, scale);
+        haralick_features(sums, px_, px_, px_plus_y_, px_minus_y_, fm1_, preserve_haralick_bug, feats);
+    }
+
+    private:
+    void update(const npy_intp i, const npy_intp j, const int delta) {
+        npy_int32& c = counts_[i*fm1_ + j];
+        const npy_int32 nc = c + delta;
+        sum_sq_ += double(nc)*nc - double(c)*c;
+        clogc_ += clogc_table_[nc] - clogc_table_[c];
+        nr_nonzero_ += (nc != 0) - (c != 0);
+        c = nc;
+        total_ += delta;
+        sum_ij_ += double(i)*j*delta;
+        idm_ += delta/(1. + double(i - j)*(i - j));
+        marginal_[i] += delta;
+        plus_[i + j] += delta;
+        minus_[std::abs(i - j)] += delta;
+    }
+
+    const npy_intp fm1_;
+    const std::vector<double>& clogc_table_;
+    std::vector<npy_int32> counts_;
+    std::vector<double> marginal_, plus_, minus_;
+    double total_, sum_sq_, sum_ij_, idm_, clogc_;
+    npy_intp nr_nonzero_;
+    marginal px_, px_plus_y_, px_minus_y_;
+};
+
+// Grey levels of rows [r0, r1) of f (-1 marks ignored zeros)
+template<typename T>
+void load_levels(const numpy::aligned_array<T>& f, const npy_intp r0, const npy_intp r1, const bool ignore_zeros, const grey_levels<T>& level, std::vector<npy_intp>& levels) {
+    const npy_intp N1 = f.dim(1);
+    const npy_intp step = f.stride(1);
+    levels.resize((r1 - r0)*N1);
+    std::vector<npy_intp>::iterator out = levels.begin();
+    for (npy_intp r = r0; r != r1; ++r) {
+        const T* row = f.data(r);
+        for (npy_intp c = 0; c != N1; ++c, ++out) {
+            const T v = row[c*step];
+            *out = (ignore_zeros && !v) ? -1 : level(v);
+        }
+    }
+}
+
+// A rectangular window [r0, r1] x [c0, c1] (inclusive bounds)
+struct window {
+    npy_intp r0, r1, c0, c1;
+};
+
+// Adds (sign = +1) or removes (sign = -1) the pairs (in direction (dy, dx))
+// whose first pixel is in column c and which lie inside win.
+// levels holds rows starting at row lr0 and has N1 columns.
+void column_pairs(window_cooccurence& cooc, const std::vector<npy_intp>& levels, const npy_intp lr0, const npy_intp N1, const npy_intp dy, const npy_intp dx, const npy_intp c, const window& win, const int sign) {
+    if (c < win.c0 || c > win.c1 || c + dx < win.c0 || c + dx > win.c1) return;
+    const npy_intp rstart = std::max(win.r0, win.r0 - dy);
+    const npy_intp rend = std::min(win.r1, win.r1 - dy);
+    for (npy_intp r = rstart; r <= rend; ++r) {
+        const npy_intp i = levels[(r - lr0)*N1 + c];
+        const npy_intp j = levels[(r + dy - lr0)*N1 + c + dx];
+        if (i < 0 || j < 0) continue;
+        cooc.add_pair(i, j, sign);
+    }
+}
+
+// Adds (sign = +1) or removes (sign = -1) all pairs which lie inside win and
+// touch column c
+void touching_pairs(window_cooccurence& cooc, const std::vector<npy_intp>& levels, const npy_intp lr0, const npy_intp N1, const npy_intp dy, const npy_intp dx, const npy_intp c, const window& win, const int sign) {
+    column_pairs(cooc, levels, lr0, N1, dy, dx, c, win, sign);
+    if (dx) column_pairs(cooc, levels, lr0, N1, dy, dx, c - dx, win, sign);
+}
+
+// Haralick features of the (2ry + 1) x (2rx + 1) window around each pixel of
+// rows [y0, y1) (windows are clipped at the image border).
+//
+// Along each row, the window slides one column at a time: the pairs which
+// touch the column that leaves the window are removed and those which touch
+// the entering column are added.
+//
+// If `mean`, output has shape (N0, N1, 13) and gets the mean over the
+// directions; otherwise, it has shape (N0, N1, nr_dirs, 13).
+template<typename T>
+void haralick_map(const numpy::aligned_array<T> f, const npy_intp* deltas, const npy_intp nr_dirs, const npy_intp ry, const npy_intp rx, const npy_intp y0, const npy_intp y1, numpy::aligned_array<double> output, const bool mean, const npy_intp fm1, const bool ignore_zeros, const bool preserve_haralick_bug, const npy_intp nr_levels, const unsigned long long divisor) {
+    gil_release nogil;
+    const npy_intp N0 = f.dim(0);
+    const npy_intp N1 = f.dim(1);
+    if (y0 >= y1 || !N1) return;
+
+    const npy_intp lr0 = std::max<npy_intp>(0, y0 - ry);
+    const npy_intp lr1 = std::min<npy_intp>(N0, y1 + ry);
+    std::vector<npy_intp> levels;
+    load_levels(f, lr0, lr1, ignore_zeros, grey_levels<T>(nr_levels, divisor), levels);
+
+    // A window has at most (2ry + 1)(2rx + 1) pairs, each of which counts
+    // twice if it is on the diagonal
+    std::vector<double> clogc(2*(2*ry + 1)*(2*rx + 1) + 1);
+    for (unsigned c = 1; c < clogc.size(); ++c) clogc[c] = c*std::log(double(c));
+    std::vector<window_cooccurence> coocs(nr_dirs, window_cooccurence(fm1, clogc));
+    for (npy_intp y = y0; y != y1; ++y) {
+        window win;
+        win.r0 = std::max<npy_intp>(0, y - ry);
+        win.r1 = std::min<npy_intp>(N0 - 1, y + ry);
+        win.c0 = 0;
+        win.c1 = std::min<npy_intp>(N1 - 1, rx);
+        // Start each row from scratch (this also keeps rounding errors from
+        // accumulating)
+        for (npy_intp d = 0; d != nr_dirs; ++d) {
+            coocs[d].clear();
+            for (npy_intp c = win.c0; c <= win.c1; ++c) {
+                column_pairs(coocs[d], levels, lr0, N1, deltas[2*d], deltas[2*d + 1], c, win, +1);
+            }
+        }
+        for (npy_intp x = 0; x != N1; ++x) {
+            if (x) {
+                if (x - rx - 1 >= 0) {
+                    for (npy_intp d = 0; d != nr_dirs; ++d) {
+                        touching_pairs(coocs[d], levels, lr0, N1, deltas[2*d], deltas[2*d + 1], win.c0, win, -1);
+                    }
+                    ++win.c0;
+                }
+                if (x + rx < N1) {
+                    ++win.c1;
+                    for (npy_intp d = 0; d != nr_dirs; ++d) {
+                        touching_pairs(coocs[d], levels, lr0, N1, deltas[2*d], deltas[2*d + 1], win.c1, win, +1);
+                    }
+                }
+            }
+            double* out = output.data(y, x);
+            if (!mean) {
+                for (npy_intp d = 0; d != nr_dirs; ++d) {
+                    coocs[d].features(preserve_haralick_bug, out + 13*d);
+                }
+                continue;
+            }
+            std::fill(out, out + 13, 0.);
+            for (npy_intp d = 0; d != nr_dirs; ++d) {
+                double feats[13];
+                coocs[d].features(preserve_haralick_bug, feats);
+                for (int i = 0; i != 13; ++i) out[i] += feats[i];
+            }
+            for (int i = 0; i != 13; ++i) out[i] /= nr_dirs;
         }
     }
+}
 
+PyObject* py_haralick_map(PyObject* self, PyObject* args) {
+    PyArrayObject* array;
+    PyArrayObject* deltas;
+    PyArrayObject* output;
+    Py_ssize_t ry, rx, y0, y1;
+    int ignore_zeros;
+    int preserve_haralick_bug;
+    Py_ssize_t fm1;
+    Py_ssize_t levels;
+    unsigned long long divisor;
+    if (!PyArg_ParseTuple(args,"OOOnnnniinnK", &array, &deltas, &output, &ry, &rx, &y0, &y1, &ignore_zeros, &preserve_haralick_bug, &fm1, &levels, &divisor)) return NULL;
+    if (!numpy::are_arrays(array, deltas, output) ||
+        PyArray_NDIM(array) != 2 ||
+        PyArray_TYPE(deltas) != numpy::index_type_number || !PyArray_ISCARRAY(deltas) ||
+        PyArray_NDIM(deltas) != 2 || PyArray_DIM(deltas, 1) != 2 ||
+        PyArray_TYPE(output) != NPY_DOUBLE || !PyArray_ISCARRAY(output) ||
+        (PyArray_NDIM(output) != 3 && PyArray_NDIM(output) != 4) ||
+        PyArray_DIM(output, 0) != PyArray_DIM(array, 0) ||
+        PyArray_DIM(output, 1) != PyArray_DIM(array, 1) ||
+        (PyArray_NDIM(output) == 4 && PyArray_DIM(output, 2) != PyArray_DIM(deltas, 0)) ||
+        PyArray_DIM(output, PyArray_NDIM(output) - 1) != 13 ||
+        y0 < 0 || y1 > PyArray_DIM(array, 0) || ry < 0 || rx < 0 ||
+        !divisor) {
+        PyErr_SetString(PyExc_RuntimeError, TypeErrorMsg);
+        return NULL;
+    }
+    const npy_intp* deltas_data = static_cast<const npy_intp*>(PyArray_DATA(deltas));
+    const bool mean = (PyArray_NDIM(output) == 3);
+#define HANDLE(type) \
+    haralick_map<type>(numpy::aligned_array<type>(array), deltas_data, PyArray_DIM(deltas, 0), ry, rx, y0, y1, numpy::aligned_array<double>(output), mean, fm1, ignore_zeros, preserve_haralick_bug, levels, divisor);
+    SAFE_SWITCH_ON_INTEGER_TYPES_OF(array, true)
+#undef HANDLE
     Py_RETURN_NONE;
 }
 
+PyObject* py_labeled_haralick(PyObject* self, PyObject* args) {
+    PyArrayObject* array;
+    PyArrayObject* labeled;
+    PyArrayObject* bboxes;
+    int label0, label1;
+    PyArrayObject* deltas;
+    PyArrayObject* feats;
+    int ignore_zeros;
+    int preserve_haralick_bug;
+    Py_ssize_t max_dense_levels;
+    if (!PyArg_ParseTuple(args,"OOOiiOOiin", &array, &labeled, &bboxes, &label0, &label1, &deltas, &feats, &ignore_zeros, &preserve_haralick_bug, &max_dense_levels)) return NULL;
+    if (!numpy::are_arrays(array, labeled, bboxes) || !numpy::are_arrays(deltas, feats) ||
+        PyArray_NDIM(array) != 3 || !numpy::same_shape(array, labeled) ||
+        PyArray_TYPE(labeled) != NPY_INT ||
+        PyArray_TYPE(bboxes) != numpy::index_type_number || !PyArray_ISCARRAY(bboxes) ||
+        PyArray_NDIM(bboxes) != 2 || PyArray_DIM(bboxes, 1) != 6 ||
+        PyArray_TYPE(deltas) != numpy::index_type_number || !PyArray_ISCARRAY(deltas) ||
+        PyArray_NDIM(deltas) != 2 || PyArray_DIM(deltas, 1) != 3 ||
+        PyArray_TYPE(feats) != NPY_DOUBLE || !PyArray_ISCARRAY(feats) ||
+        PyArray_NDIM(feats) != 3 || PyArray_DIM(feats, 0) != PyArray_DIM(bboxes, 0) ||
+        PyArray_DIM(feats, 1) != PyArray_DIM(deltas, 0) || PyArray_DIM(feats, 2) < 13 ||
+        label0 < 0 || label1 < label0 || label1 > PyArray_DIM(bboxes, 0)) {
+        PyErr_SetString(PyExc_RuntimeError, TypeErrorMsg);
+        return NULL;
+    }
+    const npy_intp* bboxes_data = static_cast<const npy_intp*>(PyArray_DATA(bboxes));
+    const npy_intp* deltas_data = static_cast<const npy_intp*>(PyArray_DATA(deltas));
+    double* feats_data = static_cast<double*>(PyArray_DATA(feats));
+#define HANDLE(type) \
+    labeled_haralick<type>(numpy::aligned_array<type>(array), numpy::aligned_array<int>(labeled), bboxes_data, label0, label1, \
+                deltas_data, PyArray_DIM(deltas, 0), feats_data, PyArray_DIM(feats, 2), ignore_zeros, preserve_haralick_bug, max_dense_levels);
+    SAFE_SWITCH_ON_INTEGER_TYPES_OF(array, true)
+#undef HANDLE
+    Py_RETURN_NONE;
+}
 
 PyMethodDef methods[] = {
   {"cooccurence",(PyCFunction)py_cooccurent, METH_VARARGS, NULL},
-  {"compute_plus_minus",(PyCFunction)py_compute_plus_minus, METH_VARARGS, NULL},
+  {"haralick",(PyCFunction)py_haralick, METH_VARARGS, NULL},
+  {"haralick_map",(PyCFunction)py_haralick_map, METH_VARARGS, NULL},
+  {"labeled_haralick",(PyCFunction)py_labeled_haralick, METH_VARARGS, NULL},
   {NULL, NULL,0,NULL},
 };
 
@@ -1,7 +1,11 @@
+#include <algorithm>
 #include <complex>
 #include <cmath>
 #include <new>
+#include <vector>
 
+#include "../numpypp/array.hpp"
+#include "../numpypp/dispatch.hpp"
 #include "../utils.hpp"
 
 extern "C" {
@@ -15,76 +19,281 @@ const char TypeErrorMsg[] =
     "Type not understood. "
     "This is caused by either a direct call to _zernike (which is dangerous: types are not checked!) or a bug in zernike.py.\n";
 
-double _factorialtable[] = {
-        1, 1, 2, 6, 24, 120, 720, 5040, 40320, 362880, 3628800, 39916800, 479001600
+// Accumulates the sums needed for all Zernike moments (n, l) through degree
+// in a single pass over the points.
+//
+// The radial polynomials are computed with Kintner's recurrence (over n, for
+// each l) and the angular terms by repeated multiplication, so that there are
+// no calls to pow() and no factorials in the inner loop.
+struct zernike_accumulator {
+    zernike_accumulator(const int degree)
+        :degree_(degree)
+        ,total_(0.)
+        ,R_(degree + 1)
+        ,slots_((degree + 1)*(degree + 1))
+        ,kintner_((degree + 1)*(degree + 1)*3)
+        {
+            for (int n = 0; n <= degree; ++n) {
+                for (int l = 0; l <= n; ++l) {
+                    if ((n - l) % 2) continue;
+                    slots_[n*(degree + 1) + l] = orders_.size();
+                    orders_.push_back(n);
+                    if (n < l + 4) continue;
+                    // R[n] = ((K2 r^2 + K3) R[n-2] + K4 R[n-4]) / K1
+                    const double K1 = (n + l)*(n - l)*(n - 2.)/2.;
+                    const double K2 = 2.*n*(n - 1.)*(n - 2.);
+                    const double K3 = -double(l)*l*(n - 1.) - n*(n - 1.)*(n - 2.);
+                    const double K4 = -n*(n + l - 2.)*(n - l - 2.)/2.;
+                    double* k = &kintner_[(n*(degree + 1) + l)*3];
+                    k[0] = K2/K1;
+                    k[1] = K3/K1;
+                    k[2] = K4/K1;
+                }
+            }
+            sums_.resize(orders_.size());
+        }
+
+    void clear() {
+        total_ = 0.;
+        std::fill(sums_.begin(), sums_.end(), std::complex<double>(0.));
+    }
+
+    // (xn, yn) are the coordinates (relative to the centre & normalised by the
+    // radius) of a point with weight p. Points outside the unit disk are
+    // ignored.
+    void add(const double xn, const double yn, const double p) {
+        if (!(xn*xn + yn*yn <= 1.)) return;
+        total_ += p;
+        visit<true>(xn, yn, p, &sums_[0]);
+    }
+
+    // Writes the conjugates of all Zernike polynomials at (xn, yn) to out (in
+    // (n, l) order). Outside the unit disk, they are taken to be zero.
+    void basis(const double xn, const double yn, std::complex<double>* out) {
+        if (!(xn*xn + yn*yn <= 1.)) {
+            std::fill(out, out + sums_.size(), std::complex<double>(0.));
+            return;
+        }
+        visit<false>(xn, yn, 1., out);
+    }
+
+    double total() const { return total_; }
+    unsigned size() const { return sums_.size(); }
+    const std::complex<double>* sums() const { return &sums_[0]; }
+
+    // Writes the absolute value of the moments in (n, l) order
+    void moments(double* out) const {
+        const double pi = std::atan(1.0)*4;
+        for (unsigned i = 0; i != sums_.size(); ++i) {
+            out[i] = (total_ ? std::abs(sums_[i])*(orders_[i] + 1)/pi/total_ : 0.);
+        }
+    }
+
+    private:
+    // Computes p * conj(V_nl(xn, yn)) for all moments & adds it to (or
+    // stores it in) out
+    template <bool Accumulate>
+    void visit(const double xn, const double yn, const double p, std::complex<double>* out) {
+        using std::complex;
+        const double r2 = xn*xn + yn*yn;
+        const double r = std::sqrt(r2);
+        // conj(exp(i theta)); at the centre, only the l = 0 terms are nonzero
+        const complex<double> a = (r > 0. ? complex<double>(xn/r, -yn/r) : complex<double>(0.));
+        complex<double> pal = p;
+        double rl = 1.;
+        for (int l = 0; l <= degree_; ++l) {
+            R_[l] = rl;
+            if (l + 2 <= degree_) R_[l+2] = (l + 2)*rl*r2 - (l + 1)*rl;
+            for (int n = l + 4; n <= degree_; n += 2) {
+                const double* k = &kintner_[(n*(degree_ + 1) + l)*3];
+                R_[n] = (k[0]*r2 + k[1])*R_[n-2] + k[2]*R_[n-4];
+            }
+            for (int n = l; n <= degree_; n += 2) {
+                complex<double>& target = out[slots_[n*(degree_ + 1) + l]];
+                if (Accumulate) target += R_[n]*pal;
+                else target = R_[n]*pal;
+            }
+            pal *= a;
+            rl *= r;
+        }
+    }
+
+    int degree_;
+    double total_;
+    std::vector<double> R_;
+    // slots_[n*(degree + 1) + l] is the index of moment (n, l)
+    std::vector<unsigned> slots_;
+    std::vector<int> orders_;
+    std::vector<double> kintner_;
+    std::vector<std::complex<double> > sums_;
 };
 
-inline
-double fact(int n) {
-    if (unsigned(n) < sizeof(_factorialtable)/sizeof(double)) return _factorialtable[n];
-    return double(n) * fact(n - 1);
+// Sums (see zernike_accumulator) of the pixels in rows [y0, y1) of f, around
+// (cy, cx). Only pixels with positive values are used. Returns the total
+// weight of the pixels used.
+template<typename T>
+double zernike_sums(const numpy::aligned_array<T> f, const double cy, const double cx, const double radius, const int degree, const npy_intp y0, const npy_intp y1, numpy::aligned_array<std::complex<double> > sums) {
+    gil_release nogil;
+    zernike_accumulator acc(degree);
+    if (npy_intp(acc.size()) != sums.dim(0)) {
+        throw PythonException(PyExc_RuntimeError, TypeErrorMsg);
+    }
+    const npy_intp N1 = f.dim(1);
+    const npy_intp step = f.stride(1);
+    for (npy_intp y = y0; y != y1; ++y) {
+        const T* row = f.data(y);
+        const double yn = (y - cy)/radius;
+        for (npy_intp x = 0; x != N1; ++x, row += step) {
+            const T v = *row;
+            if (!(v > 0)) continue;
+            acc.add((x - cx)/radius, yn, double(v));
+        }
+    }
+    std::copy(acc.sums(), acc.sums() + acc.size(), sums.data());
+    return acc.total();
 }
 
-PyObject* py_znl(PyObject* self, PyObject* args) {
-    using std::pow;
-    using std::atan;
-    using std::atan2;
-    using std::polar;
-    using std::conj;
-    using std::complex;
-
-    const double pi = atan(1.0)*4;
-
-    PyArrayObject* Da;
-    PyArrayObject* Aa;
-    PyArrayObject* Pa;
-    int n;
-    int l;
-    if (!PyArg_ParseTuple(args,"OOOii", &Da, &Aa, &Pa, &n, &l)) return NULL;
-    if (!PyArray_Check(Da) || !PyArray_Check(Aa) || !PyArray_Check(Pa) ||
-        PyArray_TYPE(Da) != NPY_DOUBLE || PyArray_TYPE(Aa) != NPY_CDOUBLE || PyArray_TYPE(Pa) != NPY_DOUBLE) {
-        PyErr_SetString(PyExc_RuntimeError, TypeErrorMsg);
-        return NULL;
+// Zernike basis (see zernike_accumulator::basis) for all pixels of an image
+// of size N0 x N1, around (cy, cx). basis is a C-contiguous
+// (nr_moments x N0*N1) array.
+void zernike_basis(const double cy, const double cx, const double radius, const int degree, const npy_intp N0, const npy_intp N1, std::complex<double>* basis) {
+    gil_release nogil;
+    zernike_accumulator acc(degree);
+    const npy_intp nr_moments = acc.size();
+    const npy_intp npixels = N0*N1;
+    std::vector<std::complex<double> > values(nr_moments);
+    for (npy_intp y = 0; y != N0; ++y) {
+        for (npy_intp x = 0; x != N1; ++x) {
+            acc.basis((x - cx)/radius, (y - cy)/radius, &values[0]);
+            for (npy_intp i = 0; i != nr_moments; ++i) {
+                basis[i*npixels + y*N1 + x] = values[i];
+            }
+        }
     }
-    holdref Da_hr(Da);
-    holdref Aa_hr(Aa);
-    holdref Pa_hr(Pa);
-
-    double* D = static_cast<double*>(PyArray_DATA(Da));
-    complex<double>* A = static_cast<complex<double>*>(PyArray_DATA(Aa));
-    double* P = static_cast<double*>(PyArray_DATA(Pa));
-    const int Nelems = PyArray_SIZE(Da);
-    complex<double> v = 0.;
-    try {
-        gil_release nogil;
-        complex<double> Vnl = 0.0;
-        double * g_m = new double[ int( (n-l)/2 ) + 1];
-        for(int m = 0; m <= (n-l)/2; m++) {
-            double f = (m & 1) ? -1 : 1;
-            g_m[m] = f * fact(n-m) /
-                   ( fact(m) * fact((n - 2*m + l) / 2) * fact((n - 2*m - l) / 2) );
+}
+
+// Zernike moments (through degree) of objects label0 .. label1-1, computed as
+// zernike_moments() would compute them for the bounding box of each object
+// (with the pixels of other objects set to zero), around the object's centre
+// of mass. output is a C-contiguous (nr_labels x nr_moments) array.
+template<typename T>
+void labeled_zernike(const numpy::aligned_array<T> f, const numpy::aligned_array<int> labeled, const npy_intp* bboxes, const int label0, const int label1, const double radius, const int degree, double* output, const npy_intp nr_moments) {
+    gil_release nogil;
+    zernike_accumulator acc(degree);
+    if (npy_intp(acc.size()) != nr_moments) {
+        throw PythonException(PyExc_RuntimeError, TypeErrorMsg);
+    }
+    for (int label = label0; label != label1; ++label) {
+        const npy_intp* bbox = bboxes + 4*label;
+        if (bbox[1] == bbox[0]) continue;
+        double total = 0., cy = 0., cx = 0.;
+        for (npy_intp y = bbox[0]; y != bbox[1]; ++y) {
+            for (npy_intp x = bbox[2]; x != bbox[3]; ++x) {
+                if (labeled.at(y, x) != label) continue;
+                const double v = f.at(y, x);
+                total += v;
+                cy += v*y;
+                cx += v*x;
+            }
         }
+        if (total == 0.) continue;
+        cy /= total;
+        cx /= total;
 
-        for (int i = 0; i != Nelems; ++i) {
-            double d=D[i];
-            complex<double> a=A[i];
-            double p=P[i];
-            Vnl = 0.;
-            for(int m = 0; m <= (n-l)/2; m++) {
-                Vnl += g_m[m] * pow(d, double(n - 2*m)) * a;
+        acc.clear();
+        for (npy_intp y = bbox[0]; y != bbox[1]; ++y) {
+            for (npy_intp x = bbox[2]; x != bbox[3]; ++x) {
+                if (labeled.at(y, x) != label) continue;
+                const T v = f.at(y, x);
+                if (!(v > 0)) continue;
+                acc.add((x - cx)/radius, (y - cy)/radius, double(v));
             }
-            v += p * conj(Vnl);
         }
-        v *= (n+1)/pi;
-        delete [] g_m;
+        acc.moments(output + label*nr_moments);
+    }
+}
+
+PyObject* py_zernike_sums(PyObject* self, PyObject* args) {
+    PyArrayObject* array;
+    double cy, cx, radius;
+    int degree;
+    npy_intp y0, y1;
+    PyArrayObject* sums;
+    if (!PyArg_ParseTuple(args,"OdddinnO", &array, &cy, &cx, &radius, &degree, &y0, &y1, &sums)) return NULL;
+    if (!numpy::are_arrays(array, sums) ||
+        PyArray_NDIM(array) != 2 ||
+        PyArray_TYPE(sums) != NPY_CDOUBLE || !PyArray_ISCARRAY(sums) || PyArray_NDIM(sums) != 1 ||
+        y0 < 0 || y1 < y0 || y1 > PyArray_DIM(array, 0) || degree < 0) {
+        PyErr_SetString(PyExc_RuntimeError, TypeErrorMsg);
+        return NULL;
+    }
+    double total = 0.;
+#define HANDLE(type) \
+    total = zernike_sums<type>(numpy::aligned_array<type>(array), cy, cx, radius, degree, y0, y1, numpy::aligned_array<std::complex<double> >(sums));
+    SAFE_SWITCH_ON_TYPES_OF(array, true)
+#undef HANDLE
+    return PyFloat_FromDouble(total);
+}
+
+PyObject* py_zernike_basis(PyObject* self, PyObject* args) {
+    double cy, cx, radius;
+    int degree;
+    npy_intp N0, N1;
+    PyArrayObject* basis;
+    if (!PyArg_ParseTuple(args,"dddinnO", &cy, &cx, &radius, &degree, &N0, &N1, &basis)) return NULL;
+    if (!PyArray_Check(basis) ||
+        PyArray_TYPE(basis) != NPY_CDOUBLE || !PyArray_ISCARRAY(basis) || PyArray_NDIM(basis) != 2 ||
+        degree < 0 || N0 < 0 || N1 < 0 || PyArray_DIM(basis, 1) != N0*N1) {
+        PyErr_SetString(PyExc_RuntimeError, TypeErrorMsg);
+        return NULL;
+    }
+    try {
+        if (PyArray_DIM(basis, 0) != npy_intp(zernike_accumulator(degree).size())) {
+            PyErr_SetString(PyExc_RuntimeError, TypeErrorMsg);
+            return NULL;
+        }
+        zernike_basis(cy, cx, radius, degree, N0, N1, static_cast<std::complex<double>*>(PyArray_DATA(basis)));
     } catch (const std::bad_alloc&) {
         PyErr_NoMemory();
         return NULL;
     }
-    return PyComplex_FromDoubles(v.real(), v.imag());
+    Py_RETURN_NONE;
 }
+
+PyObject* py_labeled_zernike(PyObject* self, PyObject* args) {
+    PyArrayObject* array;
+    PyArrayObject* labeled;
+    PyArrayObject* bboxes;
+    int label0, label1;
+    double radius;
+    int degree;
+    PyArrayObject* output;
+    if (!PyArg_ParseTuple(args,"OOOiidiO", &array, &labeled, &bboxes, &label0, &label1, &radius, &degree, &output)) return NULL;
+    if (!numpy::are_arrays(array, labeled, bboxes) || !numpy::are_arrays(output) ||
+        PyArray_NDIM(array) != 2 || !numpy::same_shape(array, labeled) ||
+        PyArray_TYPE(labeled) != NPY_INT ||
+        PyArray_TYPE(bboxes) != numpy::index_type_number || !PyArray_ISCARRAY(bboxes) ||
+        PyArray_NDIM(bboxes) != 2 || PyArray_DIM(bboxes, 1) != 4 ||
+        PyArray_TYPE(output) != NPY_DOUBLE || !PyArray_ISCARRAY(output) ||
+        PyArray_NDIM(output) != 2 || PyArray_DIM(output, 0) != PyArray_DIM(bboxes, 0) ||
+        label0 < 0 || label1 < label0 || label1 > PyArray_DIM(bboxes, 0) || degree < 0) {
+        PyErr_SetString(PyExc_RuntimeError, TypeErrorMsg);
+        return NULL;
+    }
+    const npy_intp* bboxes_data = static_cast<const npy_intp*>(PyArray_DATA(bboxes));
+    double* output_data = static_cast<double*>(PyArray_DATA(output));
+#define HANDLE(type) \
+    labeled_zernike<type>(numpy::aligned_array<type>(array), numpy::aligned_array<int>(labeled), bboxes_data, label0, label1, \
+                radius, degree, output_data, PyArray_DIM(output, 1));
+    SAFE_SWITCH_ON_TYPES_OF(array, true)
+#undef HANDLE
+    Py_RETURN_NONE;
+}
+
 PyMethodDef methods[] = {
-  {"znl",(PyCFunction)py_znl, METH_VARARGS, NULL},
+  {"zernike_sums",(PyCFunction)py_zernike_sums, METH_VARARGS, NULL},
+  {"zernike_basis",(PyCFunction)py_zernike_basis, METH_VARARGS, NULL},
+  {"labeled_zernike",(PyCFunction)py_labeled_zernike, METH_VARARGS, NULL},
   {NULL, NULL,0,NULL},
 };
 
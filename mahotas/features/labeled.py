@@ -0,0 +1,129 @@
+# -*- coding: utf-8 -*-
+# Copyright (C) 2012, Luis Pedro Coelho <luis@luispedro.org>
+# vim: set ts=4 sts=4 sw=4 expandtab smartindent:
+#
+# License: MIT (see COPYING file)
+
+from __future__ import division
+import numpy as np
+from . import _texture
+from . import _zernike
+from . import _tas
+from .texture import _2d_deltas, _max_dense_levels
+from .zernike import _nr_moments
+from .lbp import labeled_lbp
+from ..bbox import labeled_bbox
+from ..internal import _verify_is_integer_type, _get_nr_threads, _run_threads
+
+__all__ = [
+    'labeled_features',
+    ]
+
+def labeled_features(image, labeled, haralick=True, lbp=None, zernike=None, pftas=False, nr_threads=None):
+    '''
+    features = labeled_features(image, labeled, haralick=True, lbp=None, zernike=None, pftas=False, nr_threads=None)
+
+    Compute features for every region of a labeled image
+
+    The features of region ``i`` are the same as those computed on its
+    bounding box, with all the pixels which do not belong to the region set to
+    zero, i.e.::
+
+        min0,max0,min1,max1 = mahotas.bbox(labeled == i)
+        crop = image[min0:max0, min1:max1] * (labeled[min0:max0, min1:max1] == i)
+
+    but all regions are processed at once (in C++, with the regions split
+    between ``nr_threads`` threads), which is much faster than looping over
+    the regions in Python when there are many small regions.
+
+    The exception are LBP features, whose histogram only counts the pixels of
+    the region (not the whole bounding box, see ``labeled_lbp``).
+
+    Parameters
+    ----------
+    image : ndarray
+        input image (2-D)
+    labeled : ndarray of integers
+        labeled image (of the same shape as ``image``)
+    haralick : bool, optional
+        whether to compute Haralick features (averaged over the four
+        directions, see ``haralick``). Requires an integer image. default: True
+    lbp : (radius, points), optional
+        If given, compute local binary patterns with these arguments (see
+        ``labeled_lbp``, which is called with ``isolate=True``)
+    zernike : (radius, degree), optional
+        If given, compute Zernike moments with these arguments (see
+        ``zernike_moments``). The moments are computed around the centre of
+        mass of each region.
+    pftas : bool, optional
+        whether to compute parameter free TAS features (see ``pftas``).
+        Requires an unsigned integer image. default: False
+    nr_threads : int, optional
+        Number of threads (default: one per CPU, but small images are
+        processed in a single thread)
+
+    Returns
+    -------
+    features : ndarray of np.double
+        A ``(labeled.max() + 1) x nr_features`` array, where ``features[i]`` are
+        the features of region ``i``. The features are concatenated in the
+        order of the arguments above. ``features[0]`` (the background) is
+        always zero.
+    '''
+    image = np.asanyarray(image)
+    labeled = np.asanyarray(labeled)
+    if image.ndim != 2:
+        raise ValueError('mahotas.labeled_features: Only 2-D images are supported')
+    if image.shape != labeled.shape:
+        raise ValueError('mahotas.labeled_features: `image` is not the same size as `labeled`')
+    _verify_is_integer_type(labeled, 'labeled_features')
+    if labeled.dtype != np.intc:
+        labeled = labeled.astype(np.intc)
+    bboxes = labeled_bbox(labeled)
+    nr_labels = len(bboxes)
+
+    features = []
+    kernels = []
+    if haralick:
+        _verify_is_integer_type(image, 'labeled_features')
+        if image.dtype.kind == 'i' and image.size and image.min() < 0:
+            raise ValueError('mahotas.labeled_features: Image has negative values.')
+        deltas = np.array([(0,) + d for d in _2d_deltas], np.intp)
+        hfeatures = np.zeros((nr_labels, len(deltas), 13))
+        # _texture works on 3-D images
+        bboxes3d = np.ascontiguousarray(np.hstack([np.tile([0,1], (nr_labels,1)), bboxes]), np.intp)
+        kernels.append(lambda l0, l1:
+            _texture.labeled_haralick(image[np.newaxis], labeled[np.newaxis], bboxes3d, l0, l1, deltas, hfeatures, False, False, _max_dense_levels))
+        features.append(hfeatures)
+    if lbp is not None:
+        lbp_radius, lbp_points = lbp
+        # A single pass over the whole image (not split by region)
+        features.append(labeled_lbp(image, labeled, lbp_radius, lbp_points, isolate=True))
+    if zernike is not None:
+        radius, degree = zernike
+        nr_moments = _nr_moments(degree)
+        zfeatures = np.zeros((nr_labels, nr_moments))
+        kernels.append(lambda l0, l1:
+            _zernike.labeled_zernike(image, labeled, bboxes, l0, l1, float(radius), int(degree), zfeatures))
+        features.append(zfeatures)
+    if pftas:
+        if image.dtype not in (np.uint8, np.uint16, np.uint32, np.uint64):
+            raise TypeError('mahotas.labeled_features: pftas requires an unsigned integer image')
+        tfeatures = np.zeros((nr_labels, 54))
+        kernels.append(lambda l0, l1:
+            _tas.labeled_pftas(image, labeled, bboxes, l0, l1, tfeatures))
+        features.append(tfeatures)
+
+    nr_threads = max(1, min(_get_nr_threads(nr_threads, image.size), nr_labels - 1))
+    def compute(l0, l1):
+        for kernel in kernels:
+            kernel(l0, l1)
+    # Label 0 (the background) is skipped
+    bounds = [1 + ((nr_labels - 1)*t)//nr_threads for t in xrange(nr_threads + 1)]
+    _run_threads(compute, [(bounds[t], bounds[t+1]) for t in xrange(nr_threads)])
+
+    if haralick:
+        features[0] = hfeatures.mean(1)
+    if not features:
+        return np.zeros((nr_labels, 0))
+    return np.hstack(features)
@@ -5,27 +5,122 @@
 # License: MIT (see COPYING file)
 
 import numpy as np
-from ..histogram import fullhistogram
+from ..internal import _verify_is_integer_type
 
 __all__ = [
+    'labeled_lbp',
     'lbp',
+    'lbp_transform',
     ]
-def lbp(image, radius, points, ignore_zeros=False):
+
+def _sample_offsets(radius, points, ndim):
+    '''
+    offsets = _sample_offsets(radius, points, ndim)
+
+    Offsets (relative to the centre pixel) of the points sampled by LBP.
+
+    In 2-D, the points are equally spaced on a circle. In 3-D, they are spread
+    over a sphere (along a golden-angle spiral).
+    '''
+    if ndim == 2:
+        angles = np.linspace(0, 2*np.pi, points+1)[:-1]
+        offsets = -radius * np.array([np.sin(angles), np.cos(angles)]).T
+    elif ndim == 3:
+        i = np.arange(points) + .5
+        z = 1. - 2.*i/points
+        r = np.sqrt(1. - z**2)
+        angles = np.pi * (3. - np.sqrt(5.)) * i
+        offsets = -radius * np.array([z, r*np.sin(angles), r*np.cos(angles)]).T
+    else:
+        raise ValueError('mahotas.features.lbp: Only 2-D and 3-D images are supported')
+    # Avoid sampling a neighbouring pixel with a negligible weight because of
+    # rounding errors (e.g., sin(pi) != 0)
+    rounded = np.round(offsets)
+    close = np.abs(offsets - rounded) < 1e-9
+    offsets[close] = rounded[close]
+    return np.ascontiguousarray(offsets, dtype=np.float64)
+
+def _prepare(image, radius, points):
+    if not (0 < points <= 32):
+        raise ValueError('mahotas.features.lbp: points must be between 1 and 32')
+    image = np.ascontiguousarray(image)
+    if image.dtype == np.bool_:
+        image = image.astype(np.uint8)
+    return image, _sample_offsets(radius, points, image.ndim)
+
+def _lbp_codes(image, radius, points, ignore_zeros):
+    from mahotas.features import _lbp
+    image, offsets = _prepare(image, radius, points)
+    codes = np.zeros(image.shape, np.uint32)
+    _lbp.lbp_codes(image, offsets, codes, bool(ignore_zeros), None, None, None, False)
+    return codes
+
+_mapping_tables = {}
+
+def _mapping(points, mode):
+    '''
+    table, nr_bins = _mapping(points, mode)
+
+    Lookup table from raw LBP codes to histogram bins. Tables are computed
+    once per (points, mode) and cached.
+
+    In 'ri' (rotation invariant) mode, each code is mapped to the index of
+    its minimal rotation among all such minimal rotations (in increasing
+    order). In 'riu2' (rotation invariant uniform) mode, codes with at most two
+    0/1 transitions (circularly) are mapped to their number of 1s, all others
+    to ``points + 1``.
+    '''
+    from mahotas.features import _lbp
+    key = (points, mode)
+    if key not in _mapping_tables:
+        codes = np.arange(2**points, dtype=np.uint32)
+        if mode == 'ri':
+            pivots = _lbp.map(codes.copy(), points)
+            _, table = np.unique(pivots, return_inverse=True)
+            nr_bins = table.max() + 1
+        elif mode == 'riu2':
+            bits = (codes[:,np.newaxis] >> np.arange(points, dtype=np.uint32)) & 1
+            transitions = (bits != np.roll(bits, 1, axis=1)).sum(1)
+            table = np.where(transitions <= 2, bits.sum(1), points + 1)
+            nr_bins = points + 2
+        else:
+            raise ValueError("mahotas.features.lbp: mode must be one of 'ri' or 'riu2' (got %s)" % mode)
+        table = table.astype(np.intp)
+        table.setflags(write=False)
+        _mapping_tables[key] = table, nr_bins
+    return _mapping_tables[key]
+
+def lbp(image, radius, points, ignore_zeros=False, mode='ri'):
     '''
-    features = lbp(image, radius, points, ignore_zeros=False)
+    features = lbp(image, radius, points, ignore_zeros=False, mode='ri')
 
     Compute Linear Binary Patterns
 
+    The value of each sample point is obtained by bilinear interpolation
+    (pixels outside the image are taken to be zero). The codes are computed in
+    C++ in a single pass over the image.
+
     Parameters
     ----------
     image : ndarray
-        input image (2-D numpy ndarray)
-    radius : number (integer or floating point)
-        radius (in pixels)
-    points : integer
-        nr of points to consider
+        input image (2-D or 3-D numpy ndarray). For 3-D images, the points are
+        spread over a sphere (and rotation invariance is only approximate).
+    radius : number (integer or floating point) or sequence of numbers
+        radius (in pixels). If a sequence, the histograms for each radius are
+        concatenated.
+    points : integer or sequence of integers
+        nr of points to consider. If a sequence, it must be of the same length
+        as ``radius``. The mapping from codes to histogram bins is a lookup
+        table of ``2**points`` entries, which is computed once and cached.
     ignore_zeros : boolean, optional
         whether to ignore zeros (default: False)
+    mode : {'ri', 'riu2'}, optional
+        'ri' (default)
+            rotation invariant patterns
+        'riu2'
+            rotation invariant uniform patterns: ``points + 2`` bins (one for
+            each number of 1s in uniform patterns & one for all non-uniform
+            patterns)
 
     Returns
     -------
@@ -39,34 +134,112 @@ def lbp(image, radius, points, ignore_zeros=False):
         Ojala, T. Pietikainen, M. Maenpaa, T. LECTURE NOTES IN COMPUTER SCIENCE (Springer)
         2000, ISSU 1842, pages 404-420
     '''
-    from ..interpolate import shift
-    from mahotas.features import _lbp
+    image = np.asanyarray(image)
+    if np.ndim(radius) != 0:
+        radii = list(radius)
+        if np.ndim(points) == 0:
+            points = [points] * len(radii)
+        if len(points) != len(radii):
+            raise ValueError('mahotas.features.lbp: radius and points must have the same length')
+        return np.concatenate([lbp(image, r, p, ignore_zeros, mode) for r,p in zip(radii, points)])
+    codes = _lbp_codes(image, radius, points, ignore_zeros)
+    table, nr_bins = _mapping(points, mode)
     if ignore_zeros:
-        Y,X = np.nonzero(image)
-        def select(im):
-            return im[Y,X].ravel()
-        pixels = image[Y,X].ravel()
-    else:
-        select = np.ravel
-        pixels = image.ravel()
-    image = image.astype(np.float64)
-    angles = np.linspace(0, 2*np.pi, points+1)[:-1]
-    data = []
-    for dy,dx in zip(np.sin(angles), np.cos(angles)):
-        data.append(
-            select(shift(image, [radius*dy,radius*dx], order=1)))
-    data = np.array(data)
-    codes = (data > pixels).astype(np.int32)
-    codes *= (2**np.arange(points)[:,np.newaxis])
-    codes = codes.sum(0)
-    codes = _lbp.map(codes.astype(np.uint32), points)
-    final = fullhistogram(codes.astype(np.uint32))
-
-    codes = np.arange(2**points, dtype=np.uint32)
-    iters = codes.copy()
-    codes = _lbp.map(codes.astype(np.uint32), points)
-    pivots = (codes == iters)
-    npivots = np.sum(pivots)
-    compressed = final[pivots[:len(final)]]
-    compressed = np.concatenate((compressed, [0]*(npivots - len(compressed))))
-    return compressed
+        codes = codes[image != 0]
+    return np.bincount(table[codes.ravel()], minlength=nr_bins).astype(np.float64)
+
+def lbp_transform(image, radius, points, ignore_zeros=False, mode=None):
+    '''
+    codes = lbp_transform(image, radius, points, ignore_zeros=False, mode=None)
+
+    Compute the Linear Binary Pattern of every pixel
+
+    Parameters
+    ----------
+    image : ndarray
+        input image (2-D or 3-D numpy ndarray)
+    radius : number (integer or floating point)
+        radius (in pixels)
+    points : integer
+        nr of points to consider
+    ignore_zeros : boolean, optional
+        whether to ignore zeros (their code is set to 0). default: False
+    mode : {None, 'ri', 'riu2'}, optional
+        If None (default), return the raw codes (bit ``i`` is set if the value
+        at point ``i`` is larger than the centre pixel). Otherwise, return the
+        index of the histogram bin of each code (as in ``lbp``)
+
+    Returns
+    -------
+    codes : ndarray
+        Code image of the same shape as ``image`` (of type ``np.uint32`` if
+        ``mode`` is None, ``np.intp`` otherwise)
+
+    See Also
+    --------
+    lbp : function
+        histogram of the codes
+    '''
+    image = np.asanyarray(image)
+    codes = _lbp_codes(image, radius, points, ignore_zeros)
+    if mode is None:
+        return codes
+    table, _ = _mapping(points, mode)
+    return table[codes]
+
+def labeled_lbp(image, labeled, radius, points, ignore_zeros=False, mode='ri', isolate=False, return_codes=False):
+    '''
+    histograms = labeled_lbp(image, labeled, radius, points, ignore_zeros=False, mode='ri', isolate=False, return_codes=False)
+    histograms, codes = labeled_lbp(image, labeled, radius, points, ignore_zeros=False, mode='ri', isolate=False, return_codes=True)
+
+    Compute the LBP histogram of each region of a labeled image
+
+    All histograms (and, optionally, the code image) are computed in a single
+    pass over the image.
+
+    Parameters
+    ----------
+    image : ndarray
+        input image (2-D or 3-D numpy ndarray)
+    labeled : ndarray of integers
+        labeled image (of the same shape as ``image``)
+    radius : number (integer or floating point)
+        radius (in pixels)
+    points : integer
+        nr of points to consider
+    ignore_zeros : boolean, optional
+        whether to ignore zeros (default: False)
+    mode : {'ri', 'riu2'}, optional
+        histogram bins (see ``lbp``)
+    isolate : boolean, optional
+        If true, the pixels of other regions (including the background) are
+        taken to be zero when computing the codes of a region (default: False)
+    return_codes : boolean, optional
+        whether to also return the code image (see ``lbp_transform``)
+
+    Returns
+    -------
+    histograms : ndarray
+        ``(labeled.max() + 1) x nr_bins`` array, where ``histograms[i]`` is the
+        histogram of region ``i`` (``histograms[0]`` is always zero)
+    codes : ndarray of np.uint32, optional
+        raw code image (only if ``return_codes``). If ``isolate``, the code of
+        each pixel is computed with the pixels of other regions set to zero.
+    '''
+    from mahotas.features import _lbp
+    image = np.asanyarray(image)
+    labeled = np.asanyarray(labeled)
+    if image.shape != labeled.shape:
+        raise ValueError('mahotas.features.labeled_lbp: `image` is not the same size as `labeled`')
+    _verify_is_integer_type(labeled, 'labeled_lbp')
+    labeled = np.ascontiguousarray(labeled, dtype=np.intc)
+    image, offsets = _prepare(image, radius, points)
+    table, nr_bins = _mapping(points, mode)
+    nr_labels = (labeled.max() + 1 if labeled.size else 1)
+    histograms = np.zeros((nr_labels, nr_bins), np.intp)
+    codes = (np.zeros(image.shape, np.uint32) if return_codes else None)
+    _lbp.lbp_codes(image, offsets, codes, bool(ignore_zeros), labeled, table, histograms, bool(isolate))
+    histograms = histograms.astype(np.float64)
+    if return_codes:
+        return histograms, codes
+    return histograms
@@ -6,9 +6,10 @@
 from __future__ import division
 import numpy as np
 from . import _surf
-from ..internal import _verify_is_integer_type
+from ..internal import _verify_is_integer_type, _get_nr_threads, _run_threads
+from ..integral import integral as _integral_image, _supported_dtypes as _integral_dtypes
 
-__all__ = ['integral', 'surf']
+__all__ = ['integral', 'surf', 'match']
 
 def integral(f, in_place=False, dtype=np.double):
     '''
@@ -29,19 +30,153 @@ def integral(f, in_place=False, dtype=np.double):
     -------
     fi : ndarray of `dtype` of same shape as `f`
         The integral image
+
+    See Also
+    --------
+    mahotas.integral : function
+        Integral images of 2-D & 3-D images (with more options)
     '''
     if f.ndim != 2:
         raise ValueError('mahotas.surf.integral: Can only handle 2D-images (i.e., greyscale images).')
+    if in_place:
+        dtype = f.dtype
+    dtype = np.dtype(dtype)
+    if any(dtype == d for d in _integral_dtypes):
+        if in_place:
+            return _integral_image(f, dtype, out=f)
+        return _integral_image(f, dtype)
+    # mahotas.integral does not handle other types: these are summed in their
+    # own type (wrapping around on overflow, as always)
     if not in_place:
-        if dtype != f.dtype:
-            f = f.astype(dtype)
-        else:
-            f = f.copy()
-    return _surf.integral(f)
+        f = f.astype(dtype)
+    np.cumsum(f, 0, dtype=dtype, out=f)
+    np.cumsum(f, 1, dtype=dtype, out=f)
+    return f
+
+def _pyramid(fi, nr_octaves, nr_scales, initial_step_size, nr_threads):
+    '''
+    pyramid = _pyramid(fi, nr_octaves, nr_scales, initial_step_size, nr_threads)
+
+    Build the Hessian pyramid of the integral image `fi`, with the rows of
+    each layer split between `nr_threads` threads.
+    '''
+    pyramid = _surf.allocate_pyramid(fi.shape[0], fi.shape[1], nr_octaves, nr_scales, initial_step_size)
+    nr_threads = min(_get_nr_threads(nr_threads, fi.size), max(1, fi.shape[0] // initial_step_size))
+    def fill(part):
+        _surf.fill_pyramid(fi, pyramid, nr_scales, initial_step_size, part, nr_threads)
+    _run_threads(fill, [(t,) for t in range(nr_threads)])
+    return pyramid
+
+def _check_integral(f, is_integral):
+    if not is_integral:
+        return integral(f)
+    if f.dtype != np.double:
+        raise TypeError('mahotas.surf: integral image must be of dtype double')
+    return f
+
+def _threshold(threshold, max_points):
+    if threshold is None:
+        if max_points is None or max_points < 0:
+            raise ValueError('mahotas.surf: max_points must be given if threshold is None')
+        return 0.
+    if threshold < 0:
+        raise ValueError('mahotas.surf: threshold must be non-negative')
+    return float(threshold)
+
+def _tiles(shape, tile_size, nr_octaves, nr_scales, initial_step_size):
+    '''
+    for core, region in _tiles(shape, tile_size, nr_octaves, nr_scales, initial_step_size): ...
 
-def surf(f, nr_octaves=4, nr_scales=6, initial_step_size=1, threshold=0.1, max_points=1024, descriptor_only=False):
+    Split an image of the given shape into tiles for tiled SURF
+
+    The cores ``(y0, y1, x0, x1)`` of the tiles partition the image. Each
+    region is its core extended by a margin which is large enough that the
+    Hessian pyramid (see ``get_border_size`` in _surf.cpp), the non-maximum
+    suppression, and the descriptors of the points in the core are the same
+    as if the whole image had been used. All the tile boundaries are aligned
+    to the non-maximum suppression blocks of the coarsest octave.
     '''
-    points = surf(f, nr_octaves=4, nr_scales=6, initial_step_size=1, threshold=0.1, max_points=1024, descriptor_only=False):
+    align = 3 * initial_step_size * 2**(nr_octaves - 1)
+    margin = 0
+    for o in range(nr_octaves):
+        step = initial_step_size * 2**o
+        border = int(np.ceil(3*(2**(o+1)*(nr_scales+1)+1)/2.))
+        # the 3x3x3 blocks and their neighbourhoods
+        margin = max(margin, (border + 6)*step)
+    # The largest possible scale (see interpolate_point) & the corresponding
+    # descriptor window (see compute_descriptors)
+    max_scale = 1.2/9. * 3*(2**nr_octaves*(nr_scales+1) + 1)
+    margin = max(margin, int(np.ceil(31*max_scale/2.)) + 2)
+    margin = align * int(np.ceil(margin / align))
+    tile_size = align * max(1, int(np.ceil(tile_size / align)))
+    N0,N1 = shape
+    for y0 in range(0, N0, tile_size):
+        y1 = min(N0, y0 + tile_size)
+        for x0 in range(0, N1, tile_size):
+            x1 = min(N1, x0 + tile_size)
+            yield (y0, y1, x0, x1), (max(0, y0 - margin), min(N0, y1 + margin), max(0, x0 - margin), min(N1, x1 + margin))
+
+def _in_core(points, core):
+    y0,y1,x0,x1 = core
+    return (points[:,0] >= y0) & (points[:,0] < y1) & (points[:,1] >= x0) & (points[:,1] < x1)
+
+def _top_points(points, max_points):
+    order = np.argsort(-points[:,3], kind='mergesort')
+    if max_points is not None and max_points >= 0:
+        order = order[:max_points]
+    return points[order]
+
+def _tiled_interest_points(f, tile_size, nr_octaves, nr_scales, initial_step_size, threshold, max_points, nr_threads):
+    '''
+    points = _tiled_interest_points(f, tile_size, nr_octaves, nr_scales, initial_step_size, threshold, max_points, nr_threads)
+
+    Same as ``interest_points(f, ...)``, but only the integral image and the
+    pyramid of a single tile are kept in memory at any time (and only the
+    best ``max_points`` points found so far)
+    '''
+    if f.ndim != 2:
+        raise ValueError('mahotas.surf: Can only handle 2D-images (i.e., greyscale images).')
+    threshold = _threshold(threshold, max_points)
+    result = np.zeros((0, 5))
+    for core, region in _tiles(f.shape, tile_size, nr_octaves, nr_scales, initial_step_size):
+        ry0,ry1,rx0,rx1 = region
+        # Once max_points have been found, weaker points can be ignored
+        tile_threshold = threshold
+        if max_points is not None and 0 < max_points == len(result):
+            tile_threshold = max(threshold, result[-1,3])
+        points = interest_points(integral(f[ry0:ry1, rx0:rx1]), nr_octaves, nr_scales, initial_step_size, tile_threshold, None, is_integral=True, nr_threads=nr_threads)
+        points[:,0] += ry0
+        points[:,1] += rx0
+        result = _top_points(np.vstack([result, points[_in_core(points, core)]]), max_points)
+    return result
+
+def _tiled_descriptors(f, points, tile_size, nr_octaves, nr_scales, initial_step_size, nr_threads, upright, extended):
+    '''
+    spoints = _tiled_descriptors(f, points, tile_size, nr_octaves, nr_scales, initial_step_size, nr_threads, upright, extended)
+
+    Compute the descriptors of `points` (the output of
+    ``_tiled_interest_points``), one tile at a time
+    '''
+    result = np.zeros((len(points), 6 + (128 if extended else 64)))
+    valid = np.zeros(len(points), np.bool_)
+    for core, region in _tiles(f.shape, tile_size, nr_octaves, nr_scales, initial_step_size):
+        selected = np.flatnonzero(_in_core(points, core))
+        if not len(selected):
+            continue
+        ry0,ry1,rx0,rx1 = region
+        local = points[selected]
+        local[:,0] -= ry0
+        local[:,1] -= rx0
+        surfs, tvalid = _compute_descriptors(integral(f[ry0:ry1, rx0:rx1]), local, nr_threads, upright, extended)
+        surfs[:,0] += ry0
+        surfs[:,1] += rx0
+        result[selected] = surfs
+        valid[selected] = tvalid
+    return result[valid]
+
+def surf(f, nr_octaves=4, nr_scales=6, initial_step_size=1, threshold=0.1, max_points=1024, descriptor_only=False, nr_threads=None, upright=False, extended=False, tile_size=None):
+    '''
+    points = surf(f, nr_octaves=4, nr_scales=6, initial_step_size=1, threshold=0.1, max_points=1024, descriptor_only=False, nr_threads={cpu_count}, upright=False, extended=False, tile_size={no tiling}):
 
     Run SURF detection and descriptor computations
 
@@ -56,7 +191,9 @@ def surf(f, nr_octaves=4, nr_scales=6, initial_step_size=1, threshold=0.1, max_p
     initial_step_size : integer, optional
         Initial step size in pixels (default: 1)
     threshold : float, optional
-        Threshold of the strength of the interest point (default: 0.1)
+        Threshold of the strength of the interest point (default: 0.1). If
+        None, then there is no threshold and the ``max_points`` strongest
+        points are used.
     max_points : integer, optional
         Maximum number of points to return. By default, return at most 1024
         points. Note that the number may be smaller even in the case where
@@ -64,28 +201,52 @@ def surf(f, nr_octaves=4, nr_scales=6, initial_step_size=1, threshold=0.1, max_p
         threshold is implemented: only ``max_points`` are considered, but some
         of those may be filtered out.
     descriptor_only : boolean, optional
-        If ``descriptor_only``, then returns only the 64-element descriptors
+        If ``descriptor_only``, then returns only the descriptors (64 or, if
+        ``extended``, 128 elements each)
+    nr_threads : integer, optional
+        Nr of threads used to build the Hessian pyramid and to compute the
+        descriptors (default: one per CPU, but small inputs are processed in
+        a single thread)
+    upright : boolean, optional
+        If true, compute upright (U-SURF) descriptors: the orientation of the
+        points is not computed (it is set to zero), which is faster, but the
+        descriptors are not rotation invariant (default: False)
+    extended : boolean, optional
+        If true, compute 128-element (instead of 64-element) descriptors
+        (default: False)
+    tile_size : integer, optional
+        If given, the image is processed in (overlapping) tiles of about this
+        size, so that memory usage is proportional to the tile size (plus the
+        overlap, which depends on ``nr_octaves`` & ``nr_scales``) rather than
+        to the size of the image. The results are the same as without tiling
+        (up to floating point rounding). ``f`` can be a memory mapped array.
 
     Returns
     -------
-    points : ndarray of double, shape = (N, 6 + 64)
+    points : ndarray of double, shape = (N, 6 + 64) or (N, 6 + 128)
         `N` is nr of points. Each point is represented as
         *(y,x,scale,score,laplacian,angle, D_0,...,D_63)* where *y,x,scale* is
         the position, *angle* the orientation, *score* and *laplacian* the
-        score and sign of the detector; and *D_i* is the descriptor
+        score and sign of the detector; and *D_i* is the descriptor (which
+        has 128 elements if ``extended``)
 
         If ``descriptor_only``, then only the *D_i*s are returned and the array
-        has shape (N, 64)!
+        has shape (N, 64) (or (N, 128) if ``extended``)!
     '''
-    surfs = _surf.surf(integral(f), nr_octaves, nr_scales, initial_step_size, threshold, max_points)
-    if descriptor_only:
-        surfs = surfs[:,6:]
-    return surfs
+    if tile_size is not None:
+        points = _tiled_interest_points(f, tile_size, nr_octaves, nr_scales, initial_step_size, threshold, max_points, nr_threads)
+        spoints = _tiled_descriptors(f, points, tile_size, nr_octaves, nr_scales, initial_step_size, nr_threads, upright, extended)
+        if descriptor_only:
+            spoints = spoints[:,6:]
+        return spoints
+    fi = integral(f)
+    points = interest_points(fi, nr_octaves, nr_scales, initial_step_size, threshold, max_points, is_integral=True, nr_threads=nr_threads)
+    return descriptors(fi, points, is_integral=True, descriptor_only=descriptor_only, nr_threads=nr_threads, upright=upright, extended=extended)
 
 
-def interest_points(f, nr_octaves=4, nr_scales=6, initial_step_size=1, threshold=0.1, max_points=None, is_integral=False):
+def interest_points(f, nr_octaves=4, nr_scales=6, initial_step_size=1, threshold=0.1, max_points=None, is_integral=False, nr_threads=None, tile_size=None):
     '''
-    desc_array = interest_points(f, nr_octaves=4, nr_scales=6, initial_step_size=1, threshold=0.1, max_points={all}, is_integral=False)
+    desc_array = interest_points(f, nr_octaves=4, nr_scales=6, initial_step_size=1, threshold=0.1, max_points={all}, is_integral=False, nr_threads={cpu_count}, tile_size={no tiling})
 
     SURF Detector
 
@@ -100,11 +261,21 @@ def interest_points(f, nr_octaves=4, nr_scales=6, initial_step_size=1, threshold
     initial_step_size : integer, optional
         Initial step size in pixels (default: 1)
     threshold : float, optional
-        Threshold of the strength of the interest point (default: 0.1)
+        Threshold of the strength of the interest point (default: 0.1). If
+        None, return the ``max_points`` strongest points (which is faster than
+        using a low threshold and keeping the first ``max_points``).
     max_points : integer, optional
-        Maximum number of points to return. By default, return all.
+        Maximum number of points to return. By default, return all. Only the
+        strongest points are kept during detection (they are not all
+        collected and sorted).
     is_integral : boolean, optional
         Whether `f` is an integral image
+    nr_threads : integer, optional
+        Nr of threads used to build the Hessian pyramid (default: one per
+        CPU, but small images are processed in a single thread)
+    tile_size : integer, optional
+        Process the image in tiles (see ``surf``). Cannot be used with
+        ``is_integral``.
 
     Returns
     -------
@@ -119,22 +290,46 @@ def interest_points(f, nr_octaves=4, nr_scales=6, initial_step_size=1, threshold
     surf : SURF detection and descriptors
     descriptors : SURF descriptors
     '''
-    if not is_integral:
-        f = integral(f)
-    else:
-        if f.dtype != np.double:
-            raise TypeError('mahotas.surf: integral image must be of dtype double')
+    if tile_size is not None:
+        if is_integral:
+            raise ValueError('mahotas.surf.interest_points: tile_size cannot be used with is_integral')
+        return _tiled_interest_points(f, tile_size, nr_octaves, nr_scales, initial_step_size, threshold, max_points, nr_threads)
+    threshold = _threshold(threshold, max_points)
+    f = _check_integral(f, is_integral)
     if max_points is None:
         max_points = -1
-    return _surf.interest_points(f, nr_octaves, nr_scales, initial_step_size, threshold, max_points)
+    pyramid = _pyramid(f, nr_octaves, nr_scales, initial_step_size, nr_threads)
+    return _surf.interest_points(pyramid, initial_step_size, threshold, max_points)
 
 
-def descriptors(f, interest_points, is_integral=False, descriptor_only=False):
+def _compute_descriptors(fi, interest_points, nr_threads, upright, extended):
     '''
-    desc_array = descriptors(f, interest_points, is_integral=False)
+    surfs, valid = _compute_descriptors(fi, interest_points, nr_threads, upright, extended)
+
+    Implements ``descriptors``, but returns all the points together with a
+    boolean array marking those whose descriptor could be computed (i.e.,
+    those not too close to the border)
+    '''
+    interest_points = np.ascontiguousarray(np.asanyarray(interest_points, np.double)[:,:5])
+    nr_points = len(interest_points)
+    surfs = np.zeros((nr_points, 6 + (128 if extended else 64)))
+    valid = np.zeros(nr_points, np.bool_)
+    # Each descriptor samples a 20x20 grid around its point
+    nr_threads = min(_get_nr_threads(nr_threads, 400*nr_points), max(1, nr_points))
+    def compute(part):
+        _surf.descriptors(fi, interest_points, surfs, valid, bool(upright), bool(extended), part, nr_threads)
+    _run_threads(compute, [(t,) for t in range(nr_threads)])
+    return surfs, valid
+
+def descriptors(f, interest_points, is_integral=False, descriptor_only=False, nr_threads=None, upright=False, extended=False):
+    '''
+    desc_array = descriptors(f, interest_points, is_integral=False, descriptor_only=False, nr_threads={cpu_count}, upright=False, extended=False)
 
     Compute SURF descriptors
 
+    Points which are too close to the border of the image for a descriptor to
+    be computed are dropped.
+
     Parameters
     ----------
     f : ndarray
@@ -144,28 +339,169 @@ def descriptors(f, interest_points, is_integral=False, descriptor_only=False):
     is_integral : boolean, optional
         Whether `f` is an integral image
     descriptor_only : boolean, optional
-        If ``descriptor_only``, then returns only the 64-element descriptors
+        If ``descriptor_only``, then returns only the descriptors (64 or, if
+        ``extended``, 128 elements each)
+    nr_threads : integer, optional
+        Nr of threads between which the points are split (default: one per
+        CPU, but a few points are processed in a single thread)
+    upright : boolean, optional
+        If true, skip the computation of the orientation (see ``surf``)
+    extended : boolean, optional
+        If true, compute 128-element descriptors (see ``surf``)
 
     Returns
     -------
-    points : ndarray of double, shape = (N, 6 + 64)
+    points : ndarray of double, shape = (N, 6 + 64) or (N, 6 + 128)
         `N` is nr of points. Each point is represented as
         *(y,x,scale,score,laplacian,angle, D_0,...,D_63)* where *y,x,scale* is
         the position, *angle* the orientation, *score* and *laplacian* the
-        score and sign of the detector; and *D_i* is the descriptor.
+        score and sign of the detector; and *D_i* is the descriptor (which
+        has 128 elements if ``extended``).
         If ``descriptor_only`` is true, then returns only *(D_0,...,D_63)*
+        (or *(D_0,...,D_127)* if ``extended``)
     '''
-    if not is_integral:
-        f = integral(f)
-    else:
-        if f.dtype != np.double:
-            raise TypeError('mahotas.surf: integral image must be of dtype double')
-    surfs = _surf.descriptors(f, interest_points)
+    f = _check_integral(f, is_integral)
+    surfs, valid = _compute_descriptors(f, interest_points, nr_threads, upright, extended)
+    surfs = surfs[valid]
     if descriptor_only:
         surfs = surfs[:,6:]
     return surfs
 
 
+def _descriptors_of(spoints):
+    '''
+    descs, laplacian = _descriptors_of(spoints)
+
+    Split the output of ``surf`` (or ``descriptors``) into the descriptors and
+    the laplacian signs (``laplacian`` is None if ``spoints`` only contains
+    descriptors).
+    '''
+    spoints = np.asanyarray(spoints, np.double)
+    if spoints.ndim != 2:
+        raise ValueError('mahotas.surf.match: points should be a 2-D array')
+    if spoints.shape[1] in (6 + 64, 6 + 128):
+        return np.ascontiguousarray(spoints[:,6:]), spoints[:,4]
+    if spoints.shape[1] in (64, 128):
+        return np.ascontiguousarray(spoints), None
+    raise ValueError('mahotas.surf.match: points should be the output of surf (or the descriptors only)')
+
+def _kdtree(data, leaf_size=8):
+    '''
+    nodes, splits, perm = _kdtree(data, leaf_size=8)
+
+    Build a kd-tree over the rows of `data` (see _surf.cpp for the format)
+    '''
+    max_nodes = 2*len(data) - 1
+    nodes = np.empty((max_nodes, 3), np.intp)
+    splits = np.empty(max_nodes)
+    perm = np.empty(len(data), np.intp)
+    nr_nodes = _surf.build_kdtree(data, leaf_size, nodes, splits, perm)
+    return nodes[:nr_nodes].copy(), splits[:nr_nodes].copy(), perm
+
+def _match(queries, data, ratio, method, max_checks, nr_threads):
+    matches = np.empty(len(queries), np.intp)
+    matches.fill(-1)
+    distances = np.empty(len(queries))
+    distances.fill(np.inf)
+    if not len(queries) or not len(data):
+        return matches, distances
+    if method == 'exact':
+        nodes, splits, perm = None, None, None
+        max_checks = 0
+    else:
+        nodes, splits, perm = _kdtree(data)
+        if max_checks is None:
+            max_checks = 0
+    nr_threads = min(_get_nr_threads(nr_threads, len(queries)*len(data)), len(queries))
+    def compute(part):
+        _surf.match(queries, data, float(ratio), int(max_checks), nodes, splits, perm, matches, distances, part, nr_threads)
+    _run_threads(compute, [(t,) for t in range(nr_threads)])
+    return matches, distances
+
+def match(spoints0, spoints1, ratio=.8, use_laplacian=True, method='exact', max_checks=None, return_distances=False, nr_threads=None):
+    '''
+    pairs = match(spoints0, spoints1, ratio=.8, use_laplacian=True, method='exact', max_checks=None, return_distances=False, nr_threads={cpu_count})
+
+    Match SURF points by their descriptors
+
+    Each point in ``spoints0`` is matched to its nearest neighbour (in
+    Euclidean distance between the descriptors) in ``spoints1`` if it passes
+    the ratio test, i.e., if the distance to the nearest neighbour is less than
+    ``ratio`` times the distance to the second nearest neighbour.
+
+    Parameters
+    ----------
+    spoints0 : ndarray
+        output of ``surf`` (or ``descriptors``), possibly with
+        ``descriptor_only=True``
+    spoints1 : ndarray
+        points to match against (same format as ``spoints0``)
+    ratio : float, optional
+        Ratio for the ratio test (default: .8). Use 1. to match every point to
+        its nearest neighbour.
+    use_laplacian : boolean, optional
+        If true, points are only matched to points with the same laplacian sign
+        (this is both faster and more robust). Ignored if only the descriptors
+        were given. default: True
+    method : str, optional
+        One of:
+
+        'exact'
+            brute-force search (default)
+        'kdtree'
+            search using a kd-tree built on ``spoints1``. This is exact if
+            ``max_checks`` is None, otherwise it is approximate (but much
+            faster for large sets of points).
+    max_checks : integer, optional
+        For ``method='kdtree'``, the maximum number of points of ``spoints1``
+        compared to each point in ``spoints0`` (default: no limit)
+    return_distances : boolean, optional
+        Whether to also return the distance between the matched descriptors
+    nr_threads : integer, optional
+        Nr of threads between which ``spoints0`` is split (default: one per
+        CPU, but small inputs are processed in a single thread)
+
+    Returns
+    -------
+    pairs : ndarray of np.intp, shape = (N, 2)
+        Each row ``(i, j)`` is a match between ``spoints0[i]`` and
+        ``spoints1[j]`` (ordered by ``i``)
+    distances : ndarray of double, shape = (N,)
+        Only returned if ``return_distances``
+    '''
+    if method not in ('exact', 'kdtree'):
+        raise ValueError("mahotas.surf.match: method must be one of 'exact' or 'kdtree'")
+    if ratio <= 0:
+        raise ValueError('mahotas.surf.match: ratio must be positive')
+    if max_checks is not None and max_checks < 1:
+        raise ValueError('mahotas.surf.match: max_checks must be positive')
+    descs0, lap0 = _descriptors_of(spoints0)
+    descs1, lap1 = _descriptors_of(spoints1)
+    if descs0.shape[1] != descs1.shape[1]:
+        raise ValueError('mahotas.surf.match: descriptors have different sizes')
+    if not use_laplacian or lap0 is None or lap1 is None:
+        matches, distances = _match(descs0, descs1, ratio, method, max_checks, nr_threads)
+    else:
+        matches = np.empty(len(descs0), np.intp)
+        distances = np.empty(len(descs0))
+        for positive in (True, False):
+            queries = ((lap0 > 0) == positive)
+            candidates = np.flatnonzero((lap1 > 0) == positive)
+            m, d = _match(np.ascontiguousarray(descs0[queries]), np.ascontiguousarray(descs1[candidates]), ratio, method, max_checks, nr_threads)
+            # map back to indices into spoints1
+            found = (m >= 0)
+            m[found] = candidates[m[found]]
+            matches[queries] = m
+            distances[queries] = d
+    valid = (matches >= 0)
+    pairs = np.empty((valid.sum(), 2), np.intp)
+    pairs[:,0] = np.flatnonzero(valid)
+    pairs[:,1] = matches[valid]
+    if return_distances:
+        return pairs, distances[valid]
+    return pairs
+
+
 def show_surf(f, spoints, values=None, colors=None):
     '''
     f2 = show_surf(f, spoints, values=None, colors={[(255,0,0)]}):
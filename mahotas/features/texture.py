@@ -6,24 +6,51 @@
 from __future__ import division
 import numpy as np
 from . import _texture
-from ..internal import _verify_is_integer_type
-import math
+from ..internal import _verify_is_integer_type, _get_nr_threads, _run_threads
 
-__all__ = ['haralick', "haralick_labels"]
+__all__ = ['haralick', 'haralick_map', "haralick_labels"]
 
-def _entropy(p):
-    p = p.ravel()
-    return -np.dot(np.log(p+(p==0)),p)/math.log(2.0)
+# Above this number of grey levels, sparse co-occurrence matrices are used
+# (unless the image is large enough to fill the dense ones)
+_max_dense_levels = 256
+# haralick_map keeps a dense co-occurrence matrix per direction & thread
+_max_map_levels = 1024
 
+def _grey_levels(f, nr_grey_levels, fname):
+    '''
+    fm1, nr_grey_levels, divisor = _grey_levels(f, nr_grey_levels, fname)
 
-def haralick(f, ignore_zeros=False, preserve_haralick_bug=False, compute_14th_feature=False):
+    Returns the number of grey levels in the co-occurrence matrices and the
+    quantisation arguments for the _texture functions (a value ``v`` is
+    mapped to ``v * nr_grey_levels // divisor``)
+    '''
+    if f.dtype.kind == 'i' and f.size and f.min() < 0:
+        raise ValueError('mahotas.texture.%s: Image has negative values.' % fname)
+    fmax = (int(f.max()) if f.size else 0)
+    if nr_grey_levels is None:
+        return fmax + 1, 0, 1
+    nr_grey_levels = int(nr_grey_levels)
+    if nr_grey_levels < 1:
+        raise ValueError('mahotas.texture.%s: nr_grey_levels must be positive.' % fname)
+    # The divisor is passed as a 64 bit unsigned integer
+    return nr_grey_levels, nr_grey_levels, min(fmax + 1, 2**64 - 1)
+
+def haralick(f, ignore_zeros=False, preserve_haralick_bug=False, compute_14th_feature=False, nr_grey_levels=None):
     '''
-    feats = haralick(f, ignore_zeros=False, preserve_haralick_bug=False, compute_14th_feature=False)
+    feats = haralick(f, ignore_zeros=False, preserve_haralick_bug=False, compute_14th_feature=False, nr_grey_levels=None)
 
     Compute Haralick texture features
 
     Computes the Haralick texture features for the four 2-D directions or
-    thirteen 3-D directions (depending on the dimensions of `f`).
+    thirteen 3-D directions (depending on the dimensions of `f`). The
+    co-occurrence matrices for all directions are computed in a single pass
+    over the image.
+
+    For images with many grey levels (e.g., 12 or 16 bit images), the
+    co-occurrence matrices are stored sparsely (only the pairs that actually
+    occur are kept), so that memory usage does not grow with the square of the
+    number of grey levels. Alternatively, ``nr_grey_levels`` quantises the
+    image on the fly.
 
     Notes
     -----
@@ -44,6 +71,11 @@ def haralick(f, ignore_zeros=False, preserve_haralick_bug=False, compute_14th_fe
         replicate someone else's wrong implementation.
     compute_14th_feature : bool, optional
         whether to compute & return the 14-th feature
+    nr_grey_levels : int, optional
+        If given, pixel values are quantised to this many grey levels (pixel
+        value ``v`` is mapped to ``floor(v * nr_grey_levels / (f.max() + 1))``)
+        before the co-occurrence matrices are computed. With ``ignore_zeros``,
+        only pixels which are zero in ``f`` are ignored.
 
     Returns
     -------
@@ -55,95 +87,52 @@ def haralick(f, ignore_zeros=False, preserve_haralick_bug=False, compute_14th_fe
     _verify_is_integer_type(f, 'mahotas.haralick')
 
     if len(f.shape) == 2:
-        nr_dirs = len(_2d_deltas)
+        deltas = [(0,) + d for d in _2d_deltas]
     elif len(f.shape) == 3:
-        nr_dirs = len(_3d_deltas)
+        deltas = _3d_deltas
     else:
         raise ValueError('mahotas.texture.haralick: Can only handle 2D and 3D images.')
+    nr_dirs = len(deltas)
     feats = np.zeros((nr_dirs, 13 + bool(compute_14th_feature)), np.double)
-    fm1 = f.max() + 1
-    cmat = np.empty((fm1, fm1), np.int32)
-    k = np.arange(fm1)
-    k2 = k**2
-    tk = np.arange(2*fm1)
-    tk2 = tk**2
-    i,j = np.mgrid[:fm1,:fm1]
-    ij = i*j
-    i_j2_p1 = (i - j)**2
-    i_j2_p1 += 1
-    i_j2_p1 = 1. / i_j2_p1
-    i_j2_p1 = i_j2_p1.ravel()
-    px_plus_y = np.empty(2*fm1, np.double)
-    px_minus_y = np.empty(fm1, np.double)
-
-    for dir in xrange(nr_dirs):
-        cooccurence(f, dir, cmat, symmetric=True)
-        if ignore_zeros:
-            cmat[0] = 0
-            cmat[:,0] = 0
-        T = cmat.sum()
-        if not T:
-            continue
-        p = cmat / float(T)
-        pravel = p.ravel()
-        px = p.sum(0)
-        py = p.sum(1)
-
-        ux = np.dot(px, k)
-        uy = np.dot(py, k)
-        vx = np.dot(px, k2) - ux**2
-        vy = np.dot(py, k2) - uy**2
-
-        sx = np.sqrt(vx)
-        sy = np.sqrt(vy)
-        px_plus_y.fill(0)
-        px_minus_y.fill(0)
-        _texture.compute_plus_minus(p, px_plus_y, px_minus_y)
-
-        feats[dir, 0] = np.dot(pravel, pravel)
-        feats[dir, 1] = np.dot(k2, px_minus_y)
-
-        if sx == 0. or sy == 0.:
-            feats[dir, 2] = 1.
-        else:
-            feats[dir, 2] = (1. / sx / sy) * (np.dot(ij.ravel(), pravel) - ux * uy)
-
-        feats[dir, 3] = vx
-        feats[dir, 4] = np.dot(i_j2_p1, pravel)
-        feats[dir, 5] = np.dot(tk, px_plus_y)
-
-        feats[dir, 7] = _entropy(px_plus_y)
-
-        # There is some confusion w.r.t. feats[dir, 6].
-        #
-        # Haralick's paper uses feats[dir, 7] in its computation, but it is
-        # clear that feats[dir, 5] should be used (i.e., it computes a
-        # variance).
-        #
-        if preserve_haralick_bug:
-            feats[dir, 6] = ((tk-feats[dir, 7])**2*px_plus_y).sum()
-        else:
-            feats[dir, 6] = np.dot(tk2, px_plus_y) - feats[dir, 5]**2
-
-        feats[dir,  8] = _entropy(pravel)
-        feats[dir,  9] = px_minus_y.var()
-        feats[dir, 10] = _entropy(px_minus_y)
-
-        HX = _entropy(px)
-        HY = _entropy(py)
-        crosspxpy = np.outer(px,py)
-        crosspxpy += (crosspxpy == 0) # This makes log(0) become log(1), and thus evaluate to zero, such that everything works below:
-        crosspxpy = crosspxpy.ravel()
-        HXY1 = -np.dot(pravel, np.log2(crosspxpy))
-        HXY2 = _entropy(crosspxpy)
-
-        if max(HX, HY) == 0.:
-            feats[dir, 11] = (feats[dir,8]-HXY1)
-        else:
-            feats[dir, 11] = (feats[dir,8]-HXY1)/max(HX,HY)
-        feats[dir, 12] = np.sqrt(1 - np.exp( -2. * (HXY2 - feats[dir,8])))
-
-        if compute_14th_feature:
+    fm1, nr_grey_levels, divisor = _grey_levels(f, nr_grey_levels, 'haralick')
+    if fm1 <= _max_dense_levels or (fm1 <= 8*_max_dense_levels and fm1*fm1 <= f.size):
+        cmats = np.empty((nr_dirs, fm1, fm1), np.int32)
+    else:
+        # Most of the (fm1 x fm1) co-occurrence matrix would be zero
+        cmats = None
+    # Computes the co-occurrence matrices for all directions (in a single pass)
+    # and the first 13 features
+    entries = _texture.haralick(
+                    f[(np.newaxis,) * (3 - f.ndim)],
+                    np.array(deltas, np.intp),
+                    cmats,
+                    feats,
+                    bool(ignore_zeros),
+                    bool(preserve_haralick_bug),
+                    fm1,
+                    nr_grey_levels,
+                    divisor,
+                    bool(compute_14th_feature))
+
+    if compute_14th_feature:
+        for dir in xrange(nr_dirs):
+            if cmats is not None:
+                cmat = cmats[dir]
+            else:
+                # Build the co-occurrence matrix restricted to the grey
+                # levels which occur (entries only has its upper triangle)
+                i,j,counts = entries[dir].T
+                levels = np.unique(np.concatenate((i,j)))
+                i = np.searchsorted(levels, i)
+                j = np.searchsorted(levels, j)
+                cmat = np.zeros((len(levels), len(levels)), np.intp)
+                cmat[i,j] = counts
+                cmat[j,i] = counts
+            T = cmat.sum()
+            if not T:
+                continue
+            p = cmat / float(T)
+            px = p.sum(0)
             # Square root of the second largest eigenvalue of the correlation matrix
             # Probably the faster way to do this is just SVD the whole (likely rank deficient) matrix
             # grab the second highest singular value . . . Instead, we just amputate the empty rows/cols and move on.
@@ -160,6 +149,80 @@ def haralick(f, ignore_zeros=False, preserve_haralick_bug=False, compute_14th_fe
     return feats
 
 
+def haralick_map(f, window, ignore_zeros=False, preserve_haralick_bug=False, nr_grey_levels=None, return_mean=True, nr_threads=None):
+    '''
+    feature_map = haralick_map(f, window, ignore_zeros=False, preserve_haralick_bug=False, nr_grey_levels=None, return_mean=True, nr_threads=None)
+
+    Compute Haralick texture features over a sliding window
+
+    For each pixel, the first 13 Haralick features (see ``haralick``) of the
+    window centred on it are computed (at the border, the window is clipped to
+    the image). This is much faster than calling ``haralick`` on each window
+    as the co-occurrence matrices are updated incrementally as the window
+    slides along each row. The rows are split between ``nr_threads`` threads.
+
+    The grey levels are always those of the whole image (this matters for the
+    Difference Variance, which is a variance over all grey levels).
+
+    The cost of computing the features at each pixel grows with the number of
+    grey levels. For images with many grey levels, you probably want to set
+    ``nr_grey_levels`` (e.g., to 32).
+
+    Parameters
+    ----------
+    f : ndarray of integer type
+        input image (2-D)
+    window : int or (int, int)
+        window size (rows, columns). Sizes must be odd.
+    ignore_zeros : bool, optional
+        Whether to ignore zero pixels (default: False).
+    preserve_haralick_bug : bool, optional
+        whether to replicate Haralick's typo (default: False).
+    nr_grey_levels : int, optional
+        If given, pixel values are quantised to this many grey levels (see
+        ``haralick``).
+    return_mean : bool, optional
+        If true (the default), the features are averaged over the four
+        directions (as they are computed, so that the per-direction features
+        are never stored).
+    nr_threads : int, optional
+        Number of threads (default: one per CPU, but small images are
+        processed in a single thread)
+
+    Returns
+    -------
+    feature_map : ndarray of np.double
+        An array of shape ``f.shape + (13,)`` or, if not ``return_mean``,
+        ``f.shape + (4, 13)``
+    '''
+    _verify_is_integer_type(f, 'mahotas.haralick_map')
+    if f.ndim != 2:
+        raise ValueError('mahotas.texture.haralick_map: Can only handle 2D images.')
+    window = np.array(window, np.intp).ravel()
+    if len(window) == 1:
+        window = np.array([window[0], window[0]])
+    if len(window) != 2 or np.any(window < 1) or np.any(window % 2 == 0):
+        raise ValueError('mahotas.texture.haralick_map: window must be one or two positive odd integers.')
+    fm1, nr_grey_levels, divisor = _grey_levels(f, nr_grey_levels, 'haralick_map')
+    if fm1 > _max_map_levels:
+        raise ValueError('mahotas.texture.haralick_map: Too many grey levels (%s). Use the nr_grey_levels argument.' % fm1)
+    deltas = np.array(_2d_deltas, np.intp)
+    # The mean over the directions is computed as the features are, so that
+    # only the output is allocated
+    if return_mean:
+        output = np.zeros(f.shape + (13,), np.double)
+    else:
+        output = np.zeros(f.shape + (len(deltas), 13), np.double)
+
+    h = f.shape[0]
+    nr_threads = min(_get_nr_threads(nr_threads, f.size), h)
+    def compute(y0, y1):
+        _texture.haralick_map(f, deltas, output, window[0]//2, window[1]//2, y0, y1, bool(ignore_zeros), bool(preserve_haralick_bug), fm1, nr_grey_levels, divisor)
+    bounds = [(h*t)//nr_threads for t in xrange(nr_threads + 1)]
+    _run_threads(compute, [(bounds[t], bounds[t+1]) for t in xrange(nr_threads)])
+    return output
+
+
 haralick_labels = ["Angular Second Moment",
                    "Contrast",
                    "Correlation",
@@ -8,9 +8,10 @@ from __future__ import division
 import numpy as np
 
 from ..center_of_mass import center_of_mass
+from ..internal import _run_threads, _get_nr_threads
 from . import _zernike
 
-__all__ = ['zernike', 'zernike_moments']
+__all__ = ['ZernikeBasis', 'zernike', 'zernike_moments']
 
 def zernike(im, degree, radius, cm=None):
     """
@@ -20,15 +21,24 @@ def zernike(im, degree, radius, cm=None):
     warnings.warn('mahotas.zernike.zernike: This interface is deprecated. Switch your arguments and use ``zernike_moments``', DeprecationWarning)
     return zernike_moments(im, radius, degree, cm)
 
-def zernike_moments(im, radius, degree=8, cm=None):
+def _nr_moments(degree):
+    return sum(1 for n in range(degree+1) for l in range(n+1) if (n-l) % 2 == 0)
+
+def _orders(degree):
+    return np.array([n for n in range(degree+1) for l in range(n+1) if (n-l) % 2 == 0])
+
+def zernike_moments(im, radius, degree=8, cm=None, nr_threads=None):
     """
-    zvalues = zernike_moments(im, radius, degree=8, cm={center_of_mass(im)})
+    zvalues = zernike_moments(im, radius, degree=8, cm={center_of_mass(im)}, nr_threads=None)
 
     Zernike moments through ``degree``
 
     Returns a vector of absolute Zernike moments through ``degree`` for the
     image ``im``.
 
+    All moments are computed in a single pass over the image (the radial
+    polynomials are computed with Kintner's recurrence).
+
     Parameters
     ----------
     im : 2-ndarray
@@ -39,57 +49,131 @@ def zernike_moments(im, radius, degree=8, cm=None):
         Maximum degree to use (default: 8)
     cm : pair of floats, optional
         the centre of mass to use. By default, uses the image's centre of mass.
+    nr_threads : int, optional
+        Number of threads (the image is split into bands of rows). default:
+        number of CPUs for large images, one otherwise
 
     Returns
     -------
     zvalues : 1-ndarray of floats
-        Zernike moments
+        Zernike moments, in order of increasing ``n`` and, for each ``n``,
+        increasing ``l`` (for all ``l <= n`` such that ``n - l`` is even)
 
     Reference
     ---------
     Teague, MR. (1980). Image Analysis via the General Theory of Moments.  J.
     Opt. Soc. Am. 70(8):920-930.
+
+    Kintner, EC. (1976). On the mathematical properties of the Zernike
+    polynomials. Optica Acta 23(8):679-680.
     """
-    zvalues = []
+    im = np.asanyarray(im)
+    if im.ndim != 2:
+        raise ValueError('mahotas.zernike_moments: Only 2-D images are supported')
     if cm is None:
         c0,c1 = center_of_mass(im)
     else:
         c0,c1 = cm
+    nr_moments = _nr_moments(degree)
+    nr_threads = min(_get_nr_threads(nr_threads, im.size), max(1, im.shape[0]))
+    bounds = [(im.shape[0]*t)//nr_threads for t in range(nr_threads + 1)]
+    sums = np.zeros((nr_threads, nr_moments), np.complex128)
+    totals = np.zeros(nr_threads)
+    def compute(t):
+        totals[t] = _zernike.zernike_sums(im, float(c0), float(c1), float(radius), int(degree), bounds[t], bounds[t+1], sums[t])
+    _run_threads(compute, [(t,) for t in range(nr_threads)])
+    total = totals.sum()
+    if total == 0:
+        return np.zeros(nr_moments)
+    return np.abs(sums.sum(0)) * (_orders(degree) + 1) / np.pi / total
+
+class ZernikeBasis(object):
+    """
+    basis = ZernikeBasis(radius, degree, shape, cm={centre of shape})
+
+    Precomputed Zernike polynomials for images of a fixed shape
 
-    Y,X = np.mgrid[:im.shape[0],:im.shape[1]]
-    P = im.ravel()
-
-    def rescale(C, centre):
-        Cn = C.astype(np.double)
-        Cn -= centre
-        Cn /= radius
-        return Cn.ravel()
-    Yn = rescale(Y, c0)
-    Xn = rescale(X, c1)
-
-    Dn = Xn**2
-    Dn += Yn**2
-    np.sqrt(Dn, Dn)
-    k = (Dn <= 1.)
-    k &= (P > 0)
-
-    frac_center = np.array(P[k], np.double)
-    frac_center = frac_center.ravel()
-    frac_center /= frac_center.sum()
-    Yn = Yn[k]
-    Xn = Xn[k]
-    Dn = Dn[k]
-    An = np.empty(Yn.shape, np.complex)
-    An.real = (Xn/Dn)
-    An.imag = (Yn/Dn)
-
-    Ans = [An**p for p in xrange(2,degree+2)]
-    Ans.insert(0, An) # An**1
-    Ans.insert(0, np.ones_like(An)) # An**0
-    for n in xrange(degree+1):
-        for l in xrange(n+1):
-            if (n-l)%2 == 0:
-                z = _zernike.znl(Dn, Ans[l], frac_center, n, l)
-                zvalues.append(abs(z))
-    return np.array(zvalues)
+    When Zernike moments of many images of the same shape (e.g., crops of
+    objects) are needed with the same ``radius`` & centre, the polynomials can
+    be computed once. The moments of a batch of images are then a single
+    matrix product (which uses the BLAS through ``numpy.dot``).
 
+    ``basis.moments(im)`` is the same as ``zernike_moments(im, radius,
+    degree, cm=cm)``.
+
+    Parameters
+    ----------
+    radius : number
+        the maximum radius for the Zernike polynomials, in pixels
+    degree : integer
+        Maximum degree to use
+    shape : tuple of 2 integers
+        shape of the images
+    cm : pair of floats, optional
+        the centre to use. By default, the centre of the image
+        (``((shape[0]-1)/2., (shape[1]-1)/2.)``). Note that, unlike in
+        ``zernike_moments``, this is *not* the centre of mass of each image.
+    """
+    # Number of images processed at once by moments()
+    _block_size = 256
+
+    def __init__(self, radius, degree, shape, cm=None):
+        if len(shape) != 2:
+            raise ValueError('mahotas.features.ZernikeBasis: Only 2-D shapes are supported')
+        self.radius = radius
+        self.degree = degree
+        self.shape = tuple(shape)
+        if cm is None:
+            cm = ((shape[0]-1)/2., (shape[1]-1)/2.)
+        self.cm = tuple(cm)
+        nr_moments = _nr_moments(degree)
+        basis = np.empty((nr_moments, shape[0]*shape[1]), np.complex128)
+        _zernike.zernike_basis(float(cm[0]), float(cm[1]), float(radius), int(degree), shape[0], shape[1], basis)
+        # Only the pixels inside the unit disk are used
+        self._pixels = np.flatnonzero(np.any(basis != 0, 0))
+        basis = basis[:,self._pixels]
+        self._basis = np.ascontiguousarray(np.vstack([basis.real, basis.imag]).T)
+        self._scale = (_orders(degree) + 1) / np.pi
+
+    def moments(self, images):
+        """
+        zvalues = basis.moments(im)
+        zvalues = basis.moments(images)
+
+        Zernike moments of an image or of a batch of images
+
+        Parameters
+        ----------
+        images : ndarray
+            either a single image (of shape ``basis.shape``) or a batch of
+            images (of shape ``(N,) + basis.shape`` or ``(N, h*w)``)
+
+        Returns
+        -------
+        zvalues : ndarray
+            Zernike moments (1-D for a single image, ``N x nr_moments`` for a
+            batch)
+        """
+        images = np.asanyarray(images)
+        npixels = self.shape[0]*self.shape[1]
+        if images.shape == self.shape:
+            return self.moments(images.reshape((1, npixels)))[0]
+        if images.shape[1:] == self.shape:
+            images = images.reshape((len(images), npixels))
+        if images.ndim != 2 or images.shape[1] != npixels:
+            raise ValueError('mahotas.features.ZernikeBasis.moments: images do not match the shape of the basis (%s)' % (self.shape,))
+        nr_moments = len(self._scale)
+        result = np.zeros((len(images), nr_moments))
+        for start in range(0, len(images), self._block_size):
+            block = images[start:start+self._block_size, self._pixels].astype(np.float64)
+            # As in zernike_moments, only positive pixels are used
+            np.maximum(block, 0, block)
+            sums = np.dot(block, self._basis)
+            totals = block.sum(1)
+            valid = (totals > 0)
+            values = np.hypot(sums[:,:nr_moments], sums[:,nr_moments:])
+            values *= self._scale
+            values[valid] /= totals[valid,np.newaxis]
+            values[~valid] = 0
+            result[start:start+self._block_size] = values
+        return result
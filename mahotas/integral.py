@@ -0,0 +1,101 @@
+# Copyright (C) 2012, Luis Pedro Coelho <luis@luispedro.org>
+# vim: set ts=4 sts=4 sw=4 expandtab smartindent:
+# License: MIT
+
+from __future__ import division
+import numpy as np
+from . import _integral
+from .internal import _get_nr_threads, _run_threads
+
+__all__ = [
+    'integral',
+    ]
+
+_supported_dtypes = (np.uint32, np.uint64, np.int64, np.float32, np.float64)
+
+def _default_dtype(f):
+    if f.dtype == np.bool_ or f.dtype.kind == 'u':
+        return np.uint64
+    if f.dtype.kind == 'i':
+        return np.int64
+    return np.float64
+
+def _run(array, squared, nr_threads):
+    '''
+    _run(array, squared, nr_threads)
+
+    Transform `array` (and `squared`, which should hold a copy of `array`, or
+    be None) into an integral image in place.
+    '''
+    nr_threads = _get_nr_threads(nr_threads, array.size)
+    # The last axis first (it also computes the squares), then the others
+    for axis in range(array.ndim - 1, -1, -1):
+        # The lines along the last axis are split between the threads,
+        # otherwise the positions along the last axis are
+        nr_lines = (array.size // max(1, array.shape[-1]) if axis == array.ndim - 1 else array.shape[-1])
+        nr_parts = max(1, min(nr_threads, nr_lines))
+        def run(part):
+            _integral.integral(array, squared, axis, part, nr_parts)
+        _run_threads(run, [(p,) for p in range(nr_parts)])
+
+def integral(f, dtype=None, squared=False, out=None, nr_threads=None):
+    '''
+    fi = integral(f, dtype={uint64, int64, or float64}, squared=False, out={new array}, nr_threads={cpu_count})
+    fi, fi2 = integral(f, ..., squared=True)
+
+    Compute the integral image (summed area table) of `f`
+
+    ``fi[y,x]`` is the sum of ``f[:y+1, :x+1]`` (and, for 3-D images,
+    ``fi[z,y,x]`` is the sum of ``f[:z+1,:y+1,:x+1]``). The sum of any box can
+    then be computed from (at most) 4 (or 8) values of ``fi``.
+
+    Parameters
+    ----------
+    f : ndarray
+        2-D or 3-D image
+    dtype : dtype, optional
+        Accumulator type, one of uint32, uint64, int64, float32, or float64.
+        By default, integer images are summed exactly (uint64 for unsigned or
+        boolean images, int64 for signed ones) and float images use float64.
+        Note that, with uint32, the table may wrap around, but box sums computed
+        from it (with unsigned arithmetic) are still exact as long as they fit
+        in 32 bits.
+    squared : bool, optional
+        Whether to also compute the integral of ``f**2`` (in the same pass),
+        which is useful to compute local variances (default: False)
+    out : ndarray, optional
+        Output array (of type `dtype` and same shape as `f`). May be `f`
+        itself, in which case the computation is done in place.
+    nr_threads : integer, optional
+        Nr of threads to use (default: one per CPU, but small images are
+        processed in a single thread)
+
+    Returns
+    -------
+    fi : ndarray
+        integral image
+    fi2 : ndarray
+        integral image of ``f**2`` (only if ``squared``)
+    '''
+    f = np.asanyarray(f)
+    if f.ndim not in (2,3):
+        raise ValueError('mahotas.integral: Only 2-D and 3-D images are supported')
+    if dtype is None:
+        dtype = (out.dtype if out is not None else _default_dtype(f))
+    dtype = np.dtype(dtype)
+    if not any(dtype == d for d in _supported_dtypes):
+        raise ValueError('mahotas.integral: dtype must be one of uint32, uint64, int64, float32, or float64 (got %s)' % dtype)
+    if out is None:
+        out = f.astype(dtype)
+    else:
+        if out.dtype != dtype or out.shape != f.shape:
+            raise ValueError('mahotas.integral: `out` is not of the right type or shape')
+        if out is not f:
+            out[...] = f
+    fi2 = None
+    if squared:
+        fi2 = np.empty(out.shape, out.dtype)
+    _run(out, fi2, nr_threads)
+    if squared:
+        return out, fi2
+    return out
@@ -3,6 +3,8 @@
 #
 # License: MIT (see COPYING file)
 import numpy as np
+import multiprocessing
+import threading
 
 def _get_output(array, out, fname, dtype=None, output=None):
     '''
@@ -149,3 +151,44 @@ def _as_floating_point_array(array):
     if not np.issubdtype(array.dtype, np.float_):
         return array.astype(np.double)
     return array
+
+# With the default number of threads, each thread gets at least this many
+# pixels (smaller inputs are not worth the cost of starting threads)
+_min_pixels_per_thread = 1 << 16
+
+def _get_nr_threads(nr_threads, size):
+    '''
+    nr_threads = _get_nr_threads(nr_threads, size)
+
+    Number of threads to process `size` pixels with. If `nr_threads` is None,
+    this is one per CPU, but small inputs are processed in a single thread.
+    '''
+    if nr_threads is None:
+        return max(1, min(multiprocessing.cpu_count(), size // _min_pixels_per_thread))
+    return max(1, int(nr_threads))
+
+def _run_threads(function, args):
+    '''
+    _run_threads(function, args)
+
+    Calls ``function(*a)`` for each ``a`` in `args`, each in its own thread
+    (the first one in the calling thread), and waits for all of them.
+
+    If any of the calls raises an exception, it is re-raised here (after all
+    the threads have finished).
+    '''
+    errors = []
+    def run(a):
+        try:
+            function(*a)
+        except BaseException as e:
+            errors.append(e)
+    threads = [threading.Thread(target=run, args=(a,)) for a in args[1:]]
+    for t in threads:
+        t.start()
+    if args:
+        run(args[0])
+    for t in threads:
+        t.join()
+    if errors:
+        raise errors[0]
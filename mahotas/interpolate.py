@@ -151,16 +151,77 @@ def spline_filter(array, order=3, out=None, dtype=np.float64, output=None):
 
 
 
+class PreparedSpline(object):
+    """
+    spline = PreparedSpline(array, order=3, dtype=np.float64)
+
+    Spline coefficients of an array, computed once
+
+    The interpolation functions (``zoom``, ``shift``, ``affine_transform`` &
+    ``map_coordinates``) filter their input with ``spline_filter`` on every
+    call. When the same array is resampled many times, the filtered
+    coefficients can be computed once and the spline passed instead of the
+    array::
+
+        spline = PreparedSpline(volume)
+        shifted = [shift(spline, delta) for delta in deltas]
+
+    The order of the interpolation is then that of the spline.
+
+    Parameters
+    ----------
+    array : ndarray
+        The input array.
+    order : int, optional
+        The order of the spline, default is 3.
+    dtype : dtype, optional
+        The dtype of the coefficients (np.float32 or np.float64, default:
+        np.float64)
+    """
+    def __init__(self, array, order=3, dtype=np.float64):
+        array = _check_interpolate(array, order, 'PreparedSpline')
+        if array.ndim < 1:
+            raise ValueError('mahotas.interpolate.PreparedSpline: array rank must be > 0')
+        if dtype not in (np.float32, np.float64):
+            raise TypeError('mahotas.interpolate.PreparedSpline: dtype must be np.float32 or np.float64')
+        self.order = order
+        if order > 1:
+            self.coefficients = spline_filter(array, order, dtype=dtype)
+        else:
+            self.coefficients = np.array(array, dtype=dtype, order='C')
+
+    @property
+    def shape(self):
+        return self.coefficients.shape
+
+    @property
+    def ndim(self):
+        return self.coefficients.ndim
+
 def _maybe_filter(array, order, func, prefilter, dtype):
+    '''
+    array, order = _maybe_filter(array, order, func, prefilter, dtype)
+
+    Returns the spline coefficients of `array` (which may be a
+    ``PreparedSpline``) and the order of the interpolation
+    '''
+    if isinstance(array, PreparedSpline):
+        if order is not None and order != array.order:
+            raise ValueError('mahotas.%s: order (%s) is not the order of the prepared spline (%s)' % (func, order, array.order))
+        return array.coefficients, array.order
+    if order is None:
+        order = 3
     array = _check_interpolate(array, order, func)
     if array.ndim < 1:
         raise ValueError(func+': array rank must be > 0')
     if prefilter and order > 1:
-        return spline_filter(array, order, dtype=dtype)
+        return spline_filter(array, order, dtype=dtype), order
+    elif array.dtype not in (np.float32, np.float64) or not array.flags.carray:
+        return np.ascontiguousarray(array, dtype=(array.dtype if array.dtype in (np.float32, np.float64) else dtype)), order
     else:
-        return array
+        return array, order
 
-def zoom(array, zoom, out=None, order=3, mode='constant', cval=0.0, prefilter=True, output=None):
+def zoom(array, zoom, out=None, order=None, mode='constant', cval=0.0, prefilter=True, output=None):
     """
     Zoom an array.
 
@@ -168,7 +229,7 @@ def zoom(array, zoom, out=None, order=3, mode='constant', cval=0.0, prefilter=Tr
 
     Parameters
     ----------
-    array : ndarray
+    array : ndarray or PreparedSpline
         The input array.
     zoom : float or sequence, optional
         The zoom factor along the axes. If a float, `zoom` is the same for each
@@ -177,8 +238,8 @@ def zoom(array, zoom, out=None, order=3, mode='constant', cval=0.0, prefilter=Tr
         The array in which to place the output, or the dtype of the returned
         array.
     order : int, optional
-        The order of the spline interpolation, default is 3.
-        The order has to be in the range 0-5.
+        The order of the spline interpolation, default is 3 (or the order
+        of ``array`` if it is a ``PreparedSpline``).
     mode : str, optional
         Points outside the boundaries of the input are filled according
         to the given mode ('constant', 'nearest', 'reflect' or 'wrap').
@@ -196,7 +257,7 @@ def zoom(array, zoom, out=None, order=3, mode='constant', cval=0.0, prefilter=Tr
     -------
     return_value : ndarray
     """
-    array = _maybe_filter(array, order, 'interpolate.zoom', prefilter, dtype=np.float64)
+    array, order = _maybe_filter(array, order, 'interpolate.zoom', prefilter, dtype=np.float64)
     zoom = np.array(zoom)
     if zoom.ndim == 0:
         zoom = np.array([zoom]*array.ndim)
@@ -224,7 +285,7 @@ def zoom(array, zoom, out=None, order=3, mode='constant', cval=0.0, prefilter=Tr
     return out
 
 
-def shift(array, shift, out=None, order=3, mode='constant', cval=0.0,
+def shift(array, shift, out=None, order=None, mode='constant', cval=0.0,
           prefilter=True, output=None):
     """
     Shift an array.
@@ -235,7 +296,7 @@ def shift(array, shift, out=None, order=3, mode='constant', cval=0.0,
 
     Parameters
     ----------
-    array : ndarray
+    array : ndarray or PreparedSpline
         The input array.
     shift : float or sequence, optional
         The shift along the axes. If a float, `shift` is the same for each
@@ -244,8 +305,8 @@ def shift(array, shift, out=None, order=3, mode='constant', cval=0.0,
         The array in which to place the output, or the dtype of the returned
         array.
     order : int, optional
-        The order of the spline interpolation, default is 3.
-        The order has to be in the range 0-5.
+        The order of the spline interpolation, default is 3 (or the order
+        of ``array`` if it is a ``PreparedSpline``).
     mode : str, optional
         Points outside the boundaries of the input are filled according
         to the given mode ('constant', 'nearest', 'reflect' or 'wrap').
@@ -262,15 +323,178 @@ def shift(array, shift, out=None, order=3, mode='constant', cval=0.0,
     Returns
     -------
     return_value : ndarray
-        The shifted input.
+        The shifted input (of type np.float64 or, if `array` is a
+        ``PreparedSpline``, of the type of its coefficients).
 
     """
-    array = _maybe_filter(array, order, 'interpolate.shift', prefilter, dtype=np.float64)
+    prepared = isinstance(array, PreparedSpline)
+    array, order = _maybe_filter(array, order, 'interpolate.shift', prefilter, dtype=np.float64)
+    if not prepared and array.dtype != np.float64:
+        array = array.astype(np.float64)
     _check_mode(mode, cval, 'interpolation.shift')
-    output = internal._get_output(array, out, 'interpolate.shift', dtype=np.float64, output=output)
-    shift = np.ascontiguousarray(shift, dtype=np.float64)
-    shift *= -1
+    output = internal._get_output(array, out, 'interpolate.shift', dtype=array.dtype, output=output)
+    shift = np.zeros(array.ndim) - shift
+    if shift.shape != (array.ndim,):
+        raise ValueError('mahotas.interpolation.shift: shift should have one element for each dimension of array')
     _interpolate.zoom_shift(array, None, shift, output, order, mode2int[mode], cval)
     return output
 
 
+def _run_parts(kernel, n, size, nr_threads):
+    '''
+    _run_parts(kernel, n, size, nr_threads)
+
+    Call ``kernel(part, nr_parts)`` for every part, in ``nr_parts`` threads
+    (where ``nr_parts`` is ``nr_threads``, but at most ``n``). `size` is the
+    number of output pixels (which sets the default number of threads).
+    '''
+    nr_parts = min(internal._get_nr_threads(nr_threads, size), max(1, n))
+    internal._run_threads(kernel, [(p, nr_parts) for p in range(nr_parts)])
+
+def _get_transform_output(array, out, shape, fname):
+    if out is None:
+        return np.empty(shape, array.dtype)
+    if out.dtype != array.dtype:
+        raise ValueError('mahotas.%s: `out` has wrong type (out.dtype is %s; expected %s)' % (fname, out.dtype, array.dtype))
+    if out.shape != tuple(shape):
+        raise ValueError('mahotas.%s: `out` has wrong shape' % fname)
+    if not out.flags.carray:
+        raise ValueError('mahotas.%s: `out` is not c-array' % fname)
+    return out
+
+def affine_transform(array, matrix, offset=0.0, output_shape=None, out=None, order=None, mode='constant', cval=0.0, prefilter=True, nr_threads=None):
+    """
+    Apply an affine transformation.
+
+    The value at output position ``o`` is the (spline interpolated) value of
+    the input at position ``np.dot(matrix, o) + offset``.
+
+    Parameters
+    ----------
+    array : ndarray or PreparedSpline
+        The input array.
+    matrix : ndarray
+        The matrix must be two-dimensional or can also be given as a
+        one-dimensional sequence or array. In the latter case, it is assumed
+        that the matrix is diagonal. A ``(array.ndim + 1) x (array.ndim + 1)``
+        matrix is taken to be in homogeneous coordinates (the offset is then
+        its last column).
+    offset : float or sequence, optional
+        The offset into the array where the transform is applied. If a float,
+        `offset` is the same for each axis. If a sequence, `offset` should
+        contain one value for each axis.
+    output_shape : tuple of ints, optional
+        Shape of the output (default: the shape of ``out`` if given, otherwise
+        the shape of the input)
+    out : ndarray, optional
+        The array in which to place the output (of the same type as the
+        input, after prefiltering)
+    order : int, optional
+        The order of the spline interpolation, default is 3 (or the order
+        of ``array`` if it is a ``PreparedSpline``).
+    mode : str, optional
+        Points outside the boundaries of the input are filled according
+        to the given mode ('constant', 'nearest', 'reflect', 'mirror' or
+        'wrap'). Default is 'constant'.
+    cval : scalar, optional
+        Value used for points outside the boundaries of the input if
+        ``mode='constant'``. Default is 0.0
+    prefilter : bool, optional
+        Whether to pre-filter the input with `spline_filter` (necessary for
+        spline interpolation of order > 1). To transform the same array many
+        times, pass a ``PreparedSpline`` instead (which is never filtered
+        again). Default is True.
+    nr_threads : int, optional
+        Number of threads (default: number of CPUs for large outputs, one
+        otherwise). The output lines are split between the threads.
+
+    Returns
+    -------
+    transformed : ndarray
+        The transformed input.
+    """
+    array, order = _maybe_filter(array, order, 'interpolate.affine_transform', prefilter, dtype=np.float64)
+    _check_mode(mode, cval, 'interpolate.affine_transform')
+    matrix = np.asarray(matrix, dtype=np.float64)
+    if matrix.ndim == 1:
+        matrix = np.diag(matrix)
+    if matrix.ndim != 2:
+        raise ValueError('mahotas.interpolate.affine_transform: matrix should be 1-D or 2-D')
+    if matrix.shape[0] == array.ndim + 1:
+        # homogeneous coordinates
+        offset = matrix[:array.ndim, -1]
+        matrix = matrix[:array.ndim, :-1]
+    if matrix.shape[0] != array.ndim or matrix.shape[1] < 1:
+        raise ValueError('mahotas.interpolate.affine_transform: matrix should have one row for each dimension of array')
+    matrix = np.ascontiguousarray(matrix)
+    offset = np.zeros(array.ndim) + offset
+    if offset.shape != (array.ndim,):
+        raise ValueError('mahotas.interpolate.affine_transform: offset should have one element for each dimension of array')
+    if output_shape is None:
+        output_shape = (out.shape if out is not None else array.shape)
+    output_shape = tuple(output_shape)
+    if len(output_shape) != matrix.shape[1]:
+        raise ValueError('mahotas.interpolate.affine_transform: output_shape does not match the number of columns of matrix')
+    out = _get_transform_output(array, out, output_shape, 'interpolate.affine_transform')
+    nr_lines = (out.size // out.shape[-1] if out.size else 0)
+    def kernel(part, nr_parts):
+        _interpolate.affine_transform(array, matrix, offset, out, order, mode2int[mode], cval, part, nr_parts)
+    _run_parts(kernel, nr_lines, out.size, nr_threads)
+    return out
+
+
+def map_coordinates(array, coordinates, out=None, order=None, mode='constant', cval=0.0, prefilter=True, nr_threads=None):
+    """
+    Map the input array to new coordinates by interpolation.
+
+    The value at output position ``o`` is the (spline interpolated) value of
+    the input at position ``coordinates[:, o]``.
+
+    Parameters
+    ----------
+    array : ndarray or PreparedSpline
+        The input array.
+    coordinates : array_like
+        The coordinates at which `array` is evaluated: its first dimension
+        has one entry per dimension of ``array``; the remaining dimensions
+        give the shape of the output.
+    out : ndarray, optional
+        The array in which to place the output (of the same type as the
+        input, after prefiltering)
+    order : int, optional
+        The order of the spline interpolation, default is 3 (or the order
+        of ``array`` if it is a ``PreparedSpline``).
+    mode : str, optional
+        Points outside the boundaries of the input are filled according
+        to the given mode ('constant', 'nearest', 'reflect', 'mirror' or
+        'wrap'). Default is 'constant'.
+    cval : scalar, optional
+        Value used for points outside the boundaries of the input if
+        ``mode='constant'``. Default is 0.0
+    prefilter : bool, optional
+        Whether to pre-filter the input with `spline_filter` (see
+        ``affine_transform``). Default is True.
+    nr_threads : int, optional
+        Number of threads (default: number of CPUs for large outputs, one
+        otherwise).
+
+    Returns
+    -------
+    mapped : ndarray
+        The result of transforming the input (of shape
+        ``coordinates.shape[1:]``).
+
+    See Also
+    --------
+    affine_transform
+    """
+    array, order = _maybe_filter(array, order, 'interpolate.map_coordinates', prefilter, dtype=np.float64)
+    _check_mode(mode, cval, 'interpolate.map_coordinates')
+    coordinates = np.ascontiguousarray(coordinates, dtype=np.float64)
+    if coordinates.ndim < 1 or coordinates.shape[0] != array.ndim:
+        raise ValueError('mahotas.interpolate.map_coordinates: coordinates should have one row for each dimension of array')
+    out = _get_transform_output(array, out, coordinates.shape[1:], 'interpolate.map_coordinates')
+    def kernel(part, nr_parts):
+        _interpolate.map_coordinates(array, coordinates, out, order, mode2int[mode], cval, part, nr_parts)
+    _run_parts(kernel, out.size, out.size, nr_threads)
+    return out
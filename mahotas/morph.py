@@ -6,24 +6,36 @@
 from __future__ import division
 import numpy as np
 
-from .internal import _get_output, _verify_is_integer_type
+from .internal import _get_output, _normalize_sequence, _verify_is_integer_type, _get_nr_threads, _run_threads
 from . import _morph
 
 __all__ = [
+        'areaclose',
+        'areaopen',
+        'attribute_close',
+        'attribute_open',
+        'branchpoints',
         'close',
         'close_holes',
         'cwatershed',
         'cerode',
         'dilate',
+        'endpoints',
         'erode',
         'get_structuring_elem',
+        'gradient',
         'hitmiss',
+        'hmax',
+        'hmin',
         'locmax',
         'locmin',
-        'majority_filter'
+        'majority_filter',
         'open',
+        'prune',
         'regmax',
         'regmin',
+        'tophat_close',
+        'tophat_open',
         ]
 
 def get_structuring_elem(A,Bc):
@@ -92,6 +104,55 @@ def get_structuring_elem(A,Bc):
             Bc.flat[i] = 1
     return Bc
 
+def _decompose_structuring_elem(Bc):
+    '''
+    decomposition = _decompose_structuring_elem(Bc)
+
+    Checks whether erosion & dilation by `Bc` can be computed by the
+    decomposed implementation (``_morph.decomposed_erode_dilate``), namely
+    whether `Bc` is flat (all elements in its support have the same value),
+    symmetric along each axis, and every line parallel to an axis intersects
+    its support in an interval (disks, diamonds, octagons, boxes, ...).
+
+    Returns
+    -------
+    decomposition : tuple or None
+        None if `Bc` cannot be decomposed. Otherwise, ``(sizes, c, is_box)``,
+        where `c` is the value of `Bc` in its support and `sizes` are either
+        the half widths of each row of `Bc` (-1 for empty rows) for 2-D
+        elements, or the half sizes along each axis (if `is_box`, which is
+        the only case supported in other than 2 dimensions).
+    '''
+    if any((s % 2) == 0 for s in Bc.shape):
+        return None
+    if Bc.dtype == np.bool_:
+        support = Bc
+    else:
+        support = (Bc != np.iinfo(Bc.dtype).min)
+    values = Bc[support]
+    if not len(values) or np.any(values != values[0]):
+        return None
+    c = np.array([values[0]], Bc.dtype)
+    if Bc.ndim != 2:
+        if support.all():
+            return np.array(Bc.shape, np.intp)//2, c, True
+        return None
+    for axis in range(Bc.ndim):
+        flipped = support.swapaxes(0, axis)
+        if np.any(flipped != flipped[::-1]):
+            return None
+        half = flipped[len(flipped)//2:]
+        # Moving away from the centre, the support can only shrink:
+        if np.any(half[1:] & ~half[:-1]):
+            return None
+    widths = support.sum(1)//2
+    widths[~support.any(1)] = -1
+    return widths.astype(np.intp), c, False
+
+def _decomposed_erode_dilate(A, decomposition, output, is_dilate):
+    sizes, c, is_box = decomposition
+    return _morph.decomposed_erode_dilate(A, sizes, c, output, is_box, is_dilate)
+
 def dilate(A, Bc=None, out=None, output=None):
     '''
     dilated = dilate(A, Bc={3x3 cross}, out={np.empty_like(A)})
@@ -103,6 +164,11 @@ def dilate(A, Bc=None, out=None, output=None):
     greyscale dilation, the smallest value in the domain of ``Bc`` is
     interpreted as +Inf.
 
+    Structuring elements which are flat, symmetric along each axis, and convex
+    along each axis (e.g., disks, diamonds, octagons, or boxes) are decomposed
+    into lines, so that the cost grows with the height of ``Bc`` rather than
+    with its area.
+
     Parameters
     ----------
     A : ndarray of bools
@@ -123,6 +189,9 @@ def dilate(A, Bc=None, out=None, output=None):
     _verify_is_integer_type(A, 'dilate')
     Bc = get_structuring_elem(A,Bc)
     output = _get_output(A, out, 'dilate', output=output)
+    decomposition = _decompose_structuring_elem(Bc)
+    if decomposition is not None:
+        return _decomposed_erode_dilate(A, decomposition, output, True)
     return _morph.dilate(A, Bc, output)
 
 def erode(A, Bc=None, out=None, output=None):
@@ -136,6 +205,11 @@ def erode(A, Bc=None, out=None, output=None):
     greyscale erosion, the smallest value in the domain of ``Bc`` is
     interpreted as -Inf.
 
+    Structuring elements which are flat, symmetric along each axis, and convex
+    along each axis (e.g., disks, diamonds, octagons, or boxes) are decomposed
+    into lines, so that the cost grows with the height of ``Bc`` rather than
+    with its area.
+
     Parameters
     ----------
     A : ndarray
@@ -156,6 +230,9 @@ def erode(A, Bc=None, out=None, output=None):
     _verify_is_integer_type(A,'erode')
     Bc = get_structuring_elem(A,Bc)
     output = _get_output(A, out, 'erode', output=output)
+    decomposition = _decompose_structuring_elem(Bc)
+    if decomposition is not None:
+        return _decomposed_erode_dilate(A, decomposition, output, False)
     return _morph.erode(A, Bc, output)
 
 
@@ -276,6 +353,7 @@ def hitmiss(input, Bc, out=None, output=None):
     '''
     _verify_is_integer_type(input, 'hitmiss')
     _verify_is_integer_type(Bc, 'hitmiss')
+    is_binary = (input.dtype == np.bool_)
     if input.dtype != Bc.dtype:
         if input.dtype == np.bool_:
             input = input.view(np.uint8)
@@ -299,9 +377,250 @@ def hitmiss(input, Bc, out=None, output=None):
                 out = out.view(np.uint8)
             else:
                 raise TypeError('mahotas.hitmiss: out must be of same type as input')
+    if is_binary and input.ndim == 2 and Bc.shape == (3,3):
+        _morph.hitmiss_lut(input.view(np.bool_), _hitmiss_lut([Bc]), out.view(np.bool_))
+        # The generic implementation does not match at the border:
+        out[0] = 0
+        out[-1] = 0
+        out[:,0] = 0
+        out[:,-1] = 0
+        return out
     return _morph.hitmiss(input, Bc, out)
 
 
+def _hitmiss_lut(templates):
+    '''
+    lut = _hitmiss_lut(templates)
+
+    Builds a lookup table for 3x3 binary hit & miss templates
+
+    The code of a neighbourhood is ``sum(f[y+r-1, x+c-1] << (3*c + r))``
+    (this is the encoding used by ``_morph.hitmiss_lut``). An entry of `lut` is
+    True if any of the templates matches the corresponding neighbourhood.
+
+    Parameters
+    ----------
+    templates : sequence of ndarrays
+        3x3 hit & miss templates (values in (0, 1, 2), see ``hitmiss``)
+
+    Returns
+    -------
+    lut : ndarray of bool
+        512 element lookup table
+    '''
+    codes = np.arange(512)
+    lut = np.zeros(512, np.bool_)
+    for Bc in templates:
+        match = np.ones(512, np.bool_)
+        for r in range(3):
+            for c in range(3):
+                if Bc[r,c] != 2:
+                    match &= (((codes >> (3*c + r)) & 1) == Bc[r,c])
+        lut |= match
+    return lut
+
+
+def _rotations(Bc):
+    '''
+    Bcs = _rotations(Bc)
+
+    Returns the 4 rotations (by 90 degrees) of template `Bc`
+    '''
+    return [np.rot90(Bc, i) for i in range(4)]
+
+_endpoints_templates = \
+    _rotations(np.array([
+            [2, 0, 0],
+            [1, 1, 0],
+            [2, 0, 0]])) + \
+    _rotations(np.array([
+            [1, 0, 0],
+            [0, 1, 0],
+            [0, 0, 0]]))
+
+def _branchpoints_lut():
+    codes = np.arange(512)
+    # The 8-neighbours, in circular order
+    ring = [(0,0), (0,1), (0,2), (1,2), (2,2), (2,1), (2,0), (1,0)]
+    ring = [((codes >> (3*c + r)) & 1) for r,c in ring]
+    crossings = sum((ring[i-1] == 0) & (ring[i] == 1) for i in range(8))
+    centre = (codes >> 4) & 1
+    return (centre == 1) & (crossings >= 3)
+
+_endpoints_lut = _hitmiss_lut(_endpoints_templates)
+_branchpoints_lut = _branchpoints_lut()
+
+def _skeleton_lut_apply(skel, lut, out, fname):
+    skel = np.asanyarray(skel)
+    if skel.ndim != 2:
+        raise ValueError('mahotas.%s: only 2-D images are supported' % fname)
+    skel = skel.astype(np.bool_)
+    out = _get_output(skel, out, fname)
+    return _morph.hitmiss_lut(skel, lut, out)
+
+def endpoints(skel, out=None):
+    '''
+    ep = endpoints(skel, out={np.empty(skel.shape, bool)})
+
+    Find the end points of a skeleton
+
+    An end point is a positive pixel with a single neighbour (or two adjacent
+    neighbours) in its 8-neighbourhood. These are the 8 templates that are
+    used for pruning.
+
+    Parameters
+    ----------
+    skel : ndarray
+        2-D binary image (typically, the output of ``thin``)
+    out : ndarray, optional
+        Used for output. Must be Boolean ndarray of same size as `skel`
+
+    Returns
+    -------
+    ep : ndarray of bool
+        end points
+
+    See Also
+    --------
+    branchpoints : function
+    prune : function
+    '''
+    return _skeleton_lut_apply(skel, _endpoints_lut, out, 'endpoints')
+
+def branchpoints(skel, out=None):
+    '''
+    bp = branchpoints(skel, out={np.empty(skel.shape, bool)})
+
+    Find the branch points of a skeleton
+
+    A branch point is a positive pixel whose 8-neighbourhood, walked in
+    circular order, contains at least 3 separate runs of positive pixels.
+
+    Parameters
+    ----------
+    skel : ndarray
+        2-D binary image (typically, the output of ``thin``)
+    out : ndarray, optional
+        Used for output. Must be Boolean ndarray of same size as `skel`
+
+    Returns
+    -------
+    bp : ndarray of bool
+        branch points
+
+    See Also
+    --------
+    endpoints : function
+    '''
+    return _skeleton_lut_apply(skel, _branchpoints_lut, out, 'branchpoints')
+
+def prune(skel, n=1, out=None):
+    '''
+    pruned = prune(skel, n=1, out={np.empty(skel.shape, bool)})
+
+    Prune a skeleton
+
+    At each iteration, all the end points (see ``endpoints``) are removed at
+    once. This is done in place on `out`, without any temporary images.
+
+    Parameters
+    ----------
+    skel : ndarray
+        2-D binary image (typically, the output of ``thin``)
+    n : int, optional
+        Number of iterations. If ``None``, iterate until there are no more end
+        points (only closed loops will remain).
+    out : ndarray, optional
+        Used for output. Must be Boolean ndarray of same size as `skel`. It
+        can be `skel` itself.
+
+    Returns
+    -------
+    pruned : ndarray of bool
+
+    See Also
+    --------
+    endpoints : function
+    thin : function
+    '''
+    skel = np.asanyarray(skel)
+    if skel.ndim != 2:
+        raise ValueError('mahotas.prune: only 2-D images are supported')
+    out = _get_output(skel, out, 'prune', np.bool_)
+    if out is not skel:
+        out[...] = skel
+    if n is None:
+        n = -1
+    elif n < 0:
+        raise ValueError('mahotas.prune: n must be non-negative')
+    _morph.hitmiss_lut_remove(out, _endpoints_lut, n)
+    return out
+
+
+_fused_operations = {
+    'open' : 0,
+    'close' : 1,
+    'tophat_open' : 2,
+    'tophat_close' : 3,
+    'gradient' : 4,
+}
+
+def _subtract(a, b, out):
+    if out.dtype == np.bool_:
+        return np.logical_and(a, ~b, out=out)
+    return np.subtract(a, b, out=out)
+
+def _fused_morph(f, Bc, out, output, fname):
+    '''
+    y = _fused_morph(f, Bc, out, output, fname)
+
+    Computes operation `fname` (one of the keys of ``_fused_operations``)
+    without allocating any full-size temporary image (for images of up to 3
+    dimensions): either in a single pass (only a few slabs of the
+    intermediate result are kept, i.e., rows for 2-D images & planes for 3-D
+    images) or, if `Bc` can be decomposed, by decomposed erosions & dilations
+    (which work in place). The gradient needs both the erosion and the
+    dilation, so it is always computed in a single pass.
+    '''
+    _verify_is_integer_type(f, fname)
+    Bc = get_structuring_elem(f, Bc)
+    out = _get_output(f, out, fname, output=output)
+    decomposition = _decompose_structuring_elem(Bc)
+    if (decomposition is None or fname == 'gradient') and f.ndim <= 3:
+        # The single pass sweeps over the first axis, so the extra axes go
+        # after it: this way, a slab of a 2-D image is a single row
+        expand = (slice(None),) + (np.newaxis,) * (3 - f.ndim)
+        _morph.fused_morph(f[expand], Bc[expand], out[expand], _fused_operations[fname])
+        return out
+
+    if decomposition is not None:
+        def erode_(g, o):
+            return _decomposed_erode_dilate(g, decomposition, o, False)
+        def dilate_(g, o):
+            return _decomposed_erode_dilate(g, decomposition, o, True)
+    else:
+        # The fused implementation handles up to 3 dimensions
+        def erode_(g, o):
+            return _morph.erode(g, Bc, np.empty_like(g))
+        def dilate_(g, o):
+            return _morph.dilate(g, Bc, np.empty_like(g))
+    if fname == 'gradient':
+        # Only reached for images of more than 3 dimensions
+        dilated = dilate_(f, out)
+        return _subtract(dilated, erode_(f, np.empty_like(f)), out)
+    if fname in ('open', 'tophat_open'):
+        first, second = erode_, dilate_
+    else:
+        first, second = dilate_, erode_
+    filtered = second(first(f, out), out)
+    if fname == 'tophat_open':
+        return _subtract(f, filtered, out)
+    if fname == 'tophat_close':
+        return _subtract(filtered, f, out)
+    if filtered is not out:
+        out[...] = filtered
+    return out
+
 def open(f, Bc=None, out=None, output=None):
     """
     y = open(f, Bc={3x3 cross}, out={np.empty_like(f)})
@@ -331,14 +650,10 @@ def open(f, Bc=None, out=None, output=None):
 
     See Also
     --------
-    open : function
+    close : function
+    tophat_open : function
     """
-    _verify_is_integer_type(f, 'open')
-    Bc = get_structuring_elem(f, Bc)
-    eroded = erode(f, Bc, out=out)
-    # We need to copy for the simple reason that otherwise, the image will be
-    # modified in place, which can mess up the implementation
-    return dilate(eroded.copy(), Bc, out=eroded)
+    return _fused_morph(f, Bc, out, output, 'open')
 
 
 def close(f, Bc=None, out=None, output=None):
@@ -371,13 +686,104 @@ def close(f, Bc=None, out=None, output=None):
     See Also
     --------
     open : function
+    tophat_close : function
     """
-    _verify_is_integer_type(f, 'close')
-    Bc = get_structuring_elem(f, Bc)
-    dilated = dilate(f, Bc, out=out)
-    # We need to copy for the simple reason that otherwise, the image will be
-    # modified in place, which can mess up the implementation
-    return erode(dilated.copy(), Bc, out=dilated)
+    return _fused_morph(f, Bc, out, output, 'close')
+
+
+def tophat_open(f, Bc=None, out=None):
+    '''
+    y = tophat_open(f, Bc={3x3 cross}, out={np.empty_like(f)})
+
+    White top-hat transform: ``f - open(f, Bc)``
+
+    For images of up to 3 dimensions, this is computed without any full-size
+    temporary images (in a single pass, which buffers only a few rows or
+    planes, or, if `Bc` can be decomposed into lines, by in-place erosions &
+    dilations).
+
+    Parameters
+    ----------
+    f : ndarray
+        Gray-scale (integer) or binary image.
+    Bc : ndarray, optional
+        Structuring element (default: 3x3 elementary cross).
+    out : ndarray, optional
+        Output array
+
+    Returns
+    -------
+    y : ndarray
+
+    See Also
+    --------
+    open : function
+    tophat_close : function
+    '''
+    return _fused_morph(f, Bc, out, None, 'tophat_open')
+
+
+def tophat_close(f, Bc=None, out=None):
+    '''
+    y = tophat_close(f, Bc={3x3 cross}, out={np.empty_like(f)})
+
+    Black top-hat transform: ``close(f, Bc) - f``
+
+    For images of up to 3 dimensions, this is computed without any full-size
+    temporary images (in a single pass, which buffers only a few rows or
+    planes, or, if `Bc` can be decomposed into lines, by in-place erosions &
+    dilations).
+
+    Parameters
+    ----------
+    f : ndarray
+        Gray-scale (integer) or binary image.
+    Bc : ndarray, optional
+        Structuring element (default: 3x3 elementary cross).
+    out : ndarray, optional
+        Output array
+
+    Returns
+    -------
+    y : ndarray
+
+    See Also
+    --------
+    close : function
+    tophat_open : function
+    '''
+    return _fused_morph(f, Bc, out, None, 'tophat_close')
+
+
+def gradient(f, Bc=None, out=None):
+    '''
+    y = gradient(f, Bc={3x3 cross}, out={np.empty_like(f)})
+
+    Morphological gradient: ``dilate(f, Bc) - erode(f, Bc)``
+
+    For images of up to 3 dimensions, this is computed in a single pass,
+    without any full-size temporary images (only a row of the erosion of a
+    2-D image, or a plane for 3-D images, is buffered).
+
+    Parameters
+    ----------
+    f : ndarray
+        Gray-scale (integer) or binary image.
+    Bc : ndarray, optional
+        Structuring element (default: 3x3 elementary cross).
+    out : ndarray, optional
+        Output array
+
+    Returns
+    -------
+    y : ndarray
+
+    See Also
+    --------
+    dilate : function
+    erode : function
+    '''
+    return _fused_morph(f, Bc, out, None, 'gradient')
 
 
 def close_holes(ref, Bc=None):
@@ -403,23 +809,34 @@ def close_holes(ref, Bc=None):
     return _morph.close_holes(ref, Bc)
 
 
-def majority_filter(img, N=3, out=None, output=None):
+def majority_filter(img, N=3, out=None, output=None, nr_threads=None):
     '''
-    filtered = majority_filter(img, N=3, out={np.empty(img.shape, np.bool)})
+    filtered = majority_filter(img, N=3, out={np.empty(img.shape, np.bool)}, nr_threads=None)
 
     Majority filter
 
     filtered[y,x] is positive if the majority of pixels in the squared of size
     `N` centred on (y,x) are positive.
 
+    Close to the border, the window is clipped to the image and the majority
+    is taken over the pixels that lie inside it.
+
+    The implementation uses running sums, so that the cost per pixel does not
+    depend on `N`. The rows (along the first axis) are split between
+    `nr_threads` threads.
+
     Parameters
     ----------
     img : ndarray
-        input img (currently only 2-D images accepted)
-    N : int, optional
-        size of filter (must be odd integer), defaults to 3.
+        input img (any number of dimensions)
+    N : int or sequence of ints, optional
+        size of filter (must be odd integer), defaults to 3. If a sequence, it
+        gives the size along each dimension.
     out : ndarray, optional
         Used for output. Must be Boolean ndarray of same size as `img`
+    nr_threads : int, optional
+        Number of threads (default: number of CPUs for large images, one
+        otherwise)
 
     Returns
     -------
@@ -428,13 +845,256 @@ def majority_filter(img, N=3, out=None, output=None):
     '''
     img = img.astype(np.bool_)
     output = _get_output(img, out, 'majority_filter', np.bool_, output=output)
-    if N <= 1:
-        raise ValueError('mahotas.majority_filter: filter size must be positive')
-    if not N&1:
-        import warnings
-        warnings.warn('mahotas.majority_filter: size argument must be odd. Adding 1.')
-        N += 1
-    return _morph.majority_filter(img, N, output)
+    sizes = _normalize_sequence(img, N, 'majority_filter')
+    for i,n in enumerate(sizes):
+        if n <= 1:
+            raise ValueError('mahotas.majority_filter: filter size must be positive')
+        if not n&1:
+            import warnings
+            warnings.warn('mahotas.majority_filter: size argument must be odd. Adding 1.')
+            sizes[i] = n + 1
+    sizes = np.array(sizes, np.intp)
+    nr_parts = min(_get_nr_threads(nr_threads, img.size), max(1, img.shape[0]))
+    def run(part):
+        _morph.majority_filter(img, sizes, output, part, nr_parts)
+    _run_threads(run, [(p,) for p in range(nr_parts)])
+    return output
+
+
+_tree_attributes = {
+    'area' : 0,
+    'volume' : 1,
+    'height' : 2,
+    'extent' : 3,
+}
+
+def _attribute_filter(f, attribute, threshold, Bc, out, is_max, fname):
+    _verify_is_integer_type(f, fname)
+    if attribute not in _tree_attributes:
+        raise ValueError('mahotas.%s: unknown attribute `%s` (must be one of %s)' % (fname, attribute, sorted(_tree_attributes.keys())))
+    f = np.ascontiguousarray(f)
+    Bc = get_structuring_elem(f, Bc)
+    out = _get_output(f, out, fname)
+    return _morph.attribute_filter(f, Bc, out, _tree_attributes[attribute], float(threshold), is_max)
+
+def attribute_open(f, attribute, threshold, Bc=None, out=None):
+    '''
+    y = attribute_open(f, attribute, threshold, Bc={3x3 cross}, out={np.empty_like(f)})
+
+    Attribute opening
+
+    All the connected components of the upper level sets of `f` for which the
+    attribute is smaller than `threshold` are removed. This is computed on the
+    max-tree of `f` (built in quasi-linear time).
+
+    Parameters
+    ----------
+    f : ndarray
+        integer image
+    attribute : str
+        One of
+
+        'area'
+            number of pixels
+        'volume'
+            sum of ``f(x) - level + 1`` over the pixels of the component
+        'height'
+            ``max(f) - level + 1`` over the component
+        'extent'
+            largest side of the component's bounding box
+    threshold : number
+        Minimum value of the attribute
+    Bc : ndarray, optional
+        Structuring element (default: 3x3 elementary cross).
+    out : ndarray, optional
+        Output array
+
+    Returns
+    -------
+    y : ndarray
+
+    See Also
+    --------
+    areaopen : function
+    attribute_close : function
+    '''
+    return _attribute_filter(f, attribute, threshold, Bc, out, True, 'attribute_open')
+
+def attribute_close(f, attribute, threshold, Bc=None, out=None):
+    '''
+    y = attribute_close(f, attribute, threshold, Bc={3x3 cross}, out={np.empty_like(f)})
+
+    Attribute closing
+
+    This is the dual of ``attribute_open`` (computed on the min-tree): the
+    connected components of the lower level sets of `f` for which the
+    attribute is smaller than `threshold` are filled.
+
+    Parameters
+    ----------
+    f : ndarray
+        integer image
+    attribute : str
+        One of 'area', 'volume', 'height', or 'extent' (see ``attribute_open``)
+    threshold : number
+        Minimum value of the attribute
+    Bc : ndarray, optional
+        Structuring element (default: 3x3 elementary cross).
+    out : ndarray, optional
+        Output array
+
+    Returns
+    -------
+    y : ndarray
+
+    See Also
+    --------
+    areaclose : function
+    attribute_open : function
+    '''
+    return _attribute_filter(f, attribute, threshold, Bc, out, False, 'attribute_close')
+
+def areaopen(f, areasize, Bc=None, out=None):
+    '''
+    y = areaopen(f, areasize, Bc={3x3 cross}, out={np.empty_like(f)})
+
+    Area opening
+
+    Removes the bright connected components with fewer than `areasize`
+    pixels (at all levels).
+
+    Parameters
+    ----------
+    f : ndarray
+        integer image
+    areasize : int
+        Minimum area
+    Bc : ndarray, optional
+        Structuring element (default: 3x3 elementary cross).
+    out : ndarray, optional
+        Output array
+
+    Returns
+    -------
+    y : ndarray
+
+    See Also
+    --------
+    areaclose : function
+    attribute_open : function
+    '''
+    return _attribute_filter(f, 'area', areasize, Bc, out, True, 'areaopen')
+
+def areaclose(f, areasize, Bc=None, out=None):
+    '''
+    y = areaclose(f, areasize, Bc={3x3 cross}, out={np.empty_like(f)})
+
+    Area closing
+
+    Fills the dark connected components with fewer than `areasize` pixels
+    (at all levels).
+
+    Parameters
+    ----------
+    f : ndarray
+        integer image
+    areasize : int
+        Minimum area
+    Bc : ndarray, optional
+        Structuring element (default: 3x3 elementary cross).
+    out : ndarray, optional
+        Output array
+
+    Returns
+    -------
+    y : ndarray
+
+    See Also
+    --------
+    areaopen : function
+    attribute_close : function
+    '''
+    return _attribute_filter(f, 'area', areasize, Bc, out, False, 'areaclose')
+
+def _hextrema(f, h, Bc, out, is_max, fname):
+    _verify_is_integer_type(f, fname)
+    if h < 0:
+        raise ValueError('mahotas.%s: h must be non-negative' % fname)
+    f = np.ascontiguousarray(f)
+    Bc = get_structuring_elem(f, Bc)
+    out = _get_output(f, out, fname)
+    if f.dtype == np.bool_:
+        h = min(h, 1)
+    else:
+        h = min(h, np.iinfo(f.dtype).max)
+    h = np.array(h, f.dtype)
+    return _morph.hextrema(f, Bc, out, h, is_max)
+
+def hmax(f, h, Bc=None, out=None):
+    '''
+    y = hmax(f, h, Bc={3x3 cross}, out={np.empty_like(f)})
+
+    h-maxima transform
+
+    Suppresses all the regional maxima whose height (dynamic) is not larger
+    than `h`. This is the reconstruction by dilation of ``f - h`` under `f`,
+    but it is computed directly on the max-tree of `f`.
+
+    The extended maxima are ``regmax(hmax(f, h))``.
+
+    Parameters
+    ----------
+    f : ndarray
+        integer image
+    h : int
+        height (non-negative)
+    Bc : ndarray, optional
+        Structuring element (default: 3x3 elementary cross).
+    out : ndarray, optional
+        Output array
+
+    Returns
+    -------
+    y : ndarray
+
+    See Also
+    --------
+    hmin : function
+    regmax : function
+    '''
+    return _hextrema(f, h, Bc, out, True, 'hmax')
+
+def hmin(f, h, Bc=None, out=None):
+    '''
+    y = hmin(f, h, Bc={3x3 cross}, out={np.empty_like(f)})
+
+    h-minima transform
+
+    Suppresses all the regional minima whose depth is not larger than `h`.
+    This is the reconstruction by erosion of ``f + h`` over `f`, computed on
+    the min-tree of `f`.
+
+    Parameters
+    ----------
+    f : ndarray
+        integer image
+    h : int
+        depth (non-negative)
+    Bc : ndarray, optional
+        Structuring element (default: 3x3 elementary cross).
+    out : ndarray, optional
+        Output array
+
+    Returns
+    -------
+    y : ndarray
+
+    See Also
+    --------
+    hmax : function
+    regmin : function
+    '''
+    return _hextrema(f, h, Bc, out, False, 'hmin')
 
 
 def _remove_centre(Bc):
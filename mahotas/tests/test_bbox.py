@@ -1,6 +1,7 @@
 import numpy as np
 import mahotas
 from mahotas import bbox
+from mahotas.bbox import labeled_bbox
 from nose.tools import raises
 
 def test_croptobbox():
@@ -65,3 +66,19 @@ def test_bbox():
     assert a1 == 2
     assert b1 == 9
 
+
+def test_labeled_bbox():
+    np.random.seed(33)
+    labeled = (np.random.rand(32, 48) * 6).astype(np.intc)
+    labeled[labeled == 4] = 0
+    bboxes = labeled_bbox(labeled)
+    assert bboxes.shape == (6, 4)
+    for i in range(6):
+        assert np.all(bboxes[i] == mahotas.bbox(labeled == i))
+    assert np.all(bboxes[4] == 0)
+
+    labeled = np.zeros((5, 6, 7), np.uint8)
+    labeled[1:3, 2, 3:5] = 2
+    bboxes = labeled_bbox(labeled)
+    assert np.all(bboxes[2] == [1,3,2,3,3,5])
+    assert np.all(bboxes[1] == 0)
@@ -40,3 +40,83 @@ def test_euler7():
     f = f.reshape((10,10))
     euler(f, 7)
 
+
+def test_euler_border():
+    f = np.ones((4,4), np.bool_)
+    assert euler(f) == 1
+    assert euler(f, 4) == 1
+    f = np.zeros((6,6), np.bool_)
+    f[3:,3:] = 1
+    assert euler(f) == 1
+    f[4,4] = 0
+    assert euler(f) == 0
+
+def test_euler_diagonal():
+    f = np.zeros((8,8), np.bool_)
+    f[2,2] = 1
+    f[3,3] = 1
+    assert euler(f) == 1
+    assert euler(f, 4) == 2
+
+def test_euler_3d():
+    f = np.zeros((8,8,8), np.bool_)
+    f[2,2,2] = 1
+    assert euler(f) == 1
+    assert euler(f, 6) == 1
+    f[3,3,2] = 1
+    assert euler(f) == 1
+    assert euler(f, 6) == 2
+
+    f = np.zeros((8,8,8), np.bool_)
+    f[1:6,1:6,1:6] = 1
+    assert euler(f) == 1
+    # A hollow cube (cavity): 1 component + 1 cavity
+    f[2:5,2:5,2:5] = 0
+    assert euler(f) == 2
+    assert euler(f, 6) == 2
+
+    # A torus (ring)
+    f = np.zeros((8,8,8), np.bool_)
+    f[3, 1:6, 1:6] = 1
+    f[3, 2:5, 2:5] = 0
+    assert euler(f) == 0
+    assert euler(f, 6) == 0
+
+def test_labeled_euler():
+    from mahotas.euler import labeled_euler
+    labeled = np.zeros((32,32), np.int32)
+    labeled[2:10,2:10] = 1
+    labeled[4:6,4:6] = 0
+    labeled[10:20,4:12] = 2
+    labeled[24:30,20:30] = 3
+    labeled[26,22] = 0
+    labeled[27,26] = 0
+    ls = labeled_euler(labeled)
+    assert len(ls) == 4
+    assert ls[0] == 0
+    for i in (1,2,3):
+        assert ls[i] == euler(labeled == i)
+
+def test_bitquad_measures():
+    from mahotas.euler import bitquad_measures
+    f = np.zeros((16,16), np.bool_)
+    f[4:8,4:10] = 1
+    e, area, perimeter = bitquad_measures(f)
+    assert e == 1
+    assert area == f.sum()
+    assert perimeter == 2*(4+6)
+
+    labeled = f.astype(np.int32)
+    labeled[10:12,2:5] = 2
+    e, area, perimeter = bitquad_measures(labeled, labeled=True)
+    assert np.all(e == [0,1,1])
+    assert np.all(area == [0, 24, 6])
+    assert np.all(perimeter == [0, 20, 10])
+
+    _, area, perimeter = bitquad_measures(f, method='duda')
+    assert area == f.sum()
+    assert perimeter < 20
+
+@raises(ValueError)
+def test_euler_3d_bad_connectivity():
+    euler(np.zeros((4,4,4), np.bool_), 8)
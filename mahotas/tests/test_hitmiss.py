@@ -54,3 +54,60 @@ def test_hitmiss_types():
     Bc = np.array([[1, 1, 2],[1,1,2],[0,0,0]], dtype=np.int64)
     assert np.sum(mahotas.morph.hitmiss(f,Bc))
 
+
+def test_hitmiss_lut_against_slow():
+    np.random.seed(223)
+    for i in range(8):
+        A = np.random.rand(64,48) > .4
+        Bc = np.random.randint(0, 3, size=(3,3))
+        W = mahotas.morph.hitmiss(A, Bc)
+        assert np.all(W == slow_hitmiss(A, Bc))
+        assert np.all(W == mahotas.morph.hitmiss(A.astype(np.uint8), Bc))
+
+
+def test_hitmiss_lut_strided():
+    np.random.seed(224)
+    A = np.random.rand(64,96) > .4
+    Bc = np.array([
+        [0,1,2],
+        [0,1,1],
+        [2,1,1]])
+    W = mahotas.morph.hitmiss(A[::2,::3], Bc)
+    assert np.all(W == slow_hitmiss(A[::2,::3], Bc))
+
+
+def test_endpoints():
+    A = np.zeros((16,16), bool)
+    A[4,4:12] = 1
+    A[4:10,8] = 1
+    ep = mahotas.morph.endpoints(A)
+    assert ep.sum() == 3
+    assert ep[4,4]
+    assert ep[4,11]
+    assert ep[9,8]
+    bp = mahotas.morph.branchpoints(A)
+    assert bp.sum() == 1
+    assert bp[4,8]
+
+
+def test_prune():
+    A = np.zeros((16,16), bool)
+    A[4,4:12] = 1
+    A[4:10,8] = 1
+    pruned = mahotas.morph.prune(A, 2)
+    assert pruned.sum() == A.sum() - 6
+    assert not pruned[4,4:6].any()
+    assert pruned[4,6]
+
+    assert not mahotas.morph.prune(A, None).any()
+
+    loop = np.zeros((16,16), bool)
+    loop[4,4:9] = 1
+    loop[8,4:9] = 1
+    loop[4:9,4] = 1
+    loop[4:9,8] = 1
+    assert np.all(mahotas.morph.prune(loop, None) == loop)
+
+    B = A.copy()
+    mahotas.morph.prune(B, 1, out=B)
+    assert np.all(B == mahotas.morph.prune(A, 1))
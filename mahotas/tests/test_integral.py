@@ -0,0 +1,78 @@
+import numpy as np
+import mahotas
+from mahotas.integral import integral
+from nose.tools import raises
+
+def _slow_integral(f):
+    fi = f.astype(np.float64)
+    for axis in range(f.ndim):
+        fi = fi.cumsum(axis)
+    return fi
+
+def test_integral_2d():
+    np.random.seed(22)
+    f = np.random.randint(0, 256, size=(37,45)).astype(np.uint8)
+    fi = integral(f)
+    assert fi.dtype == np.uint64
+    assert fi.shape == f.shape
+    assert np.all(fi == _slow_integral(f))
+    assert np.all(mahotas.integral(f) == fi)
+
+def test_integral_3d():
+    np.random.seed(23)
+    f = np.random.rand(7,11,13)
+    assert np.allclose(integral(f), _slow_integral(f))
+
+def test_integral_signed():
+    np.random.seed(24)
+    f = np.random.randint(-100, 100, size=(20,20)).astype(np.int16)
+    fi = integral(f)
+    assert fi.dtype == np.int64
+    assert np.all(fi == _slow_integral(f))
+
+def test_integral_dtypes():
+    np.random.seed(25)
+    f = np.random.randint(0, 256, size=(16,19)).astype(np.uint8)
+    for dtype in (np.uint32, np.uint64, np.int64, np.float32, np.float64):
+        fi = integral(f, dtype)
+        assert fi.dtype == dtype
+        assert np.all(fi == _slow_integral(f))
+
+def test_integral_squared():
+    np.random.seed(26)
+    f = np.random.randint(0, 256, size=(12,10,14)).astype(np.uint16)
+    fi, fi2 = integral(f, squared=True)
+    assert np.all(fi == _slow_integral(f))
+    assert np.all(fi2 == _slow_integral(f.astype(np.uint64)**2))
+
+def test_integral_threads():
+    np.random.seed(27)
+    f = np.random.rand(40,33)
+    single = integral(f, nr_threads=1)
+    for nr_threads in (2, 3, 64):
+        assert np.all(integral(f, nr_threads=nr_threads) == single)
+    f3 = np.random.randint(0, 100, size=(5,6,7))
+    assert np.all(integral(f3, nr_threads=4) == integral(f3, nr_threads=1))
+
+def test_integral_out():
+    np.random.seed(28)
+    f = np.random.rand(20,30)
+    expected = _slow_integral(f)
+    out = np.empty_like(f)
+    assert integral(f, out=out) is out
+    assert np.allclose(out, expected)
+    # in place, and non-contiguous
+    g = np.asfortranarray(f)
+    integral(g, out=g)
+    assert np.allclose(g, expected)
+
+def test_integral_empty():
+    assert integral(np.zeros((0,4))).shape == (0,4)
+
+@raises(ValueError)
+def test_integral_1d():
+    integral(np.arange(4))
+
+@raises(ValueError)
+def test_integral_bad_dtype():
+    integral(np.arange(16).reshape((4,4)), np.uint8)
@@ -1,5 +1,5 @@
 import numpy as np
-from mahotas.internal import _get_output, _get_axis
+from mahotas.internal import _get_output, _get_axis, _run_threads
 from mahotas.internal import _normalize_sequence, _verify_is_integer_type, _verify_is_floatingpoint_type, _as_floating_point_array
 from nose.tools import raises
 
@@ -132,3 +132,29 @@ def test_as_floating_point_array():
     yield check_arr, [[1,2],[2,3],[3,4]]
     yield check_arr, [[1.,2.],[2.,3.],[3.,4.]]
 
+
+def test_run_threads():
+    out = np.zeros(5)
+    def fill(i, v):
+        out[i] = v
+    _run_threads(fill, [(i, i + 1.) for i in range(5)])
+    assert np.all(out == np.arange(1, 6))
+
+def test_run_threads_errors():
+    def fail(i):
+        if i == 2:
+            raise MemoryError('thread %s' % i)
+    for args in ([(2,)], [(0,), (1,), (2,)]):
+        try:
+            _run_threads(fail, args)
+        except MemoryError:
+            pass
+        else:
+            assert False, 'MemoryError was not re-raised'
+
+def test_get_nr_threads():
+    from mahotas.internal import _get_nr_threads
+    assert _get_nr_threads(None, 64*64) == 1
+    assert _get_nr_threads(3, 64*64) == 3
+    assert _get_nr_threads(0, 64*64) == 1
+    assert _get_nr_threads(None, 1 << 30) >= 1
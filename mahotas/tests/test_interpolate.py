@@ -55,3 +55,154 @@ def test_complex():
     yield call_f, interpolate.spline_filter1d, f, 3
     yield call_f, interpolate.spline_filter, f, 3
 
+
+def test_shift_border_constant():
+    f = np.arange(20.).reshape((4,5)) + 1
+    output = interpolate.shift(f, (1,0), order=1)
+    assert np.all(output[0] == 0)
+    assert np.all(output[1:] == f[:-1])
+
+def test_shift_scipy():
+    from scipy import ndimage
+    np.random.seed(31)
+    f = np.random.rand(20,23)
+    for order in (1,2,3,4):
+        for mode in ('mirror', 'constant', 'wrap'):
+            output = interpolate.shift(f, (1.3,-2.6), order=order, mode=mode)
+            expected = ndimage.shift(f, (1.3,-2.6), order=order, mode=mode)
+            assert np.allclose(output, expected, atol=1e-6)
+
+def test_zoom_scipy():
+    from scipy import ndimage
+    np.random.seed(32)
+    f = np.random.rand(20,23)
+    for order in (1,3):
+        output = interpolate.zoom(f, 1.7, order=order, mode='mirror')
+        expected = ndimage.zoom(f, 1.7, order=order, mode='mirror')
+        assert np.allclose(output, expected, atol=1e-6)
+
+def test_zoom_3d():
+    from scipy import ndimage
+    np.random.seed(33)
+    f = np.random.rand(6,7,8)
+    output = interpolate.zoom(f, (1.5,2.,.5), order=3, mode='mirror')
+    expected = ndimage.zoom(f, (1.5,2.,.5), order=3, mode='mirror')
+    assert output.shape == expected.shape
+    assert np.allclose(output, expected, atol=1e-6)
+
+def test_shift_interpolates():
+    f = np.arange(20.).reshape((4,5))
+    output = interpolate.shift(f, (0,.5), order=1, mode='nearest')
+    assert np.allclose(output[:,1:], f[:,:-1] + .5)
+
+def test_shift_scalar():
+    f = np.arange(20.).reshape((4,5)) + 1
+    assert np.all(interpolate.shift(f, 1, order=1) == interpolate.shift(f, (1,1), order=1))
+
+def test_shift_types():
+    f = (np.arange(20).reshape((4,5)) + 1).astype(np.uint8)
+    expected = interpolate.shift(f.astype(np.float64), (1,0), order=1)
+    assert np.all(interpolate.shift(f, (1,0), order=1) == expected)
+    shifted = interpolate.shift(f.astype(np.float32), (1,0), order=1)
+    assert shifted.dtype == np.float64
+    assert np.allclose(shifted, expected)
+
+def test_affine_transform_scipy():
+    from scipy import ndimage
+    np.random.seed(34)
+    f = np.random.rand(30,33)
+    theta = .3
+    matrix = np.array([
+        [np.cos(theta), -np.sin(theta)],
+        [np.sin(theta),  np.cos(theta)]])
+    for order in (1,2,3,4):
+        for mode in ('mirror', 'constant', 'wrap'):
+            output = interpolate.affine_transform(f, matrix, (3.,-2.), order=order, mode=mode)
+            expected = ndimage.affine_transform(f, matrix, (3.,-2.), order=order, mode=mode)
+            assert np.allclose(output, expected, atol=1e-6)
+    output = interpolate.affine_transform(f, matrix, (3.,-2.), output_shape=(20,50))
+    expected = ndimage.affine_transform(f, matrix, (3.,-2.), output_shape=(20,50))
+    assert np.allclose(output, expected, atol=1e-6)
+
+def test_affine_transform_homogeneous():
+    np.random.seed(35)
+    f = np.random.rand(12,14)
+    matrix = np.array([[.9, .2], [-.1, 1.1]])
+    homogeneous = np.eye(3)
+    homogeneous[:2,:2] = matrix
+    homogeneous[:2,2] = (1.5, -.5)
+    assert np.allclose(
+            interpolate.affine_transform(f, homogeneous),
+            interpolate.affine_transform(f, matrix, (1.5, -.5)))
+
+def test_affine_transform_identity():
+    f = np.arange(60.).reshape((3,4,5))
+    assert np.allclose(interpolate.affine_transform(f, [1,1,1], order=1), f)
+
+def test_affine_transform_threads():
+    np.random.seed(36)
+    f = np.random.rand(40,37)
+    matrix = np.array([[.9, .2], [-.1, 1.1]])
+    single = interpolate.affine_transform(f, matrix, 2., nr_threads=1)
+    assert np.all(interpolate.affine_transform(f, matrix, 2., nr_threads=4) == single)
+
+def test_affine_transform_prefiltered():
+    np.random.seed(37)
+    f = np.random.rand(20,20)
+    matrix = np.array([[.9, .2], [-.1, 1.1]])
+    coefficients = interpolate.spline_filter(f)
+    assert np.allclose(
+            interpolate.affine_transform(coefficients, matrix, prefilter=False),
+            interpolate.affine_transform(f, matrix))
+
+def test_map_coordinates_scipy():
+    from scipy import ndimage
+    np.random.seed(38)
+    f = np.random.rand(30,33)
+    coordinates = np.random.rand(2,7,9)*35 - 2
+    for order in (1,3):
+        output = interpolate.map_coordinates(f, coordinates, order=order, mode='mirror', nr_threads=3)
+        expected = ndimage.map_coordinates(f, coordinates, order=order, mode='mirror')
+        assert output.shape == (7,9)
+        assert np.allclose(output, expected, atol=1e-6)
+
+def test_map_coordinates_3d():
+    np.random.seed(39)
+    f = np.random.rand(8,9,10)
+    coordinates = np.indices(f.shape).reshape((3,-1))
+    assert np.allclose(interpolate.map_coordinates(f, coordinates).reshape(f.shape), f)
+
+@raises(ValueError)
+def test_map_coordinates_wrong_rank():
+    interpolate.map_coordinates(np.zeros((4,4)), np.zeros((3,10)))
+
+def test_prepared_spline():
+    np.random.seed(40)
+    f = np.random.rand(20,23)
+    matrix = np.array([[.9, .2], [-.1, 1.1]])
+    coordinates = np.random.rand(2,30)*20
+    for order in (1,3):
+        spline = interpolate.PreparedSpline(f, order)
+        assert spline.shape == f.shape
+        assert spline.ndim == 2
+        assert np.allclose(interpolate.shift(spline, (.4,1.2)), interpolate.shift(f, (.4,1.2), order=order))
+        assert np.allclose(interpolate.zoom(spline, 1.6), interpolate.zoom(f, 1.6, order=order))
+        assert np.allclose(interpolate.affine_transform(spline, matrix), interpolate.affine_transform(f, matrix, order=order))
+        assert np.allclose(interpolate.map_coordinates(spline, coordinates), interpolate.map_coordinates(f, coordinates, order=order))
+
+def test_prepared_spline_not_refiltered():
+    f = np.zeros((16,16))
+    f[8,8] = 1
+    spline = interpolate.PreparedSpline(f)
+    shifted = interpolate.shift(spline, (0,0))
+    assert np.allclose(shifted, interpolate.shift(f, (0,0)))
+    assert not np.allclose(shifted, interpolate.shift(spline.coefficients, (0,0)))
+
+def test_prepared_spline_float32():
+    f = np.arange(64.).reshape((8,8))
+    spline = interpolate.PreparedSpline(f, dtype=np.float32)
+    assert interpolate.shift(spline, (.5,0)).dtype == np.float32
+
+@raises(ValueError)
+def test_prepared_spline_order():
+    interpolate.shift(interpolate.PreparedSpline(np.zeros((8,8)), 3), (1,1), order=2)
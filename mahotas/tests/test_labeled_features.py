@@ -0,0 +1,79 @@
+import numpy as np
+import mahotas
+from mahotas.features import labeled_features, haralick, lbp_transform, zernike_moments, pftas
+from mahotas.center_of_mass import center_of_mass
+from nose.tools import raises
+
+def _labeled_image():
+    np.random.seed(34)
+    image = (np.random.rand(64, 80) * 40).astype(np.uint8)
+    regions = np.zeros((64, 80), np.intc)
+    regions[4:20, 6:30] = 1
+    regions[10:40, 40:70] = 2
+    regions[25:60, 5:35] = 3
+    regions[45:62, 50:78] = 5
+    # 4 is empty & region 3 touches region 1
+    regions[22:26, 10:20] = 3
+    return image, regions
+
+def _crop(image, labeled, i):
+    min0,max0,min1,max1 = mahotas.bbox(labeled == i)
+    return image[min0:max0, min1:max1] * (labeled[min0:max0, min1:max1] == i)
+
+def _region_lbp(image, labeled, i, radius, points):
+    min0,max0,min1,max1 = mahotas.bbox(labeled == i)
+    codes = lbp_transform(_crop(image, labeled, i), radius, points, mode='ri')
+    region = (labeled[min0:max0, min1:max1] == i)
+    nr_bins = len(mahotas.features.lbp(image[:4,:4], radius, points))
+    return np.bincount(codes[region], minlength=nr_bins)
+
+def test_labeled_features():
+    image, labeled = _labeled_image()
+    for nr_threads in (1, 2, 5):
+        features = labeled_features(image, labeled,
+                        haralick=True,
+                        lbp=(2, 6),
+                        zernike=(12, 6),
+                        pftas=True,
+                        nr_threads=nr_threads)
+        assert features.shape[0] == 6
+        assert np.all(features[0] == 0)
+        assert np.all(features[4] == 0)
+        for i in (1, 2, 3, 5):
+            crop = _crop(image, labeled, i)
+            expected = np.concatenate([
+                        haralick(crop).mean(0),
+                        _region_lbp(image, labeled, i, 2, 6),
+                        zernike_moments(crop, 12, 6),
+                        pftas(crop)])
+            assert features[i].shape == expected.shape
+            assert np.allclose(features[i], expected)
+
+def test_labeled_features_select():
+    image, labeled = _labeled_image()
+    features = labeled_features(image, labeled, haralick=False, zernike=(8, 4))
+    assert features.shape == (6, len(zernike_moments(image, 8, 4)))
+    features = labeled_features(image, labeled, haralick=False)
+    assert features.shape == (6, 0)
+
+def test_labeled_features_16bit():
+    image, labeled = _labeled_image()
+    image = image.astype(np.uint16) * 1500
+    features = labeled_features(image, labeled, pftas=True)
+    for i in (1, 2):
+        crop = _crop(image, labeled, i)
+        assert np.allclose(features[i], np.concatenate([haralick(crop).mean(0), pftas(crop)]))
+
+def test_labeled_features_no_objects():
+    image = np.zeros((16, 16), np.uint8)
+    features = labeled_features(image, np.zeros((16, 16), np.intc), pftas=True)
+    assert features.shape == (1, 13 + 54)
+    assert np.all(features == 0)
+
+@raises(ValueError)
+def test_labeled_features_shape():
+    labeled_features(np.zeros((16, 16), np.uint8), np.zeros((16, 17), np.intc))
+
+@raises(TypeError)
+def test_labeled_features_pftas_float():
+    labeled_features(np.zeros((16, 16), np.float64), np.zeros((16, 16), np.intc), haralick=False, pftas=True)
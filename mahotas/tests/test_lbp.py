@@ -1,6 +1,7 @@
 import numpy as np
 from mahotas.features import _lbp
 import mahotas.thresholding
+from nose.tools import raises
 from mahotas.features import lbp
 
 def test_shape():
@@ -38,3 +39,118 @@ def test_positives():
     lbps = lbp(f, 4, 8)
     assert len(np.where(lbps == 0)[0]) < 2
     assert lbps.sum() == f.size
+
+def _slow_codes(f, radius, points):
+    f = f.astype(np.float64)
+    h,w = f.shape
+    codes = np.zeros(f.shape, np.uint32)
+    for p in range(points):
+        angle = 2*np.pi*p/points
+        dy = -radius*np.sin(angle)
+        dx = -radius*np.cos(angle)
+        for y in range(h):
+            for x in range(w):
+                py = y + dy
+                px = x + dx
+                y0 = int(np.floor(py + 1e-9))
+                x0 = int(np.floor(px + 1e-9))
+                fy = max(py - y0, 0)
+                fx = max(px - x0, 0)
+                value = 0.
+                for yy,wy in ((y0, 1-fy), (y0+1, fy)):
+                    for xx,wx in ((x0, 1-fx), (x0+1, fx)):
+                        if wy*wx > 1e-9 and 0 <= yy < h and 0 <= xx < w:
+                            value += wy*wx*f[yy,xx]
+                if value > f[y,x] + 1e-9:
+                    codes[y,x] |= (1 << p)
+    return codes
+
+def test_codes_bilinear():
+    from mahotas.features.lbp import _lbp_codes
+    np.random.seed(36)
+    f = (np.random.random_sample((24,20))*64).astype(np.uint8)
+    for radius,points in [(1,4), (1,8), (2.5,8), (3,12)]:
+        assert np.all(_lbp_codes(f, radius, points, False) == _slow_codes(f, radius, points))
+
+def test_ignore_zeros_histogram():
+    np.random.seed(37)
+    f = (np.random.random_sample((32,32))*4).astype(np.uint8)
+    assert lbp(f, 2, 8, ignore_zeros=True).sum() == np.sum(f != 0)
+
+def test_multi_radius():
+    np.random.seed(38)
+    f = np.random.random_sample((32,32))
+    features = lbp(f, [1,2,3], [8,8,12])
+    assert np.all(features == np.concatenate([lbp(f,1,8), lbp(f,2,8), lbp(f,3,12)]))
+    assert np.all(lbp(f, [1,2], 8) == np.concatenate([lbp(f,1,8), lbp(f,2,8)]))
+
+def test_3d():
+    np.random.seed(39)
+    f = np.random.random_sample((8,16,16))
+    features = lbp(f, 2, 8)
+    assert features.shape == lbp(f[0], 2, 8).shape
+    assert features.sum() == f.size
+
+def test_mapping_cached():
+    from mahotas.features.lbp import _mapping
+    table, nr_bins = _mapping(8, 'ri')
+    assert _mapping(8, 'ri')[0] is table
+    assert nr_bins == 36
+    codes = np.arange(256, dtype=np.uint32)
+    mapped = _lbp.map(codes.copy(), 8)
+    assert np.all((table[:,np.newaxis] == table) == (mapped[:,np.newaxis] == mapped))
+
+def test_riu2():
+    np.random.seed(40)
+    f = np.random.random_sample((32,32))
+    for points in (4, 8, 12):
+        features = lbp(f, 2, points, mode='riu2')
+        assert features.shape == (points + 2,)
+        assert features.sum() == f.size
+    # constant image: all codes are 0 (uniform, no ones)
+    features = lbp(np.ones((16,16)), 1, 8, mode='riu2')
+    assert features[0] == 16*16
+    assert features[-1] == 0
+
+@raises(ValueError)
+def test_bad_mode():
+    lbp(np.ones((16,16)), 1, 8, mode='nonsense')
+
+def test_lbp_transform():
+    from mahotas.features import lbp_transform
+    np.random.seed(41)
+    f = np.random.random_sample((32,32))
+    codes = lbp_transform(f, 2, 8)
+    assert codes.shape == f.shape
+    assert codes.dtype == np.uint32
+    assert np.all(codes == _slow_codes(f, 2, 8))
+    bins = lbp_transform(f, 2, 8, mode='riu2')
+    assert np.all(np.bincount(bins.ravel(), minlength=10) == lbp(f, 2, 8, mode='riu2'))
+
+def test_labeled_lbp():
+    from mahotas.features import labeled_lbp, lbp_transform
+    np.random.seed(42)
+    f = (np.random.random_sample((40,40))*32).astype(np.uint8)
+    labeled = np.zeros(f.shape, np.intc)
+    labeled[2:20,3:15] = 1
+    labeled[10:30,20:35] = 3
+    labeled[32:,:] = 2
+    for mode in ('ri', 'riu2'):
+        histograms, codes = labeled_lbp(f, labeled, 2, 8, mode=mode, return_codes=True)
+        assert np.all(codes == lbp_transform(f, 2, 8))
+        bins = lbp_transform(f, 2, 8, mode=mode)
+        assert histograms.shape == (4, len(lbp(f, 2, 8, mode=mode)))
+        assert np.all(histograms[0] == 0)
+        for i in (1,2,3):
+            assert np.all(histograms[i] == np.bincount(bins[labeled == i], minlength=histograms.shape[1]))
+    isolated = labeled_lbp(f, labeled, 2, 8, isolate=True)
+    for i in (1,2,3):
+        expected = np.bincount(lbp_transform(f * (labeled == i), 2, 8, mode='ri')[labeled == i], minlength=isolated.shape[1])
+        assert np.all(isolated[i] == expected)
+
+@raises(ValueError)
+def test_labeled_lbp_negative():
+    from mahotas.features import labeled_lbp
+    labeled = np.zeros((16,16), np.intc)
+    labeled[3,3] = -1
+    labeled_lbp(np.ones((16,16)), labeled, 1, 8)
@@ -7,19 +7,19 @@ def slow_majority(img, N):
     img = (img > 0)
     r,c = img.shape
     output = np.zeros_like(img)
-    for y in range(r-N):
-        for x in range(c-N):
-            count = 0
-            for dy in range(N):
-                for dx in range(N):
-                    count += img[y+dy, x+dx]
-            if count >= (N*N)//2:
-                output[y+dy//2,x+dx//2] = 1
+    for y in range(r):
+        for x in range(c):
+            window = img[max(y-N//2,0):y+N//2+1, max(x-N//2,0):x+N//2+1]
+            if window.sum() >= window.size//2:
+                output[y,x] = 1
     return output
 
 def compare_w_slow(R):
     for N in (3,5,7):
-        assert np.all(mahotas.morph.majority_filter(R, N) == slow_majority(R, N))
+        expected = slow_majority(R, N)
+        assert np.all(mahotas.morph.majority_filter(R, N) == expected)
+        for nr_threads in (2, 5, 64):
+            assert np.all(mahotas.morph.majority_filter(R, N, nr_threads=nr_threads) == expected)
 
 def test_majority():
 
@@ -36,6 +36,31 @@ def test_majority():
     R = np.random.rand(64, 64) > .68
     yield compare_w_slow, R[:23,:]
 
+    R = np.random.rand(64, 64) > .68
+    yield compare_w_slow, R[::2,::3]
+
+    R = np.random.rand(4, 5) > .5
+    yield compare_w_slow, R
+
+
+def test_interior():
+    np.random.seed(23)
+    R = np.random.rand(48, 40) > .5
+    N = 7
+    count = ndimage.uniform_filter(R.astype(np.float64), N, mode='constant')*N*N
+    expected = (np.round(count) >= (N*N)//2)
+    filtered = mahotas.morph.majority_filter(R, N)
+    assert np.all(filtered[N//2:-(N//2), N//2:-(N//2)] == expected[N//2:-(N//2), N//2:-(N//2)])
+
+
+def test_3d():
+    np.random.seed(24)
+    R = np.random.rand(12, 14, 16) > .6
+    filtered = mahotas.morph.majority_filter(R, (3,5,3))
+    for z,y,x in np.indices(R.shape).reshape((3,-1)).T:
+        window = R[max(z-1,0):z+2, max(y-2,0):y+3, max(x-1,0):x+2]
+        assert filtered[z,y,x] == (window.sum() >= window.size//2)
+
 
 @raises(ValueError)
 def test_N0():
@@ -47,3 +72,9 @@ def test_not_bool():
     R = np.random.rand(64, 64) > .68
     yield compare_w_slow, R*24.
 
+def test_3d_threads():
+    np.random.seed(25)
+    R = np.random.rand(13, 9, 11) > .5
+    expected = mahotas.morph.majority_filter(R, (5,3,7), nr_threads=1)
+    for nr_threads in (2, 3, 7, 20):
+        assert np.all(mahotas.morph.majority_filter(R, (5,3,7), nr_threads=nr_threads) == expected)
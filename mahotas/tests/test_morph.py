@@ -30,6 +30,115 @@ def test_close():
     A = np.random.random_sample((16,16)) > .345
     assert close(A).shape == (16,16)
 
+def _compare_fused(f, Bc):
+    from mahotas.morph import open, close, tophat_open, tophat_close, gradient, erode, dilate
+    opened = dilate(erode(f, Bc), Bc)
+    closed = erode(dilate(f, Bc), Bc)
+    assert np.all(open(f, Bc) == opened)
+    assert np.all(close(f, Bc) == closed)
+    if f.dtype == np.bool_:
+        assert np.all(tophat_open(f, Bc) == (f & ~opened))
+        assert np.all(tophat_close(f, Bc) == (closed & ~f))
+        assert np.all(gradient(f, Bc) == (dilate(f, Bc) & ~erode(f, Bc)))
+    else:
+        assert np.all(tophat_open(f, Bc) == f - opened)
+        assert np.all(tophat_close(f, Bc) == closed - f)
+        assert np.all(gradient(f, Bc) == dilate(f, Bc) - erode(f, Bc))
+
+def test_fused():
+    np.random.seed(124)
+    for dtype in (np.bool_, np.uint8, np.int16, np.uint32):
+        f = (np.random.random_sample((33,27))*200).astype(dtype)
+        if dtype == np.bool_:
+            f = np.random.random_sample((33,27)) > .4
+        for Bc in (None, 8, np.ones((5,5)), np.array([[0,1,1,0],[1,1,0,0],[0,0,1,0]]), np.array([[1,1,1]])):
+            if Bc is not None and type(Bc) != int:
+                Bc = Bc.astype(dtype)
+            yield _compare_fused, f, Bc
+        yield _compare_fused, f[::2, 3:], None
+        yield _compare_fused, f[:1], None
+
+def test_fused_3d():
+    np.random.seed(125)
+    f = (np.random.random_sample((9,12,13))*200).astype(np.uint8)
+    yield _compare_fused, f, None
+    Bc = (np.random.random_sample((4,3,5)) > .5).astype(np.uint8)
+    yield _compare_fused, f, Bc
+    yield _compare_fused, f > 100, Bc.astype(bool)
+    yield _compare_fused, f[:,::2], np.ones((5,1,1), np.uint8)
+
+def test_fused_1d_4d():
+    np.random.seed(126)
+    f = (np.random.random_sample(64)*200).astype(np.uint8)
+    yield _compare_fused, f, np.ones(3, np.uint8)
+    f = (np.random.random_sample((4,5,6,7))*200).astype(np.uint8)
+    yield _compare_fused, f, None
+
+def _disk(r):
+    Y,X = np.mgrid[-r:r+1,-r:r+1]
+    return (X**2 + Y**2) <= r*r
+
+def _octagon(r):
+    Y,X = np.abs(np.mgrid[-r:r+1,-r:r+1])
+    return (X + Y) <= (3*r)//2
+
+def _compare_decomposed(f, Bc):
+    from mahotas import _morph
+    from mahotas.morph import erode, dilate, _decompose_structuring_elem
+    Bc = get_structuring_elem(f, Bc)
+    assert _decompose_structuring_elem(Bc) is not None
+    assert np.all(erode(f, Bc) == _morph.erode(f, Bc, np.empty_like(f)))
+    assert np.all(dilate(f, Bc) == _morph.dilate(f, Bc, np.empty_like(f)))
+
+def test_decomposed():
+    np.random.seed(128)
+    for dtype in (np.bool_, np.uint8, np.uint16):
+        if dtype == np.bool_:
+            f = np.random.random_sample((47,39)) > .3
+        else:
+            f = (np.random.random_sample((47,39))*200).astype(dtype)
+        for Bc in (None, 8, _disk(1), _disk(3), _disk(7), _disk(30), _octagon(4), _octagon(9), np.ones((3,7)), np.ones((1,5))):
+            if Bc is not None and type(Bc) != int:
+                Bc = Bc.astype(dtype)
+            yield _compare_decomposed, f, Bc
+        Bc = _disk(5).astype(dtype)
+        yield _compare_decomposed, f[::2,::3], Bc
+        yield _compare_decomposed, f[:3], Bc
+        if dtype != np.bool_:
+            yield _compare_decomposed, f, Bc*7
+
+def test_decomposed_signed():
+    np.random.seed(130)
+    f = (np.random.random_sample((31,37))*200 - 100).astype(np.int16)
+    for r in (1, 4, 9):
+        # For signed types, zero is not the minimum value, and is part of Bc
+        Bc = np.where(_disk(r), 1, np.iinfo(np.int16).min).astype(np.int16)
+        yield _compare_decomposed, f, Bc
+    yield _compare_decomposed, f, np.ones((3,5), np.int16)
+
+def test_decomposed_3d():
+    np.random.seed(129)
+    f = (np.random.random_sample((9,17,13))*200).astype(np.uint8)
+    yield _compare_decomposed, f, np.ones((3,5,3), np.uint8)
+    yield _compare_decomposed, f > 90, np.ones((5,1,3), np.bool_)
+
+def test_not_decomposable():
+    from mahotas.morph import _decompose_structuring_elem
+    assert _decompose_structuring_elem(np.array([[0,1,1],[1,1,1],[0,1,0]], np.bool_)) is None
+    assert _decompose_structuring_elem(np.array([[1,0,1],[1,1,1],[1,0,1]], np.bool_)) is None
+    assert _decompose_structuring_elem(np.array([[1,2,1],[2,2,2],[1,2,1]], np.uint8)) is None
+    assert _decompose_structuring_elem(np.ones((2,3), np.uint8)) is None
+    assert _decompose_structuring_elem(get_structuring_elem(np.zeros((4,4,4), np.bool_), 1)) is None
+
+def test_fused_out():
+    from mahotas.morph import open
+    np.random.seed(127)
+    f = (np.random.random_sample((16,16))*200).astype(np.uint8)
+    out = np.zeros_like(f)
+    r = open(f, out=out)
+    assert r is out
+    assert np.all(out == open(f))
+
 
 def slow_reg(A, agg):
     def get(i, j):
@@ -89,3 +198,83 @@ def test_dilate_crash():
     small = large[128:256,128:256]
     dilate(small)
 
+
+
+def slow_attribute_open(f, attribute, threshold, Bc):
+    import mahotas
+    res = np.zeros_like(f)
+    res[...] = f.min()
+    for level in range(f.min(), f.max()+1):
+        labeled,n = mahotas.label(f >= level, Bc)
+        for i in range(1, n+1):
+            region = (labeled == i)
+            if attribute == 'area':
+                value = region.sum()
+            elif attribute == 'volume':
+                value = (f[region].astype(float) - level + 1).sum()
+            elif attribute == 'height':
+                value = f[region].max() - level + 1
+            elif attribute == 'extent':
+                value = max(region.any(1).sum(), region.any(0).sum())
+            if value >= threshold:
+                res[region] = np.maximum(res[region], level)
+    return res
+
+def test_attribute_open():
+    from mahotas.morph import attribute_open, areaopen
+    np.random.seed(125)
+    for Bc in (None, np.ones((3,3), bool)):
+        Bc_arr = get_structuring_elem(np.zeros((2,2)), Bc)
+        for dtype in (np.uint8, np.uint16, np.int32):
+            f = (np.random.random_sample((24,24))*8).astype(dtype)
+            for attribute,threshold in [('area', 5), ('volume', 12), ('height', 3), ('extent', 4)]:
+                assert np.all(attribute_open(f, attribute, threshold, Bc) == slow_attribute_open(f, attribute, threshold, Bc_arr))
+            assert np.all(areaopen(f, 7, Bc) == attribute_open(f, 'area', 7, Bc))
+
+def test_area_close():
+    from mahotas.morph import areaclose
+    np.random.seed(126)
+    f = (np.random.random_sample((24,24))*8).astype(np.uint8)
+    expected = 7 - slow_attribute_open(7 - f, 'area', 6, get_structuring_elem(f, None))
+    assert np.all(areaclose(f, 6) == expected)
+
+def test_areaopen_bool():
+    from mahotas.morph import areaopen
+    f = np.zeros((16,16), bool)
+    f[2:4,2:4] = 1
+    f[8:14,8:14] = 1
+    r = areaopen(f, 10)
+    assert r.dtype == np.bool_
+    assert not r[2:4,2:4].any()
+    assert np.all(r[8:14,8:14])
+    assert r.sum() == 36
+
+def slow_hmax(f, h):
+    from scipy import ndimage
+    f = f.astype(np.int64)
+    g = np.maximum(f - h, f.min() if h > f.max() else f - h)
+    while True:
+        ng = np.minimum(ndimage.grey_dilation(g, footprint=get_structuring_elem(f, None).astype(bool)), f)
+        if np.all(ng == g):
+            return g
+        g = ng
+
+def test_hmax_hmin():
+    from mahotas.morph import hmax, hmin
+    np.random.seed(127)
+    for i in range(4):
+        f = (np.random.random_sample((32,32))*32).astype(np.int32)
+        for h in (1, 3, 9):
+            assert np.all(hmax(f, h) == slow_hmax(f, h))
+            assert np.all(hmin(f, h) == -slow_hmax(-f, h))
+
+def test_hmax_saturate():
+    from mahotas.morph import hmax, hmin
+    f = np.zeros((8,8), np.uint8)
+    f[2:4,2:4] = 3
+    f[5,5] = 255
+    r = hmax(f, 10)
+    assert r[2,2] == 0
+    assert r[5,5] == 245
+    assert np.all(hmax(f, 1000) == 0)
+    assert np.all(hmin(255 - f, 1000) == 255)
@@ -1,4 +1,5 @@
 import numpy as np
+import mahotas
 import mahotas.features.surf as surf
 from mahotas.features import _surf
 from nose.tools import raises
@@ -17,6 +18,17 @@ def test_integral2():
     for y,x in np.indices(f.shape).reshape((2,-1)).T:
         assert fi[y,x] == f[:y+1,:x+1].sum()
 
+def test_integral_types():
+    f = np.arange(8*16).reshape((8,16)) % 8
+    expected = f.cumsum(0).cumsum(1)
+    for dtype in (np.uint8, np.int32, np.uint16, np.float32):
+        g = f.astype(dtype)
+        fi = surf.integral(g, in_place=True)
+        assert fi is g
+        assert np.all(fi == expected.astype(dtype))
+    fi = surf.integral(f, dtype=np.int32)
+    assert fi.dtype == np.int32
+    assert np.all(fi == expected)
 
 def test_sum_rect():
     f = np.arange(800*160).reshape((800,160)) % 7
@@ -85,3 +97,178 @@ def test_interest_points_descriptor_only():
 @raises(ValueError)
 def test_3d_image():
     surf.surf(np.arange(8*8*16).reshape((16,8,8)), 6, 24, 1)
+
+def _slow_hessian(fi, y, x, lobe_size):
+    def csum(dy, dx, h, w):
+        y0 = y + dy - h//2
+        x0 = x + dx - w//2
+        return _surf.sum_rect(fi, y0, x0, y0 + h, x0 + w)
+    lobe_offset = lobe_size//2 + 1
+    area_inv = 1./(3.*lobe_size)**2
+    Dxx = (csum(0, 0, 2*lobe_size-1, 3*lobe_size) - 3.*csum(0, 0, 2*lobe_size-1, lobe_size))*area_inv
+    Dyy = (csum(0, 0, 3*lobe_size, 2*lobe_size-1) - 3.*csum(0, 0, lobe_size, 2*lobe_size-1))*area_inv
+    Dxy = (csum(-lobe_offset, +lobe_offset, lobe_size, lobe_size)
+            + csum(+lobe_offset, -lobe_offset, lobe_size, lobe_size)
+            - csum(+lobe_offset, +lobe_offset, lobe_size, lobe_size)
+            - csum(-lobe_offset, -lobe_offset, lobe_size, lobe_size))*area_inv
+    determinant = max(Dxx*Dyy - 0.36*Dxy*Dxy, 0)
+    return (-1 if Dxx + Dyy < 0 else +1)*determinant
+
+def test_pyramid():
+    np.random.seed(41)
+    f = np.random.rand(96, 80)*200
+    fi = surf.integral(f)
+    for nr_threads in (1, 3):
+        pyramid = surf._pyramid(fi, 2, 4, 1, nr_threads)
+        assert len(pyramid) == 2
+        for o,layer in enumerate(pyramid):
+            step = 2**o
+            assert layer.shape == (4, 96//step, 80//step)
+            border = int(np.ceil(3*(2**(o+1)*5 + 1)/2.))*step
+            for i in range(4):
+                lobe_size = 2**(o+1)*(i+1) + 1
+                for y in range(border, 96 - border, step):
+                    for x in range(border, 80 - border, 3*step):
+                        assert np.abs(layer[i, y//step, x//step] - _slow_hessian(fi, y, x, lobe_size)) < 1e-10
+
+def test_surf_threads():
+    np.random.seed(42)
+    f = np.random.rand(256,256)*230
+    single = surf.surf(f, 4, 6, 1, nr_threads=1)
+    for nr_threads in (2, 5):
+        assert np.all(surf.surf(f, 4, 6, 1, nr_threads=nr_threads) == single)
+
+def test_descriptors_threads():
+    np.random.seed(43)
+    f = np.random.rand(128,128)*230
+    fi = surf.integral(f)
+    points = surf.interest_points(fi, 4, 6, 1, is_integral=True)
+    single = surf.descriptors(fi, points, is_integral=True, nr_threads=1)
+    # a point too close to the border is dropped
+    points = np.vstack([points, [2., 2., 2., 1., 1.]])
+    assert np.all(surf.descriptors(fi, points, is_integral=True, nr_threads=1) == single)
+    for nr_threads in (2, 7):
+        assert np.all(surf.descriptors(fi, points, is_integral=True, nr_threads=nr_threads) == single)
+
+def test_upright():
+    np.random.seed(44)
+    f = np.random.rand(128,128)*230
+    fi = surf.integral(f)
+    points = surf.interest_points(fi, 4, 6, 1, is_integral=True)
+    rotated = surf.descriptors(fi, points, is_integral=True)
+    upright = surf.descriptors(fi, points, is_integral=True, upright=True)
+    assert rotated.shape == upright.shape
+    assert np.all(upright[:,5] == 0)
+    assert np.all(upright[:,:5] == rotated[:,:5])
+    # with zero orientation, U-SURF is the same as SURF
+    zero = (rotated[:,5] == 0)
+    assert np.all(upright[zero] == rotated[zero])
+
+def test_extended():
+    np.random.seed(45)
+    f = np.random.rand(128,128)*230
+    spoints = surf.surf(f, 4, 6, 1)
+    extended = surf.surf(f, 4, 6, 1, extended=True)
+    assert extended.shape == (len(spoints), 6 + 128)
+    assert np.all(extended[:,:6] == spoints[:,:6])
+    assert np.allclose((extended[:,6:]**2).sum(1), 1.)
+    # each pair of elements of the extended descriptor sums to an element of
+    # the regular one (up to the normalization)
+    for ext, reg in zip(extended[:,6:], spoints[:,6:]):
+        ext = ext.reshape((16,4,2)).sum(2)
+        ext /= np.sqrt((ext**2).sum())
+        assert np.allclose(ext.ravel(), reg)
+    assert np.all(surf.surf(f, 4, 6, 1, extended=True, descriptor_only=True) == extended[:,6:])
+
+def _slow_match(d0, d1, ratio):
+    pairs = []
+    for i, d in enumerate(d0):
+        dists = np.sqrt(((d1 - d)**2).sum(1))
+        order = dists.argsort()
+        if len(order) == 1 or dists[order[0]] < ratio * dists[order[1]]:
+            pairs.append((i, order[0]))
+    return np.array(pairs, np.intp).reshape((-1,2))
+
+def test_match():
+    np.random.seed(46)
+    f = np.random.rand(128,128)*230
+    spoints = surf.surf(f, 4, 6, 1)
+    # shifting the image should not change the descriptors (just the positions)
+    shifted = surf.surf(np.roll(f, 9, axis=1), 4, 6, 1)
+    pairs = surf.match(spoints, shifted)
+    assert len(pairs) > 0
+    assert np.allclose(spoints[pairs[:,0],1] + 9, shifted[pairs[:,1],1])
+    assert np.all(spoints[pairs[:,0],4] == shifted[pairs[:,1],4])
+
+def test_match_slow():
+    np.random.seed(47)
+    d0 = np.random.rand(60, 64)
+    d1 = np.random.rand(90, 64)
+    for ratio in (.8, .95, 1.):
+        expected = _slow_match(d0, d1, ratio)
+        assert np.all(surf.match(d0, d1, ratio) == expected)
+        assert np.all(surf.match(d0, d1, ratio, nr_threads=3) == expected)
+        assert np.all(surf.match(d0, d1, ratio, method='kdtree') == expected)
+    pairs, dists = surf.match(d0, d1, 1., return_distances=True)
+    assert np.allclose(dists, np.sqrt(((d0[pairs[:,0]] - d1[pairs[:,1]])**2).sum(1)))
+    approx = surf.match(d0, d1, 1., method='kdtree', max_checks=16)
+    assert len(approx) == len(d0)
+
+def test_match_laplacian():
+    np.random.seed(48)
+    spoints0 = np.random.rand(40, 6 + 64)
+    spoints1 = np.random.rand(50, 6 + 64)
+    spoints0[:,4] = np.sign(np.random.rand(40) - .5)
+    spoints1[:,4] = np.sign(np.random.rand(50) - .5)
+    pairs = surf.match(spoints0, spoints1, 1.)
+    assert len(pairs) == len(spoints0)
+    assert np.all(spoints0[pairs[:,0],4] == spoints1[pairs[:,1],4])
+    for positive in (True, False):
+        sel0 = np.flatnonzero((spoints0[:,4] > 0) == positive)
+        sel1 = np.flatnonzero((spoints1[:,4] > 0) == positive)
+        expected = _slow_match(spoints0[sel0,6:], spoints1[sel1,6:], 1.)
+        matched = dict(pairs)
+        for i,j in expected:
+            assert matched[sel0[i]] == sel1[j]
+    assert np.all(surf.match(spoints0, spoints1, .9, method='kdtree') == surf.match(spoints0, spoints1, .9))
+    assert len(surf.match(spoints0, spoints1[:0])) == 0
+
+def test_tiled():
+    np.random.seed(49)
+    f = mahotas.gaussian_filter(np.random.rand(400,360), 2)*255
+    for max_points in (None, 40):
+        points = surf.interest_points(f, 2, 4, 1, max_points=max_points)
+        tiled = surf.interest_points(f, 2, 4, 1, max_points=max_points, tile_size=100)
+        assert points.shape == tiled.shape
+        # Compare whole points (rows), independently of their order
+        def sort_rows(p):
+            return p[np.lexsort(p.T[::-1])]
+        assert np.allclose(sort_rows(points), sort_rows(tiled))
+    spoints = surf.surf(f, 2, 4, 1)
+    tiled = surf.surf(f, 2, 4, 1, tile_size=100)
+    assert spoints.shape == tiled.shape
+    assert np.allclose(spoints, tiled)
+    assert np.allclose(surf.surf(f, 2, 4, 1, tile_size=100, descriptor_only=True), spoints[:,6:])
+
+def test_max_points():
+    np.random.seed(50)
+    f = mahotas.gaussian_filter(np.random.rand(256,256), 2)*255
+    points = surf.interest_points(f, 3, 4, 1)
+    assert np.all(np.diff(points[:,3]) <= 0)
+    for max_points in (0, 1, 17, 200, len(points) + 10):
+        top = surf.interest_points(f, 3, 4, 1, max_points=max_points)
+        assert len(top) == min(max_points, len(points))
+        assert np.all(top[:,3] == points[:len(top),3])
+
+def test_no_threshold():
+    np.random.seed(51)
+    f = mahotas.gaussian_filter(np.random.rand(256,256), 2)*255
+    allpoints = surf.interest_points(f, 3, 4, 1, threshold=0.)
+    points = surf.interest_points(f, 3, 4, 1, threshold=None, max_points=30)
+    assert len(points) == 30
+    assert np.all(points[:,3] == allpoints[:30,3])
+    assert len(surf.surf(f, 3, 4, 1, threshold=None, max_points=30)) <= 30
+
+@raises(ValueError)
+def test_no_threshold_no_max():
+    surf.interest_points(np.zeros((64,64)), threshold=None)
@@ -86,6 +86,178 @@ def test_cooccurence3():
     for di, (d0,d1,d2) in enumerate(texture._3d_deltas):
         assert np.all(texture.cooccurence(f, di, symmetric=False) == brute_force3(f, d0, d1, d2))
 
+def _entropy(p):
+    p = p.ravel()
+    return -np.dot(np.log(p+(p==0)),p)/np.log(2.0)
+
+def slow_haralick(f, ignore_zeros=False, preserve_haralick_bug=False):
+    deltas = ([(0,1),(1,1),(1,0),(1,-1)] if f.ndim == 2 else texture._3d_deltas)
+    feats = np.zeros((len(deltas), 13), np.double)
+    fm1 = f.max() + 1
+    k = np.arange(fm1)
+    tk = np.arange(2*fm1)
+    i,j = np.mgrid[:fm1,:fm1]
+    for dir,delta in enumerate(deltas):
+        cmat = (brute_force(f, *delta) if f.ndim == 2 else brute_force3(f, *delta))
+        cmat += cmat.T
+        if ignore_zeros:
+            cmat[0] = 0
+            cmat[:,0] = 0
+        if not cmat.sum():
+            continue
+        p = cmat / cmat.sum()
+        px = p.sum(0)
+        py = p.sum(1)
+        ux = np.dot(px, k)
+        uy = np.dot(py, k)
+        vx = np.dot(px, k**2) - ux**2
+        vy = np.dot(py, k**2) - uy**2
+        sx = np.sqrt(vx)
+        sy = np.sqrt(vy)
+        px_plus_y = np.array([p[(i+j) == s].sum() for s in tk])
+        px_minus_y = np.array([p[np.abs(i-j) == s].sum() for s in k])
+        feats[dir, 0] = (p**2).sum()
+        feats[dir, 1] = np.dot(k**2, px_minus_y)
+        feats[dir, 2] = (1. if (sx == 0 or sy == 0) else ((i*j*p).sum() - ux*uy)/sx/sy)
+        feats[dir, 3] = vx
+        feats[dir, 4] = (p/(1. + (i-j)**2)).sum()
+        feats[dir, 5] = np.dot(tk, px_plus_y)
+        feats[dir, 7] = _entropy(px_plus_y)
+        if preserve_haralick_bug:
+            feats[dir, 6] = ((tk-feats[dir, 7])**2*px_plus_y).sum()
+        else:
+            feats[dir, 6] = np.dot(tk**2, px_plus_y) - feats[dir, 5]**2
+        feats[dir, 8] = _entropy(p)
+        feats[dir, 9] = px_minus_y.var()
+        feats[dir, 10] = _entropy(px_minus_y)
+        HX = _entropy(px)
+        HY = _entropy(py)
+        crosspxpy = np.outer(px,py)
+        crosspxpy += (crosspxpy == 0)
+        HXY1 = -(p * np.log2(crosspxpy)).sum()
+        HXY2 = _entropy(crosspxpy)
+        feats[dir, 11] = (feats[dir,8]-HXY1)/(max(HX,HY) if max(HX, HY) else 1.)
+        feats[dir, 12] = np.sqrt(1 - np.exp( -2. * (HXY2 - feats[dir,8])))
+    return feats
+
+def test_haralick_slow():
+    np.random.seed(224)
+    f = (np.random.rand(24, 28)*20).astype(np.uint8)
+    for ignore_zeros in (False, True):
+        for bug in (False, True):
+            assert np.allclose(texture.haralick(f, ignore_zeros, bug), slow_haralick(f, ignore_zeros, bug))
+    f = (np.random.rand(8, 9, 7)*12).astype(np.int32)
+    assert np.allclose(texture.haralick(f), slow_haralick(f))
+    assert np.allclose(texture.haralick(f[:,::2]), slow_haralick(f[:,::2]))
+    assert np.allclose(texture.haralick(f[0].T), slow_haralick(f[0].T))
+
+def _haralick_forced(f, sparse, **kwargs):
+    max_dense_levels = texture._max_dense_levels
+    texture._max_dense_levels = (0 if sparse else 2**16)
+    try:
+        return texture.haralick(f, **kwargs)
+    finally:
+        texture._max_dense_levels = max_dense_levels
+
+def test_haralick_sparse():
+    np.random.seed(225)
+    f = (np.random.rand(24, 28)*20).astype(np.uint8)
+    for ignore_zeros in (False, True):
+        for bug in (False, True):
+            feats = _haralick_forced(f, True, ignore_zeros=ignore_zeros, preserve_haralick_bug=bug)
+            assert np.allclose(feats, slow_haralick(f, ignore_zeros, bug))
+
+    values = np.array([0, 3, 17, 502, 900, 1023], np.uint16)
+    f = values[(np.random.rand(24, 28)*len(values)).astype(int)]
+    for ignore_zeros in (False, True):
+        sparse = _haralick_forced(f, True, ignore_zeros=ignore_zeros, compute_14th_feature=True)
+        dense = _haralick_forced(f, False, ignore_zeros=ignore_zeros, compute_14th_feature=True)
+        assert np.allclose(sparse, dense)
+    f = (np.random.rand(6, 8, 7)*1000).astype(np.int32)
+    assert np.allclose(_haralick_forced(f, True), _haralick_forced(f, False))
+
+def test_haralick_16bit():
+    np.random.seed(226)
+    f = (np.random.rand(32, 32)*65535).astype(np.uint16)
+    feats = texture.haralick(f, compute_14th_feature=True)
+    assert feats.shape == (4, 14)
+    assert not np.any(np.isnan(feats))
+
+def test_haralick_nr_grey_levels():
+    np.random.seed(227)
+    f = (np.random.rand(32, 40)*4096).astype(np.uint16)
+    for levels in (8, 32, 256):
+        quantised = (f.astype(np.int64) * levels // (f.max() + 1))
+        assert np.allclose(texture.haralick(f, nr_grey_levels=levels), texture.haralick(quantised))
+    assert np.allclose(texture.haralick(f, nr_grey_levels=f.max()+1), texture.haralick(f))
+
+def test_haralick_nr_grey_levels_boundary():
+    # 22 * 30 / 44 is exactly 15 (but 22 * (30 / 44.) is just below it)
+    f = np.tile(np.arange(44, dtype=np.uint8), 6).reshape((12, 22))
+    f[:, 1::3] = 22
+    quantised = (f.astype(np.int64) * 30 // 44)
+    assert quantised.max() == 29
+    assert np.all(quantised[:, 1::3] == 15)
+    assert np.allclose(texture.haralick(f, nr_grey_levels=30), texture.haralick(quantised))
+    assert np.allclose(texture.haralick_map(f, 3, nr_grey_levels=30), texture.haralick_map(quantised, 3))
+
+def slow_haralick_map(f, window, **kwargs):
+    ry, rx = window[0]//2, window[1]//2
+    h, w = f.shape
+    res = np.zeros((h, w, 4, 13))
+    for y in range(h):
+        for x in range(w):
+            crop = f[max(0, y-ry):y+ry+1, max(0, x-rx):x+rx+1]
+            feats = texture.haralick(crop, **kwargs)
+            # The difference variance is a variance over all grey levels,
+            # which are those of the whole image in haralick_map
+            n = crop.max() + 1
+            N = f.max() + 1
+            nonempty = (feats[:,0] > 0)
+            feats[nonempty,9] = n*(feats[nonempty,9] + 1./n/n)/N - 1./N/N
+            res[y, x] = feats
+    return res
+
+def test_haralick_map():
+    np.random.seed(228)
+    f = (np.random.rand(17, 23)*12).astype(np.uint8)
+    for window in [(3,3), (5,7), (1,3), (31,31)]:
+        for ignore_zeros in (False, True):
+            expected = slow_haralick_map(f, window, ignore_zeros=ignore_zeros)
+            for nr_threads in (1, 3):
+                computed = texture.haralick_map(f, window, ignore_zeros=ignore_zeros, return_mean=False, nr_threads=nr_threads)
+                assert np.allclose(computed, expected)
+    assert np.allclose(texture.haralick_map(f, 5), slow_haralick_map(f, (5,5)).mean(2))
+    assert np.allclose(texture.haralick_map(f, 5, nr_threads=3), slow_haralick_map(f, (5,5)).mean(2))
+    assert np.allclose(
+            texture.haralick_map(f, 3, preserve_haralick_bug=True, return_mean=False),
+            slow_haralick_map(f, (3,3), preserve_haralick_bug=True))
+
+def test_haralick_map_flat():
+    np.random.seed(230)
+    f = (np.random.rand(40, 40)*8).astype(np.uint8)
+    f[:20, :20] = 3
+    f[25:, 10:30] = 0
+    computed = texture.haralick_map(f, 5, return_mean=False)
+    assert not np.any(np.isnan(computed))
+    # Feature 12 is sqrt(1 - exp(-2 x)): close to zero, rounding errors in x
+    # (~1e-16) become ~1e-8
+    assert np.allclose(computed, slow_haralick_map(f, (5,5)), atol=1e-6)
+
+def test_haralick_map_levels():
+    np.random.seed(229)
+    f = (np.random.rand(20, 16)*4000).astype(np.uint16)
+    quantised = (f.astype(np.int64) * 16 // (f.max() + 1))
+    assert np.allclose(texture.haralick_map(f, 5, nr_grey_levels=16), texture.haralick_map(quantised, 5))
+
+@raises(ValueError)
+def test_haralick_map_even_window():
+    texture.haralick_map(np.zeros((8,8), np.uint8), 4)
+
+@raises(ValueError)
+def test_haralick_negative():
+    texture.haralick(np.arange(-4,12).reshape((4,4)))
+
 def test_haralick():
     np.random.seed(123)
     f = np.random.rand(1024, 1024)
@@ -65,3 +65,46 @@ def test_zernike_cm():
     delta = np.array(slow) - fast
     assert np.abs(delta).max() < 0.001
 
+
+def test_zernike_high_degree():
+    np.random.seed(39)
+    A = (np.random.random_sample((24, 24)) * 32).astype(np.uint8)
+    slow = _slow_zernike(A, 12., 20)
+    fast = zernike_moments(A, 12., 20)
+    assert np.abs(slow - fast).max() < 1e-6
+
+def test_zernike_threads():
+    np.random.seed(40)
+    A = np.random.random_sample((37, 29))
+    single = zernike_moments(A, 14., 10, nr_threads=1)
+    for nr_threads in (2, 3, 64):
+        assert np.allclose(zernike_moments(A, 14., 10, nr_threads=nr_threads), single)
+
+def test_zernike_centre_pixel():
+    A = np.zeros((9, 9))
+    A[2:7,2:7] = 1
+    # The centre of mass falls exactly on a pixel (radius 0)
+    moments = zernike_moments(A, 4., 6)
+    assert np.all(np.isfinite(moments))
+    assert moments[0] > 0
+
+def test_zernike_basis():
+    from mahotas.features import ZernikeBasis
+    np.random.seed(41)
+    images = (np.random.random_sample((300, 17, 21)) * 16).astype(np.uint8)
+    basis = ZernikeBasis(9., 8, (17, 21))
+    batch = basis.moments(images)
+    assert batch.shape == (300, len(zernike_moments(images[0], 9., 8)))
+    assert np.allclose(batch, basis.moments(images.reshape((300, -1))))
+    for i in (0, 1, 255, 256, 299):
+        expected = zernike_moments(images[i], 9., 8, cm=(8., 10.))
+        assert np.allclose(basis.moments(images[i]), expected)
+        assert np.allclose(batch[i], expected)
+
+def test_zernike_basis_cm():
+    from mahotas.features import ZernikeBasis
+    np.random.seed(42)
+    A = np.random.random_sample((16, 16)) - .2
+    basis = ZernikeBasis(6., 6, A.shape, cm=(7.3, 6.1))
+    assert np.allclose(basis.moments(A), zernike_moments(A, 6., 6, cm=(7.3, 6.1)))
+    assert np.all(basis.moments(np.zeros((2, 16, 16))) == 0)
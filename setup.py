@@ -49,7 +49,9 @@ extensions = {
     'mahotas._convex': ['mahotas/_convex.cpp'],
     'mahotas._convolve': ['mahotas/_convolve.cpp', 'mahotas/_filters.cpp'],
     'mahotas._distance': ['mahotas/_distance.cpp'],
+    'mahotas._euler': ['mahotas/_euler.cpp'],
     'mahotas._histogram': ['mahotas/_histogram.cpp'],
+    'mahotas._integral': ['mahotas/_integral.cpp'],
     'mahotas._interpolate': ['mahotas/_interpolate.cpp', 'mahotas/_filters.cpp'],
     'mahotas._labeled': ['mahotas/_labeled.cpp', 'mahotas/_filters.cpp'],
     'mahotas._morph': ['mahotas/_morph.cpp', 'mahotas/_filters.cpp'],
@@ -57,6 +59,7 @@ extensions = {
 
     'mahotas.features._lbp': ['mahotas/features/_lbp.cpp'],
     'mahotas.features._surf': ['mahotas/features/_surf.cpp'],
+    'mahotas.features._tas': ['mahotas/features/_tas.cpp'],
     'mahotas.features._texture': ['mahotas/features/_texture.cpp', 'mahotas/_filters.cpp'],
     'mahotas.features._zernike': ['mahotas/features/_zernike.cpp'],
 }